@@ -134,6 +134,17 @@ const char *buffer_content0(Buffer *buf) {
 	return buf->data;
 }
 
+ssize_t buffer_read(Buffer *buf, int fd, size_t len) {
+	if (!buffer_grow(buf, len)) {
+		errno = ENOMEM;
+		return -1;
+	}
+	ssize_t n = read(fd, buf->data + buf->len, buf->size - buf->len);
+	if (n > 0)
+		buf->len += n;
+	return n;
+}
+
 ssize_t read_into_buffer(void *context, char *data, size_t len) {
 	buffer_append(context, data, len);
 	return len;
@@ -40,6 +40,12 @@ VIS_INTERNAL bool buffer_append(Buffer*, const void *data, size_t len);
 VIS_INTERNAL bool buffer_append0(Buffer*, const char *data);
 /** Append formatted buffer content, ensures NUL termination on success. */
 VIS_INTERNAL bool buffer_appendf(Buffer*, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+/**
+ * Append data read from ``fd``, at least ``len`` bytes are requested. The read
+ * fills all of the spare capacity, which grows along with the buffer.
+ * @return The number of bytes read or ``-1`` in case of an error.
+ */
+VIS_INTERNAL ssize_t buffer_read(Buffer*, int fd, size_t len);
 /** Return length of a buffer without trailing NUL byte. */
 VIS_INTERNAL size_t buffer_length0(Buffer*);
 /**
@@ -0,0 +1,18 @@
+# This version of config.mk was generated by:
+# ./configure
+# Any changes made here will be lost if configure is re-run
+SRCDIR = .
+PREFIX = /usr/local
+EXEC_PREFIX = $(PREFIX)
+BINDIR = $(EXEC_PREFIX)/bin
+DOCPREFIX = $(PREFIX)/share/doc
+MANPREFIX = $(PREFIX)/share/man
+SHAREPREFIX = $(PREFIX)/share
+CC = cc
+CFLAGS = -Wall -pipe -Wno-initializer-overrides -O2 -ffunction-sections -fdata-sections -fPIE
+LDFLAGS = -Wl,-z,now -Wl,-z,relro
+CFLAGS_STD = -std=c99 -DNDEBUG
+LDFLAGS_STD = -lc
+CFLAGS_AUTO = -fstack-protector-all
+LDFLAGS_AUTO = -Wl,--gc-sections -pie
+CFLAGS_DEBUG = -U_FORTIFY_SOURCE -UNDEBUG -O0 -g3 -ggdb -Wall -Wextra -pedantic -Wno-missing-field-initializers -Wno-unused-parameter
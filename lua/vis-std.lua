@@ -48,36 +48,107 @@ vis:option_register("horizon", "number", function(horizon)
 	return true
 end, "Number of bytes to consider for syntax highlighting")
 
+-- Lexer states of every file, each checkpoint is the position following a
+-- whitespace token spanning a line break together with the tag of that token.
+-- Lexing resumes there without having to start farther back. They are only
+-- recorded while lexing from the start of the file or another checkpoint and
+-- kept up to the first position modified since.
+local checkpoints = {}
+-- minimal distance in bytes between two checkpoints
+local checkpoint_interval = 4096
+
+-- index of the last checkpoint at or before pos
+local function checkpoint_find(positions, pos)
+	local lo, hi, found = 1, #positions, nil
+	while lo <= hi do
+		local mid = math.floor((lo + hi) / 2)
+		if positions[mid] <= pos then
+			found, lo = mid, mid + 1
+		else
+			hi = mid - 1
+		end
+	end
+	return found
+end
+
+local function checkpoint_add(states, pos, tag)
+	local positions = states.pos
+	local i = checkpoint_find(positions, pos) or 0
+	if (positions[i] and pos - positions[i] < checkpoint_interval) or
+	   (positions[i+1] and positions[i+1] - pos < checkpoint_interval) then
+		return
+	end
+	table.insert(positions, i + 1, pos)
+	table.insert(states.tag, i + 1, tag)
+end
+
+vis.events.subscribe(vis.events.FILE_CHANGE, function(file, pos)
+	local states = checkpoints[file]
+	if not states then return end
+	local positions, tags = states.pos, states.tag
+	for i = #positions, 1, -1 do
+		if positions[i] < pos then break end
+		positions[i], tags[i] = nil, nil
+	end
+end)
+
+vis.events.subscribe(vis.events.FILE_CLOSE, function(file)
+	checkpoints[file] = nil
+end)
+
 vis.events.subscribe(vis.events.WIN_HIGHLIGHT, function(win)
 	if not win.syntax or not vis.lexers.load then return end
 	local lexer = vis.lexers.load(win.syntax, nil, true)
 	if not lexer then return end
 
-	-- TODO: improve heuristic for initial style
 	local viewport = win.viewport.bytes
 	if not viewport then return end
-	local horizon_max = win.horizon or 32768
-	local horizon = viewport.start < horizon_max and viewport.start or horizon_max
+	local states = checkpoints[win.file]
+	if not states or states.syntax ~= win.syntax then
+		states = { syntax = win.syntax, pos = {}, tag = {} }
+		checkpoints[win.file] = states
+	end
+
+	-- resume from the closest checkpoint within the horizon, otherwise assume
+	-- the lexer to be in its initial state at the horizon
+	local token_styles = lexer._TAGS
+	local horizon = win.horizon or 32768
 	local view_start = viewport.start
-	local lex_start = viewport.start - horizon
+	local lex_start = view_start < horizon and 0 or view_start - horizon
+	local init_style = 1
+	local checkpoint = checkpoint_find(states.pos, view_start)
+	if checkpoint and states.pos[checkpoint] >= lex_start then
+		lex_start = states.pos[checkpoint]
+		init_style = token_styles[states.tag[checkpoint]] or 1
+	end
+	local exact = lex_start == 0 or (checkpoint and lex_start == states.pos[checkpoint])
 	viewport.start = lex_start
 	local data = win.file:content(viewport)
-	local token_styles = lexer._TAGS
-	local tokens = lexer:lex(data, 1)
-	local token_end = lex_start + (tokens[#tokens] or 1) - 1
-
-	for i = #tokens - 1, 1, -2 do
-		local token_start = lex_start + (tokens[i-1] or 1) - 1
-		if token_end < view_start then
-			break
+	local tokens = lexer:lex(data, init_style)
+
+	-- only record states which do not depend on a guessed initial one, the
+	-- last token might continue past the viewport
+	if exact then
+		local next_checkpoint = lex_start + checkpoint_interval
+		local token_start, newline = 1, 0
+		for j = 1, #tokens - 2, 2 do
+			local token_end = tokens[j+1]
+			local pos = lex_start + token_end - 1
+			if pos >= next_checkpoint and tokens[j]:find('^whitespace') then
+				if newline < token_start then
+					newline = data:find('\n', token_start, true)
+					if not newline then break end
+				end
+				if newline < token_end then
+					checkpoint_add(states, pos, tokens[j])
+					next_checkpoint = pos + checkpoint_interval
+				end
+			end
+			token_start = token_end
 		end
-		local name = tokens[i]
-		local style = token_styles[name]
-		if style ~= nil then
-			win:style(style, token_start, token_end)
-		end
-		token_end = token_start - 1
 	end
+
+	win:style_tokens(tokens, lex_start, token_styles)
 end)
 
 local modes = {
@@ -102,6 +173,12 @@ vis.events.subscribe(vis.events.WIN_STATUS, function(win)
 
 	table.insert(left_parts, (file.name or '[No Name]') ..
 		(file.modified and ' [+]' or '') .. (vis.recording and ' @' or ''))
+	if file.loading then
+		table.insert(left_parts, string.format('loading %.1f MiB', file.size / 1048576))
+	end
+	if file.saving then
+		table.insert(left_parts, string.format('saving %d%%', file.saving))
+	end
 
 	local count = vis.count
 	local keys = vis.input_queue
@@ -142,6 +142,7 @@ end
 --- Event names.
 --- @table events
 local events = {
+	FILE_CHANGE = "Event::FILE_CHANGE", -- see @{file_change}
 	FILE_CLOSE = "Event::FILE_CLOSE", -- see @{file_close}
 	FILE_OPEN = "Event::FILE_OPEN", -- see @{file_open}
 	FILE_SAVE_POST = "Event::FILE_SAVE_POST", -- see @{file_save_post}
@@ -159,6 +160,7 @@ local events = {
 	UI_DRAW = "Event::UI_DRAW", -- see @{ui_draw}
 }
 
+events.file_change = function(...) events.emit(events.FILE_CHANGE, ...) end
 events.file_close = function(...) events.emit(events.FILE_CLOSE, ...) end
 events.file_open = function(...) events.emit(events.FILE_OPEN, ...) end
 events.file_save_post = function(...) events.emit(events.FILE_SAVE_POST, ...) end
@@ -1258,7 +1258,7 @@ int main(int argc, char *argv[])
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] != '-') {
 			continue;
-		} else if (strcmp(argv[i], "-") == 0) {
+		} else if (strcmp(argv[i], "-") == 0 || strcmp(argv[i], "-r") == 0) {
 			continue;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
@@ -1339,15 +1339,21 @@ int main(int argc, char *argv[])
 			if (strcmp(argv[i], "-") == 0) {
 				if (!vis_window_new_fd(vis, STDOUT_FILENO))
 					vis_die(vis, "Can not create empty buffer\n");
-				ssize_t len = 0;
-				char buf[PIPE_BUF];
-				Text *txt = vis_text(vis);
-				while ((len = read(STDIN_FILENO, buf, sizeof buf)) > 0)
-					text_insert(vis, txt, text_size(txt), buf, len);
-				if (len == -1)
+				/* a pipe is read in the background, a terminal until end of file */
+				int fd = dup(STDIN_FILENO);
+				if (fd == -1)
+					vis_die(vis, "Can not read from stdin\n");
+				if (isatty(fd)) {
+					ssize_t len;
+					Text *txt = vis_text(vis);
+					while ((len = text_load_fd(vis, txt, fd, SIZE_MAX)) > 0);
+					if (len == -1)
+						vis_die(vis, "Can not read from stdin\n");
+					close(fd);
+				} else if (!vis_window_load_fd(vis, fd)) {
 					vis_die(vis, "Can not read from stdin\n");
-				text_snapshot(txt);
-				int fd = open("/dev/tty", O_RDWR);
+				}
+				fd = open("/dev/tty", O_RDWR);
 				if (fd == -1)
 					vis_die(vis, "Can not reopen stdin\n");
 				dup2(fd, STDIN_FILENO);
@@ -1355,6 +1361,9 @@ int main(int argc, char *argv[])
 			} else if (strcmp(argv[i], "--") == 0) {
 				end_of_options = true;
 				continue;
+			} else if (strcmp(argv[i], "-r") == 0) {
+				vis->recover = true;
+				continue;
 			}
 		} else if (argv[i][0] == '+' && !end_of_options) {
 			cmd = argv[i] + (argv[i][1] == '/' || argv[i][1] == '?');
@@ -1369,6 +1378,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	vis->recover = false;
+
 	if (!vis->win && !win_created) {
 		if (!vis_window_new(vis, NULL))
 			vis_die(vis, "Can not create empty buffer\n");
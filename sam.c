@@ -34,11 +34,26 @@ struct SamChange {
 	Selection *sel;    /* selection associated with this change, might be NULL */
 	Filerange range;   /* inserts are denoted by zero sized range (same start/end) */
 	const char *data;  /* will be free(3)-ed after transcript has been processed */
-	size_t len;        /* size in bytes of the chunk pointed to by data */
+	TextSpan *span;    /* inserted instead of data if not NULL, released along with it */
+	size_t len;        /* size in bytes of the chunk pointed to by data or of the span */
 	SamChange *next;   /* modification position increase monotonically */
 	int count;         /* how often should data be inserted? */
 };
 
+struct SamFilter {
+	Filter filter;     /* external command, its input and exit status */
+	Win *win;          /* window in which filtered file is being displayed */
+	Selection *sel;    /* selection associated with the output, might be NULL */
+	Filerange range;   /* replaced by the output */
+	Filerange delete;  /* deleted once the command succeeded, might be empty */
+	bool output;       /* whether the output is kept */
+	bool discard;      /* whether the command would not have run if executed right away */
+	size_t loop;       /* invocation of the selection loop the command was issued from */
+	size_t iteration;  /* iteration of that loop */
+	TextSpan *out;     /* data written to stdout, stored in the text of the file */
+	Buffer err;        /* data written to stderr */
+};
+
 struct Address {
 	char type;      /* # (char) l (line) g (goto line) / ? . $ + - , ; % ' */
 	Regex *regex;   /* NULL denotes default for x, y, X, and Y commands */
@@ -60,6 +75,8 @@ struct Command {
 	Count count;              /* command count, defaults to [0,+inf] */
 	int iteration;            /* current command loop iteration */
 	char flags;               /* command specific flags */
+	size_t captures;          /* number of sub expressions referenced by it or its targets as &, \1 ... \9 */
+	bool tail;                /* whether no other command depends on its outcome */
 	Command *cmd;             /* target of x, y, g, v, X, Y, { */
 	Command *next;            /* next command in {} group */
 };
@@ -289,6 +306,13 @@ enum {
 	OPTION_IGNORECASE,
 	OPTION_BREAKAT,
 	OPTION_WRAP_COLUMN,
+	OPTION_UNDO_LEVELS,
+	OPTION_UNDO_AGE,
+	OPTION_UNDO_SIZE,
+	OPTION_SAVE_BACKGROUND,
+	OPTION_UNDO_FILE,
+	OPTION_SWAP_FILE,
+	OPTION_FILTER_JOBS,
 };
 
 static const OptionDef options[] = {
@@ -397,6 +421,41 @@ static const OptionDef options[] = {
 		VIS_OPTION_TYPE_NUMBER|VIS_OPTION_NEED_WINDOW,
 		VIS_HELP("Wrap lines at minimum of window width and wrapcolumn")
 	},
+	[OPTION_UNDO_LEVELS] = {
+		{ "undolevels" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Maximal number of undo states to keep, 0 for unlimited")
+	},
+	[OPTION_UNDO_AGE] = {
+		{ "undoage" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Seconds after which undo states are discarded, 0 for never")
+	},
+	[OPTION_UNDO_SIZE] = {
+		{ "undosize" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Maximal size in bytes of the changes kept for undo, 0 for unlimited")
+	},
+	[OPTION_SAVE_BACKGROUND] = {
+		{ "savebackground" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Minimal size in bytes of files saved in the background, 0 for never")
+	},
+	[OPTION_UNDO_FILE] = {
+		{ "undofile" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Keep the undo history of files opened subsequently across sessions")
+	},
+	[OPTION_SWAP_FILE] = {
+		{ "swapfile" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Journal the changes of files opened subsequently for crash recovery")
+	},
+	[OPTION_FILTER_JOBS] = {
+		{ "filterjobs" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Maximal number of filters of a command run at the same time")
+	},
 };
 
 bool sam_init(Vis *vis) {
@@ -435,6 +494,7 @@ const char *sam_error(enum SamError err) {
 		[SAM_ERR_LOOP_INVALID_CMD]  = "Destructive command in looping construct",
 		[SAM_ERR_GROUP_INVALID_CMD] = "Destructive command in group",
 		[SAM_ERR_COUNT]           = "Invalid count",
+		[SAM_ERR_LOADING]         = "File is still being loaded",
 	};
 
 	size_t idx = err;
@@ -445,6 +505,7 @@ static void sam_change_free(SamChange *c) {
 	if (!c)
 		return;
 	free((char*)c->data);
+	text_span_free(c->span);
 	free(c);
 }
 
@@ -522,6 +583,89 @@ static bool sam_change(Win *win, Selection *sel, Filerange *range, const char *d
 	return c;
 }
 
+/* replace the range by output of a filter, the span is owned by the change if successful */
+static bool sam_change_span(Win *win, Selection *sel, Filerange *range, TextSpan *span) {
+	SamChange *c = sam_change_new(&win->file->transcript, TRANSCRIPT_CHANGE, range, win, sel);
+	if (c) {
+		c->span = span;
+		c->len = span ? text_span_size(span) : 0;
+		c->count = 1;
+	}
+	return c;
+}
+
+/* queue the filter such that it runs in parallel to those of the other
+ * selections and matches once the command completed */
+static bool sam_filter_defer(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel,
+                             Filerange *range, Filerange *delete, bool output) {
+	SamFilterList *filters = vis->filters;
+	/* arguments other than those of the command do not outlive this call */
+	if (!filters || !win || !cmd->tail || argv != cmd->argv || !text_range_valid(range))
+		return false;
+	*da_push(vis, filters) = (SamFilter){
+		.filter = {
+			.file = win->file,
+			.range = *range,
+			.argv = &argv[1],
+		},
+		.win = win,
+		.sel = sel,
+		.range = *range,
+		.delete = delete ? *delete : text_range_empty(),
+		.output = output,
+		.loop = filters->loop,
+		.iteration = filters->iteration,
+	};
+	return true;
+}
+
+/* run the queued filters and record their output in selection order, as
+ * if they were executed one after another */
+static void sam_filters_run(Vis *vis, SamFilterList *filters) {
+	if (!filters->count)
+		return;
+
+	struct {
+		Filter    **data;
+		VisDACount  count;
+		VisDACount  capacity;
+	} list = {0};
+	da_reserve(vis, &list, filters->count);
+
+	for (VisDACount i = 0; i < filters->count; i++) {
+		SamFilter *f = filters->data + i;
+		f->filter.stdout_span = f->output ? &f->out : NULL;
+		f->filter.stderr_buffer = &f->err;
+		*da_push(vis, &list) = &f->filter;
+	}
+
+	bool completed = vis_pipe_all(vis, list.data, list.count, vis->filter_jobs);
+	if (!completed)
+		vis_info_show(vis, "Command cancelled");
+
+	for (VisDACount i = 0; i < filters->count; i++) {
+		SamFilter *f = filters->data + i;
+		if (completed && !f->discard && f->filter.status == 0) {
+			if (f->output && sam_change_span(f->win, f->sel, &f->range, f->out))
+				f->out = NULL;
+			if (text_range_valid(&f->delete))
+				sam_delete(f->win, NULL, &f->delete);
+		} else if (completed && !f->discard) {
+			vis_info_show(vis, "Command failed %s", buffer_content0(&f->err));
+			/* the selection loop would have stopped after this iteration */
+			for (VisDACount j = i + 1; j < filters->count; j++) {
+				SamFilter *next = filters->data + j;
+				if (next->loop == f->loop && next->iteration != f->iteration)
+					next->discard = true;
+			}
+		}
+		text_span_free(f->out);
+		buffer_release(&f->err);
+	}
+
+	da_release(&list);
+}
+
 static Address *address_new(void) {
 	Address *addr = calloc(1, sizeof *addr);
 	if (addr)
@@ -856,6 +1000,35 @@ static const CommandDef *command_lookup(Vis *vis, const char *name) {
 	return map_closest(vis->cmds, name);
 }
 
+/* number of sub expressions referenced by a text argument, see text() */
+static size_t text_captures(const char *text) {
+	size_t captures = 0;
+	for (; text && *text; text++) {
+		if (*text == '&') {
+			captures = MAX(captures, 1);
+		} else if (*text == '\\') {
+			if ('1' <= text[1] && text[1] <= '9')
+				captures = MAX(captures, (size_t)(text[1] - '0') + 1);
+			if (text[1] && strchr("123456789\\&", text[1]))
+				text++;
+		}
+	}
+	return captures;
+}
+
+/* the sub expressions of a match which need to be captured before the
+ * command is executed for it, user commands might access all of them */
+static size_t command_captures(const Command *cmd) {
+	size_t captures = 0;
+	if (cmd->cmddef && cmd->cmddef->func == cmd_user)
+		captures = MAX_REGEX_SUB;
+	else if (cmd->cmddef && cmd->cmddef->flags & CMD_TEXT)
+		captures = text_captures(cmd->argv[1]);
+	for (const Command *c = cmd->cmd; c; c = c->next)
+		captures = MAX(captures, command_captures(c));
+	return captures;
+}
+
 static Command *command_parse(Vis *vis, const char **s, enum SamError *err) {
 	if (!**s) {
 		*err = SAM_ERR_COMMAND;
@@ -976,6 +1149,7 @@ static Command *command_parse(Vis *vis, const char **s, enum SamError *err) {
 		}
 	}
 
+	cmd->captures = command_captures(cmd);
 	return cmd;
 fail:
 	command_free(cmd);
@@ -1163,6 +1337,15 @@ static enum SamError command_validate(Command *cmd) {
 	return validate(cmd, false, false);
 }
 
+/* a command is a tail if no subsequent command of an enclosing group is
+ * skipped when it fails, its filters can be deferred */
+static void command_tail(Command *cmd, bool tail) {
+	bool group = cmd->cmddef && (cmd->cmddef->flags & CMD_GROUP);
+	cmd->tail = tail;
+	for (Command *c = cmd->cmd; c; c = c->next)
+		command_tail(c, tail && (!group || !c->next));
+}
+
 static bool count_negative(Command *cmd) {
 	if (cmd->count.start < 0 || cmd->count.end < 0)
 		return true;
@@ -1206,6 +1389,8 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 		return err;
 	}
 
+	command_tail(cmd, true);
+
 	for (File *file = vis->files; file; file = file->next) {
 		if (file->internal)
 			continue;
@@ -1215,24 +1400,59 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 	bool visual = vis->mode->visual;
 	size_t primary_pos = vis->win ? view_cursor_get(&vis->win->view) : EPOS;
 	Filerange range = text_range_empty();
+	SamFilterList filters = {0}, *filters_outer = vis->filters;
+	vis->filters = vis->filter_jobs > 1 ? &filters : NULL;
 	sam_execute(vis, vis->win, cmd, NULL, &range);
+	vis->filters = filters_outer;
+	sam_filters_run(vis, &filters);
+	da_release(&filters);
 
 	for (File *file = vis->files; file; file = file->next) {
 		if (file->internal)
 			continue;
 		Transcript *t = &file->transcript;
+		if (t->error == SAM_ERR_OK && t->changes && text_loading(file->text))
+			t->error = SAM_ERR_LOADING;
 		if (t->error != SAM_ERR_OK) {
 			err = t->error;
 			sam_transcript_free(t);
 			continue;
 		}
+		/* apply all changes at once, repeated insertions follow each other */
+		TextEditList edits = {0};
+		for (SamChange *c = t->changes; c; c = c->next) {
+			bool insert = (c->type & TRANSCRIPT_INSERT) && c->count > 0;
+			*da_push(vis, &edits) = (TextEdit){
+				.range = c->range,
+				.data = insert ? c->data : NULL,
+				.len = insert ? c->len : 0,
+				.span = insert ? c->span : NULL,
+			};
+			for (int i = 1; insert && i < c->count; i++) {
+				*da_push(vis, &edits) = (TextEdit){
+					.range = text_range_new(c->range.end, c->range.end),
+					.data = c->data,
+					.len = c->len,
+				};
+			}
+		}
 		vis_file_snapshot(vis, file);
+		bool edited = text_edit(vis, file->text, edits.data, edits.count);
+		da_release(&edits);
+		if (!edited) {
+			/* the selections can not be placed, the changes applied
+			 * before the failure are recorded and can be undone */
+			err = SAM_ERR_MEMORY;
+			sam_transcript_free(t);
+			vis_file_snapshot(vis, file);
+			continue;
+		}
+
 		ptrdiff_t delta = 0;
 		for (SamChange *c = t->changes; c; c = c->next) {
 			c->range.start += delta;
 			c->range.end += delta;
 			if (c->type & TRANSCRIPT_DELETE) {
-				text_delete_range(file->text, &c->range);
 				delta -= text_range_size(&c->range);
 				if (c->sel && c->type == TRANSCRIPT_DELETE) {
 					if (visual)
@@ -1242,10 +1462,7 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 				}
 			}
 			if (c->type & TRANSCRIPT_INSERT) {
-				for (int i = 0; i < c->count; i++) {
-					text_insert(vis, file->text, c->range.start, c->data, c->len);
-					delta += c->len;
-				}
+				delta += c->len * c->count;
 				Filerange r = text_range_new(c->range.start,
 				                             c->range.start + c->len * c->count);
 				if (c->sel) {
@@ -1253,7 +1470,10 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 						view_selections_set(c->sel, &r);
 						c->sel->anchored = true;
 					} else {
-						if (memchr(c->data, '\n', c->len))
+						bool newline = c->span ?
+							text_lineno_by_pos(file->text, r.start) != text_lineno_by_pos(file->text, r.end) :
+							memchr(c->data, '\n', c->len) != NULL;
+						if (newline)
 							view_cursors_to(c->sel, r.start);
 						else
 							view_cursors_to(c->sel, r.end);
@@ -1379,71 +1599,105 @@ static bool cmd_guard(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 	return true;
 }
 
+typedef struct {
+	Vis *vis;
+	Win *win;
+	Command *cmd;
+	Filerange *range;
+	bool extract;      /* whether matches (x) or the text in between (y) is extracted */
+	bool simulate;     /* only count the ranges which would be extracted */
+	bool done;         /* whether the last match was filtered out at EOF */
+	bool ret;
+	int count;
+	size_t nsub;
+	size_t start;      /* position from where the search continues */
+	size_t last_start; /* end of the previously extracted range */
+	size_t captures;   /* sub expressions stored in registers for every match */
+	bool matched;      /* whether there was a match, the last one is kept */
+	RegexMatch match[MAX_REGEX_SUB];
+} Extraction;
+
+static bool extract_match(RegexMatch match[], void *data) {
+	Extraction *ex = data;
+	Text *txt = ex->win->file->text;
+	size_t start = ex->start, end = ex->range->end;
+	Filerange r;
+	if (ex->extract)
+		r = text_range_new(match[0].start, match[0].end);
+	else
+		r = text_range_new(ex->last_start, match[0].start);
+	if (match[0].start == match[0].end) {
+		ex->start = match[0].end + 1;
+		if (ex->last_start == match[0].start)
+			return true;
+		/* in Plan 9's regexp library ^ matches the beginning
+		 * of a line, however in POSIX with REG_NEWLINE ^
+		 * matches the zero-length string immediately after a
+		 * newline. Try filtering out the last such match at EOF.
+		 */
+		char c;
+		if (end == match[0].start && start > ex->range->start &&
+		    text_byte_get(txt, end-1, &c) && c == '\n') {
+			ex->done = true;
+			return false;
+		}
+	} else {
+		ex->start = match[0].end;
+	}
+
+	if (text_range_valid(&r)) {
+		/* only capture what the command refers to, the rest once done */
+		for (size_t i = 0; i < ex->captures; i++) {
+			Register *reg = &ex->vis->registers[VIS_REG_AMPERSAND+i];
+			register_put_range(ex->vis, reg, txt, &match[i]);
+		}
+		memcpy(ex->match, match, ex->nsub * sizeof *match);
+		ex->matched = true;
+		ex->last_start = match[0].end;
+		if (ex->simulate)
+			ex->count++;
+		else
+			ex->ret &= sam_execute(ex->vis, ex->win, ex->cmd->cmd, NULL, &r);
+	}
+	return true;
+}
+
 static int extract(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range, bool simulate) {
 	bool ret = true;
 	int count = 0;
 	Text *txt = win->file->text;
 
 	if (cmd->regex) {
-		size_t start = range->start, end = range->end;
-		size_t last_start = argv[0][0] == 'x' ? EPOS : start;
 		size_t nsub = 1 + text_regex_nsub(cmd->regex);
 		if (nsub > MAX_REGEX_SUB)
 			nsub = MAX_REGEX_SUB;
-		RegexMatch match[MAX_REGEX_SUB];
-		while (start <= end) {
-			char c;
-			int flags = start > range->start &&
-			            text_byte_get(txt, start - 1, &c) && c != '\n' ?
-			            REG_NOTBOL : 0;
-			bool found = !text_search_range_forward(txt, start, end - start,
-			                                        cmd->regex, nsub, match,
-			                                        flags);
-			Filerange r = text_range_empty();
-			if (found) {
-				if (argv[0][0] == 'x')
-					r = text_range_new(match[0].start, match[0].end);
-				else
-					r = text_range_new(last_start, match[0].start);
-				if (match[0].start == match[0].end) {
-					if (last_start == match[0].start) {
-						start++;
-						continue;
-					}
-					/* in Plan 9's regexp library ^ matches the beginning
-					 * of a line, however in POSIX with REG_NEWLINE ^
-					 * matches the zero-length string immediately after a
-					 * newline. Try filtering out the last such match at EOF.
-					 */
-					if (end == match[0].start && start > range->start &&
-					    text_byte_get(txt, end-1, &c) && c == '\n')
-						break;
-					start = match[0].end + 1;
-				} else {
-					start = match[0].end;
-				}
-			} else {
-				if (argv[0][0] == 'y')
-					r = text_range_new(start, end);
-				start = end + 1;
-			}
-
-			if (text_range_valid(&r)) {
-				if (found) {
-					for (size_t i = 0; i < nsub; i++) {
-						Register *reg = &vis->registers[VIS_REG_AMPERSAND+i];
-						register_put_range(vis, reg, txt, &match[i]);
-					}
-					last_start = match[0].end;
-				} else {
-					last_start = start;
-				}
-				if (simulate)
-					count++;
-				else
-					ret &= sam_execute(vis, win, cmd->cmd, NULL, &r);
-			}
+		Extraction ex = {
+			.vis = vis,
+			.win = win,
+			.cmd = cmd,
+			.range = range,
+			.extract = argv[0][0] == 'x',
+			.simulate = simulate,
+			.ret = true,
+			.nsub = nsub,
+			.start = range->start,
+			.last_start = argv[0][0] == 'x' ? EPOS : range->start,
+			.captures = simulate ? 0 : MIN(nsub, cmd->captures),
+		};
+		text_search_all(txt, range, cmd->regex, nsub, 0, extract_match, &ex);
+		for (size_t i = ex.captures; ex.matched && !simulate && i < nsub; i++) {
+			Register *reg = &vis->registers[VIS_REG_AMPERSAND+i];
+			register_put_range(vis, reg, txt, &ex.match[i]);
 		}
+		if (!ex.extract && !ex.done && ex.start <= range->end) {
+			Filerange r = text_range_new(ex.start, range->end);
+			if (simulate)
+				ex.count++;
+			else
+				ex.ret &= sam_execute(vis, win, cmd->cmd, NULL, &r);
+		}
+		ret = ex.ret;
+		count = ex.count;
 	} else {
 		size_t start = range->start, end = range->end;
 		while (start < end) {
@@ -1485,6 +1739,11 @@ static bool cmd_select(Vis *vis, Win *win, Command *cmd, const char *argv[], Sel
 	Text *txt = win->file->text;
 	bool multiple_cursors = view->selection_count > 1;
 	Selection *primary = view_selections_primary_get(view);
+	SamFilterList *filters = vis->filters;
+	size_t loop = filters ? filters->loop : 0;
+	size_t iteration = filters ? filters->iteration : 0;
+	if (filters)
+		filters->loop = ++filters->iterations;
 
 	if (vis->mode->visual)
 		count_init(cmd->cmd, view->selection_count + 1);
@@ -1526,11 +1785,17 @@ static bool cmd_select(Vis *vis, Win *win, Command *cmd, const char *argv[], Sel
 		}
 		if (!text_range_valid(&r))
 			r = text_range_new(0, 0);
+		if (filters)
+			filters->iteration = ++filters->iterations;
 		ret &= sam_execute(vis, win, cmd->cmd, s, &r);
 		if (cmd->cmd->cmddef->flags & CMD_ONCE)
 			break;
 	}
 
+	if (filters) {
+		filters->loop = loop;
+		filters->iteration = iteration;
+	}
 	if (vis->win && &vis->win->view == view && primary != view_selections_primary_get(view))
 		view_selections_primary_set(view_selections(view));
 	return ret;
@@ -1575,6 +1840,137 @@ static bool cmd_substitute(Vis *vis, Win *win, Command *cmd, const char *argv[],
 	return false;
 }
 
+/* write the range r or in visual mode all selections */
+static bool file_write_ranges(Vis *vis, Win *win, TextSave *ctx, Filerange *r) {
+	bool visual = vis->mode->visual;
+	for (Selection *s = view_selections(&win->view); s; s = view_selections_next(s)) {
+		Filerange range = visual ? view_selections_get(s) : *r;
+		ssize_t written = text_save_write_range(ctx, &range);
+		if (written == -1 || (size_t)written != text_range_size(&range))
+			return false;
+		if (!visual)
+			break;
+	}
+	return true;
+}
+
+static void file_saved(Vis *vis, File *file, const char *path, bool existing_file, bool same_file) {
+	if (!file->name) {
+		file_name_set(file, path);
+		same_file = true;
+	}
+	if (same_file || (!existing_file && strcmp(file->name, path) == 0))
+		file->stat = text_stat(file->text);
+	vis_event_emit(vis, VIS_EVENT_FILE_SAVE_POST, file, path);
+}
+
+/* Write the data in a child process, which works on a copy of the piece
+ * chain as of the fork(2) and thus is not affected by further edits. Once
+ * it exits, file_save_finish commits the save. Returns false if the child
+ * could not be started, the save then has to be performed synchronously. */
+static bool file_save_background(Vis *vis, Win *win, TextSave *ctx, Filerange *r,
+                                 char *path, bool existing_file, bool same_file) {
+	File *file = win->file;
+	FileSave *save = calloc(1, sizeof *save);
+	int pfd[2];
+	if (!save)
+		return false;
+	if (pipe(pfd) == -1) {
+		free(save);
+		return false;
+	}
+
+	size_t size = 0;
+	for (Selection *s = view_selections(&win->view); s; s = view_selections_next(s)) {
+		Filerange range = vis->mode->visual ? view_selections_get(s) : *r;
+		size += text_range_size(&range);
+		if (!vis->mode->visual)
+			break;
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		close(pfd[0]);
+		close(pfd[1]);
+		free(save);
+		return false;
+	} else if (pid == 0) {
+		/* a truncated file terminates the child instead of entering the main loop */
+		signal(SIGBUS, SIG_DFL);
+		close(pfd[0]);
+		int err = 0;
+		if (!file_write_ranges(vis, win, ctx, r) || fsync(ctx->fd) == -1)
+			err = errno ? errno : EIO;
+		if (err)
+			write_all(pfd[1], (char*)&err, sizeof err);
+		_exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(pfd[1]);
+	fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+	*save = (FileSave){
+		.ctx = *ctx,
+		.path = path,
+		.existing = existing_file,
+		.same = same_file,
+		.size = size,
+		.pid = pid,
+		.fd = pfd[0],
+	};
+	file->save = save;
+	return true;
+}
+
+static void file_save_free(File *file) {
+	FileSave *save = file->save;
+	close(save->fd);
+	free(save->path);
+	free(save);
+	file->save = NULL;
+}
+
+/* abort a background save, the destination is left untouched */
+static void file_save_cancel(File *file) {
+	FileSave *save = file->save;
+	if (!save)
+		return;
+	kill(save->pid, SIGKILL);
+	while (waitpid(save->pid, NULL, 0) == -1 && errno == EINTR);
+	text_save_cancel(&save->ctx);
+	file_save_free(file);
+}
+
+/* commit a background save after its child exited, or report its failure */
+static void file_save_finish(Vis *vis, File *file) {
+	FileSave *save = file->save;
+	int err = 0, status = 0;
+	ssize_t len;
+	while ((len = read(save->fd, &err, sizeof err)) == -1 && errno == EINTR);
+	while (waitpid(save->pid, &status, 0) == -1 && errno == EINTR);
+	if (len != sizeof err && (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS))
+		err = EIO;
+	if (!err && !text_save_commit(&save->ctx))
+		err = errno;
+	else if (err)
+		text_save_cancel(&save->ctx);
+	if (err)
+		vis_info_show(vis, "Can't write `%s': %s", save->path, strerror(err));
+	else
+		file_saved(vis, file, save->path, save->existing, save->same);
+	file_save_free(file);
+}
+
+/* percentage of the background save already written or -1 if there is none */
+static int file_save_progress(File *file) {
+	FileSave *save = file->save;
+	if (!save)
+		return -1;
+	off_t written = lseek(save->ctx.fd, 0, SEEK_CUR);
+	if (written <= 0 || save->size == 0)
+		return 0;
+	return MIN((size_t)written, save->size) * 100 / save->size;
+}
+
 /* cmd_write stores win->file's contents end emits pre/post events.
  * If the range r covers the whole file, it is updated to account for
  * potential file's text mutation by a FILE_SAVE_PRE callback.
@@ -1587,7 +1983,19 @@ static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 	if (sam_transcript_error(&file->transcript, SAM_ERR_WRITE_CONFLICT))
 		return false;
 
+	if (file->save) {
+		if (cmd->flags != '!') {
+			vis_info_show(vis, "WARNING: file is still being saved");
+			return false;
+		}
+		file_save_cancel(file);
+	}
+
 	Text *text = file->text;
+	if (text_loading(text)) {
+		vis_info_show(vis, "File is still being loaded");
+		return false;
+	}
 	Filerange range_all = text_range_new(0, text_size(text));
 	bool write_entire_file = text_range_equal(r, &range_all);
 
@@ -1691,16 +2099,15 @@ static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 			goto err;
 		}
 
-		bool failure = false;
-		bool visual = vis->mode->visual;
+		/* large files are written in the background, unless the editor is about
+		 * to quit or further names follow. Only atomic saves are eligible, they
+		 * leave the destination intact if the save fails or is cancelled. */
+		if (ctx.method == TEXT_SAVE_ATOMIC && !strchr(argv[0], 'q') && !name[1] &&
+		    vis->save_background && text_size(text) >= vis->save_background &&
+		    file_save_background(vis, win, &ctx, r, path, existing_file, same_file))
+			continue;
 
-		for (Selection *s = view_selections(&win->view); s; s = view_selections_next(s)) {
-			Filerange range = visual ? view_selections_get(s) : *r;
-			ssize_t written = text_save_write_range(&ctx, &range);
-			failure = (written == -1 || (size_t)written != text_range_size(&range));
-			if (failure || !visual)
-				break;
-		}
+		bool failure = !file_write_ranges(vis, win, &ctx, r);
 
 		if (!failure) {
 			failure = !text_save_commit(&ctx);
@@ -1713,13 +2120,7 @@ static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 			goto err;
 		}
 
-		if (!file->name) {
-			file_name_set(file, path);
-			same_file = true;
-		}
-		if (same_file || (!existing_file && strcmp(file->name, path) == 0))
-			file->stat = text_stat(text);
-		vis_event_emit(vis, VIS_EVENT_FILE_SAVE_POST, file, path);
+		file_saved(vis, file, path, existing_file, same_file);
 		free(path);
 		continue;
 
@@ -1734,23 +2135,32 @@ static bool cmd_filter(Vis *vis, Win *win, Command *cmd, const char *argv[], Sel
 	if (!win)
 		return false;
 
-	Buffer bufout = {0}, buferr = {0};
+	if (sam_filter_defer(vis, win, cmd, argv, sel, range, NULL, true))
+		return true;
+
+	/* the output is stored in the text as it arrives, where it is inserted without copying it */
+	TextSpan *out = NULL;
+	Buffer buferr = {0};
+	Filter filter = {
+		.file = win->file,
+		.range = *range,
+		.argv = &argv[1],
+		.stdout_span = &out,
+		.stderr_buffer = &buferr,
+	};
 
-	int status = vis_pipe(vis, win->file, range, &argv[1], &bufout, read_into_buffer, &buferr,
-	                      read_into_buffer, false);
+	int status = vis_pipe_filter(vis, &filter, false);
 
 	if (vis->interrupted) {
 		vis_info_show(vis, "Command cancelled");
 	} else if (status == 0) {
-		char *data  = bufout.data;
-		bufout.data = 0;
-		if (!sam_change(win, sel, range, data, bufout.len, 1))
-			free(data);
+		if (sam_change_span(win, sel, range, out))
+			out = NULL;
 	} else {
 		vis_info_show(vis, "Command failed %s", buffer_content0(&buferr));
 	}
 
-	buffer_release(&bufout);
+	text_span_free(out);
 	buffer_release(&buferr);
 
 	return !vis->interrupted && status == 0;
@@ -1765,6 +2175,8 @@ static bool cmd_pipein(Vis *vis, Win *win, Command *cmd, const char *argv[], Sel
 	if (!win)
 		return false;
 	Filerange filter_range = text_range_new(range->end, range->end);
+	if (sam_filter_defer(vis, win, cmd, argv, sel, &filter_range, range, true))
+		return true;
 	bool ret = cmd_filter(vis, win, cmd, argv, sel, &filter_range);
 	if (ret)
 		ret = sam_delete(win, NULL, range);
@@ -1774,6 +2186,8 @@ static bool cmd_pipein(Vis *vis, Win *win, Command *cmd, const char *argv[], Sel
 static bool cmd_pipeout(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
 	if (!win)
 		return false;
+	if (sam_filter_defer(vis, win, cmd, argv, sel, range, NULL, false))
+		return true;
 	Buffer buferr = {0};
 
 	int status = vis_pipe(vis, win->file, range, (const char*[]){ argv[1], NULL }, NULL, NULL,
@@ -21,6 +21,7 @@ enum SamError {
 	SAM_ERR_LOOP_INVALID_CMD,
 	SAM_ERR_GROUP_INVALID_CMD,
 	SAM_ERR_COUNT,
+	SAM_ERR_LOADING,
 };
 
 VIS_INTERNAL bool sam_init(Vis*);
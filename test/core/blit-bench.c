@@ -0,0 +1,262 @@
+#include "util.h"
+
+/* the terminal output is exercised without libtermkey */
+typedef struct TermKey TermKey;
+typedef struct TermKeyKey TermKeyKey;
+typedef struct Vis Vis;
+static void termkey_start(TermKey *tk) { }
+static void termkey_stop(TermKey *tk) { }
+
+#include "ui.h"
+
+#include "buffer.c"
+#include "ui-terminal-vt100.c"
+
+/* keys typed during the replayed session, in the notation of test/vis */
+static const char session[] =
+	"<Down><Down><Down><Down><Down><End>"
+	"<Enter>static int counter;<Enter>"
+	"<Enter>int count(void) {<Enter>\treturn counter++;<Enter>}<Enter>"
+	"<Up><Up><Up><End><Backspace><Backspace><Backspace>--;"
+	"<PageDown><Down><Down><Down><Right><Right><Right><Right>"
+	"/* a comment */"
+	"<PageDown><PageDown><PageUp><Up><Up><Up><Up><Up><Home>"
+	"<Enter><Up>#define MAX 42"
+	"<Down><Down><Down><Down><Down><Down><Down><Down><Down><Down>"
+	"<Backspace><Backspace><Backspace><Backspace><Backspace>";
+
+/* a minimal editor model, rendered the way vis lays out its screen */
+typedef struct {
+	char **lines;
+	size_t count;
+	size_t top, row, col;
+} Editor;
+
+static const CellStyle style_text = { CELL_ATTR_NORMAL, CELL_COLOR_DEFAULT, CELL_COLOR_DEFAULT };
+static const CellStyle style_number = { CELL_ATTR_NORMAL, CELL_COLOR_YELLOW, CELL_COLOR_DEFAULT };
+static const CellStyle style_cursor = { CELL_ATTR_REVERSE, CELL_COLOR_DEFAULT, CELL_COLOR_DEFAULT };
+static const CellStyle style_status = { CELL_ATTR_REVERSE, CELL_COLOR_BLUE, CELL_COLOR_DEFAULT };
+
+static void draw_string(Ui *ui, int x, int y, const char *str, CellStyle style) {
+	Cell *cells = ui->cells + y * ui->width;
+	for (; *str && x < ui->width; str++, x++) {
+		cells[x] = (Cell){ .data = { *str }, .len = 1, .width = 1, .style = style };
+	}
+}
+
+static void draw(Ui *ui, Editor *ed) {
+	int height = ui->height - 1;
+	if (ed->row < ed->top)
+		ed->top = ed->row;
+	if (ed->row >= ed->top + height)
+		ed->top = ed->row - height + 1;
+	for (int y = 0; y < ui->height; y++) {
+		Cell *cells = ui->cells + y * ui->width;
+		for (int x = 0; x < ui->width; x++)
+			cells[x] = (Cell){ .data = " ", .style = style_text };
+	}
+	for (int y = 0; y < height; y++) {
+		size_t l = ed->top + y;
+		if (l >= ed->count) {
+			draw_string(ui, 0, y, "~", style_text);
+			continue;
+		}
+		char number[32];
+		snprintf(number, sizeof number, "%5zu ", l + 1);
+		draw_string(ui, 0, y, number, style_number);
+		int x = 6;
+		for (const char *c = ed->lines[l]; *c && x < ui->width; c++) {
+			if (*c == '\t') {
+				do draw_string(ui, x++, y, " ", style_text); while (x % 8 && x < ui->width);
+			} else {
+				draw_string(ui, x++, y, (char[]){ *c, '\0' }, style_text);
+			}
+		}
+	}
+	char status[64];
+	snprintf(status, sizeof status, " INSERT  session.c  %zu, %zu ", ed->row + 1, ed->col + 1);
+	Cell *cells = ui->cells + height * ui->width;
+	for (int x = 0; x < ui->width; x++)
+		cells[x] = (Cell){ .data = " ", .style = style_status };
+	draw_string(ui, 0, height, status, style_status);
+	size_t len = strlen(ed->lines[ed->row]);
+	if (ed->col > len)
+		ed->col = len;
+	ui->cur_row = ed->row - ed->top;
+	ui->cur_col = MIN(6 + (int)ed->col, ui->width - 1);
+	ui->cells[ui->cur_row * ui->width + ui->cur_col].style = style_cursor;
+}
+
+static bool key_is(const char *key, size_t len, const char *name) {
+	return len == strlen(name) && !memcmp(key, name, len);
+}
+
+static void key(Editor *ed, const char *key, size_t len, int height) {
+	char *line = ed->lines[ed->row];
+	size_t line_len = strlen(line);
+	if (key_is(key, len, "<Up>")) {
+		if (ed->row > 0)
+			ed->row--;
+	} else if (key_is(key, len, "<Down>")) {
+		if (ed->row + 1 < ed->count)
+			ed->row++;
+	} else if (key_is(key, len, "<Left>")) {
+		if (ed->col > 0)
+			ed->col--;
+	} else if (key_is(key, len, "<Right>")) {
+		if (ed->col < line_len)
+			ed->col++;
+	} else if (key_is(key, len, "<Home>")) {
+		ed->col = 0;
+	} else if (key_is(key, len, "<End>")) {
+		ed->col = line_len;
+	} else if (key_is(key, len, "<PageUp>")) {
+		ed->row = ed->row > (size_t)height ? ed->row - height : 0;
+	} else if (key_is(key, len, "<PageDown>")) {
+		ed->row = MIN(ed->row + height, ed->count - 1);
+	} else if (key_is(key, len, "<Enter>")) {
+		char *next = strdup(line + ed->col);
+		line[ed->col] = '\0';
+		ed->lines = realloc(ed->lines, (ed->count + 1) * sizeof(char*));
+		memmove(ed->lines + ed->row + 2, ed->lines + ed->row + 1, (ed->count - ed->row - 1) * sizeof(char*));
+		ed->lines[++ed->row] = next;
+		ed->count++;
+		ed->col = 0;
+	} else if (key_is(key, len, "<Backspace>")) {
+		if (ed->col > 0) {
+			memmove(line + ed->col - 1, line + ed->col, line_len - ed->col + 1);
+			ed->col--;
+		}
+	} else {
+		ed->lines[ed->row] = line = realloc(line, line_len + len + 1);
+		memmove(line + ed->col + len, line + ed->col, line_len - ed->col + 1);
+		memcpy(line + ed->col, key, len);
+		ed->col += len;
+	}
+}
+
+/* length of the next key in the session, special keys are enclosed in <> */
+static size_t key_len(const char *keys) {
+	if (keys[0] == '<') {
+		const char *end = strchr(keys, '>');
+		if (end && end > keys + 1)
+			return end - keys + 1;
+	}
+	return 1;
+}
+
+static bool ui_init_screen(Ui *ui, int width, int height) {
+	memset(ui, 0, sizeof *ui);
+	if (!ui_backend_init(ui) || !ui_term_backend_resize(ui, width, height))
+		return false;
+	ui->width = width;
+	ui->height = height;
+	ui->cells = calloc(width * height, sizeof(Cell));
+	return ui->cells != NULL;
+}
+
+static bool editor_load(Editor *ed, const char *filename) {
+	FILE *file = fopen(filename, "r");
+	if (!file)
+		return false;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, file)) != -1) {
+		if (len > 0 && line[len-1] == '\n')
+			line[len-1] = '\0';
+		ed->lines = realloc(ed->lines, (ed->count + 1) * sizeof(char*));
+		ed->lines[ed->count++] = strdup(line);
+	}
+	free(line);
+	fclose(file);
+	return ed->count > 0;
+}
+
+static char *keys_load(const char *filename) {
+	FILE *file = fopen(filename, "r");
+	if (!file)
+		return NULL;
+	Buffer buf = { 0 };
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, file)) != -1) {
+		/* new lines are only used to structure the file */
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == ' '))
+			line[--len] = '\0';
+		buffer_append(&buf, line, len);
+	}
+	free(line);
+	fclose(file);
+	buffer_terminate(&buf);
+	return buf.data;
+}
+
+int main(int argc, char *argv[]) {
+	const char *filename = argc > 1 ? argv[1] : "../../view.c";
+	const char *keys = session;
+	char *recorded = NULL;
+	if (argc > 2 && !(keys = recorded = keys_load(argv[2]))) {
+		fprintf(stderr, "failed to load keys: %s\n", argv[2]);
+		return 1;
+	}
+
+	int sizes[][2] = { { 80, 24 }, { 300, 100 } };
+
+	/* the escape sequences are only counted */
+	int null = open("/dev/null", O_WRONLY);
+	int err = dup(STDERR_FILENO);
+	if (null == -1 || err == -1 || dup2(null, STDERR_FILENO) == -1)
+		return 1;
+
+	printf("%-8s %8s %14s %14s %8s\n", "size", "frames", "full bytes", "damage bytes", "ratio");
+	for (size_t s = 0; s < LENGTH(sizes); s++) {
+		Editor ed = { 0 };
+		Ui full, damage;
+		int width = sizes[s][0], height = sizes[s][1];
+		if (!editor_load(&ed, filename) ||
+		    !ui_init_screen(&full, width, height) ||
+		    !ui_init_screen(&damage, width, height)) {
+			dprintf(err, "failed to load: %s\n", filename);
+			return 1;
+		}
+
+		size_t frames = 0, full_bytes = 0, damage_bytes = 0;
+		for (const char *k = keys; ; ) {
+			draw(&full, &ed);
+			memcpy(damage.cells, full.cells, width * height * sizeof(Cell));
+			damage.cur_row = full.cur_row;
+			damage.cur_col = full.cur_col;
+			/* the previous behavior: every frame sent again */
+			ui_term_backend_clear(&full);
+			ui_term_backend_blit(&full);
+			ui_term_backend_blit(&damage);
+			full_bytes += ((UiTermScreen*)full.ctx)->buf.len;
+			damage_bytes += ((UiTermScreen*)damage.ctx)->buf.len;
+			frames++;
+			if (!*k)
+				break;
+			size_t len = key_len(k);
+			key(&ed, k, len, height - 1);
+			k += len;
+		}
+
+		char size[16];
+		snprintf(size, sizeof size, "%dx%d", width, height);
+		printf("%-8s %8zu %14zu %14zu %8.1f\n", size, frames, full_bytes, damage_bytes,
+		       (double)full_bytes / damage_bytes);
+
+		for (size_t i = 0; i < ed.count; i++)
+			free(ed.lines[i]);
+		free(ed.lines);
+		full.termkey = damage.termkey = NULL;
+		ui_term_backend_free(&full);
+		ui_term_backend_free(&damage);
+		free(full.cells);
+		free(damage.cells);
+	}
+
+	free(recorded);
+	return 0;
+}
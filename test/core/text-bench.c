@@ -0,0 +1,316 @@
+#include "util.h"
+
+typedef struct Vis {
+	jmp_buf oom_jmp_buf;
+} Vis;
+
+#include "util.c"
+
+#include "buffer.c"
+#include "text.c"
+
+#define MiB (1 << 20)
+
+static Vis vis[1];
+
+typedef struct {
+	const char *name;
+	size_t (*count)(const char *data, size_t len);
+	size_t (*skip_forward)(const char *data, size_t len, size_t lines, size_t *lines_skipped);
+} LinesKernel;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* fill buf with lines of the given length, including the new line */
+static void lines_generate(char *buf, size_t size, size_t line_len) {
+	for (size_t i = 0; i < size; i++)
+		buf[i] = (i % line_len) == line_len - 1 ? '\n' : 'a' + i % 26;
+}
+
+static void bench_lines(const LinesKernel *kernel, const char *buf, size_t size, size_t line_len, int rounds) {
+	size_t lines = 0;
+	double start = now();
+	for (int r = 0; r < rounds; r++)
+		lines += kernel->count(buf, size);
+	double count = now() - start;
+
+	/* skip in steps of 100 lines, as done by successive line number lookups */
+	size_t skipped = 0;
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		for (size_t off = 0, n = 1; off < size && n > 0; ) {
+			off += kernel->skip_forward(buf + off, size - off, 100, &n);
+			skipped += n;
+		}
+	}
+	double skip = now() - start;
+
+	if (lines != skipped)
+		printf("%s: mismatch %zu != %zu\n", kernel->name, lines, skipped);
+	double bytes = (double)size * rounds / MiB;
+	printf("%-8s %5zu %12.1f %12.1f\n", kernel->name, line_len, bytes / count, bytes / skip);
+}
+
+/* move up and down between two long lines, at a column near their end */
+static void bench_columns(size_t line_len, int moves) {
+	Text *txt = text_load(vis, NULL);
+	char *line = malloc(line_len);
+	if (!txt || !line)
+		return;
+	lines_generate(line, line_len, line_len);
+	text_insert(vis, txt, 0, line, line_len);
+	text_insert(vis, txt, line_len, line, line_len);
+	/* scatter the lines over many pieces */
+	for (size_t i = 1; i <= 1000; i++)
+		text_insert(vis, txt, (i * 7919 * 4099) % text_size(txt), "{", 1);
+
+	size_t pos = text_line_end(txt, 0) - 1;
+	double start = now();
+	pos = text_line_down(txt, pos);
+	double first = now() - start;
+	start = now();
+	for (int i = 0; i < moves; i++)
+		pos = i % 2 ? text_line_down(txt, pos) : text_line_up(txt, pos);
+	double repeated = (now() - start) / moves;
+	printf("%-8s %5zu %12.3f %12.3f\n", "columns", line_len / MiB, first * 1e3, repeated * 1e3);
+
+	free(line);
+	text_free(txt);
+}
+
+/* save a file of the given size after replacing edit bytes in its middle,
+ * once written through user space and once by the atomic save path */
+static void bench_save(const char *filename, size_t size, size_t edit) {
+	char *buf = malloc(MAX(size, edit));
+	if (!buf)
+		return;
+	lines_generate(buf, MAX(size, edit), 80);
+	int fd = open(filename, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+	bool created = fd != -1 && write_all(fd, buf, size) == (ssize_t)size;
+	if (fd != -1)
+		close(fd);
+	Text *txt = created ? text_load_method(vis, filename, TEXT_LOAD_MMAP) : NULL;
+	if (!txt || !text_delete(txt, size / 2, edit) || !text_insert(vis, txt, size / 2, buf, edit))
+		goto out;
+
+	char tmpname[] = "bench-write-XXXXXX";
+	Filerange range = text_range_new(0, text_size(txt));
+	double start = now();
+	if ((fd = mkstemp(tmpname)) == -1)
+		goto out;
+	ssize_t written = text_write_range(txt, &range, fd);
+	fsync(fd);
+	close(fd);
+	double write = now() - start;
+	unlink(tmpname);
+
+	start = now();
+	TextSave ctx = text_save_default(.txt = txt, .filename = filename, .method = TEXT_SAVE_ATOMIC);
+	if (!text_save_begin(&ctx))
+		goto out;
+	if (text_save_write_range(&ctx, &range) != written || !text_save_commit(&ctx)) {
+		text_save_cancel(&ctx);
+		goto out;
+	}
+	double save = now() - start;
+	printf("%-8s %10zu %12.1f %12.1f\n", "save", edit, write * 1e3, save * 1e3);
+out:
+	text_free(txt);
+	unlink(filename);
+	free(buf);
+}
+
+/* pipe the text through a shell command and replace it by the output, which
+ * is either collected in PIPE_BUF sized slices read into a bounce buffer, in
+ * bulk or stored in the text as it arrives as done by vis. The replacement is
+ * undone afterwards. */
+static ssize_t filter_run(Text *txt, const char *cmd, bool bulk, bool store) {
+	int pin[2], pout[2];
+	if (pipe(pin) == -1)
+		return -1;
+	if (pipe(pout) == -1) {
+		close(pin[0]);
+		close(pin[1]);
+		return -1;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(pin[0], STDIN_FILENO);
+		dup2(pout[1], STDOUT_FILENO);
+		close(pin[0]);
+		close(pin[1]);
+		close(pout[0]);
+		close(pout[1]);
+		execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+		_exit(127);
+	}
+	close(pin[0]);
+	close(pout[1]);
+	int in = pin[1], out = pout[0];
+	if (pid == -1) {
+		close(in);
+		close(out);
+		return -1;
+	}
+#if CONFIG_SPLICE
+	if (bulk) {
+		fcntl(in, F_SETPIPE_SZ, MiB);
+		fcntl(out, F_SETPIPE_SZ, MiB);
+	}
+#endif
+	if (bulk)
+		fcntl(in, F_SETFL, O_NONBLOCK);
+	fcntl(out, F_SETFL, O_NONBLOCK);
+
+	Buffer buf = {0};
+	TextSpan *span = NULL;
+	size_t size = text_size(txt);
+	Filerange range = text_range_new(0, size);
+	while (in != -1 || out != -1) {
+		fd_set rfds, wfds;
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		if (in != -1)
+			FD_SET(in, &wfds);
+		if (out != -1)
+			FD_SET(out, &rfds);
+		if (select(bulk ? MAX(in, out) + 1 : FD_SETSIZE, &rfds, &wfds, NULL, NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (in != -1 && FD_ISSET(in, &wfds)) {
+			ssize_t written;
+			if (bulk) {
+				written = text_pipe_range(txt, &range, in);
+			} else {
+				Filerange junk = range;
+				if (junk.end > junk.start + PIPE_BUF)
+					junk.end = junk.start + PIPE_BUF;
+				written = text_write_range(txt, &junk, in);
+			}
+			if (written > 0)
+				range.start += written;
+			if (text_range_size(&range) == 0 || written == 0 || (written == -1 && errno != EAGAIN)) {
+				close(in);
+				in = -1;
+			}
+		}
+		if (out != -1 && FD_ISSET(out, &rfds)) {
+			ssize_t len;
+			if (store) {
+				size_t stored = span ? text_span_size(span) : 0;
+				len = text_span_read(vis, txt, &span, out, stored > 0 && stored < size ? size - stored : BUFSIZ);
+			} else if (bulk) {
+				len = buffer_read(&buf, out, BUFSIZ);
+			} else {
+				char data[BUFSIZ];
+				if ((len = read(out, data, sizeof data)) > 0)
+					buffer_append(&buf, data, len);
+			}
+			if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+				close(out);
+				out = -1;
+			}
+		}
+	}
+	if (in != -1)
+		close(in);
+	if (out != -1)
+		close(out);
+	waitpid(pid, NULL, 0);
+	ssize_t len = span ? text_span_size(span) : buf.len;
+	TextEdit edit = { .range = { 0, size }, .data = buf.data, .len = buf.len, .span = span };
+	text_snapshot(txt);
+	if (!text_edit(vis, txt, &edit, 1) || text_size(txt) != (size_t)len)
+		len = -1;
+	text_snapshot(txt);
+	text_undo(txt);
+	text_span_free(span);
+	buffer_release(&buf);
+	return len;
+}
+
+/* throughput of filter commands for a file with an edit in its middle,
+ * such that it consists of mmap(2)-ed and heap allocated pieces */
+static void bench_filter(const char *filename, size_t size, const char *cmd) {
+	char *buf = malloc(size);
+	if (!buf)
+		return;
+	lines_generate(buf, size, 80);
+	int fd = open(filename, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+	bool created = fd != -1 && write_all(fd, buf, size) == (ssize_t)size;
+	if (fd != -1)
+		close(fd);
+	Text *txt = created ? text_load_method(vis, filename, TEXT_LOAD_MMAP) : NULL;
+	if (!txt || !text_delete(txt, size / 2, MiB) || !text_insert(vis, txt, size / 2, buf, MiB))
+		goto out;
+
+	double start = now();
+	ssize_t chunked_len = filter_run(txt, cmd, false, false);
+	double chunked = now() - start;
+	start = now();
+	ssize_t bulk_len = filter_run(txt, cmd, true, false);
+	double bulk = now() - start;
+	start = now();
+	ssize_t stored_len = filter_run(txt, cmd, true, true);
+	double stored = now() - start;
+	if (chunked_len != bulk_len || chunked_len != stored_len)
+		printf("%s: output mismatch %zd != %zd != %zd\n", cmd, chunked_len, bulk_len, stored_len);
+	printf("%-8s %12.1f %12.1f %12.1f\n", cmd, size / chunked / MiB, size / bulk / MiB, size / stored / MiB);
+out:
+	text_free(txt);
+	unlink(filename);
+	free(buf);
+}
+
+int main(int argc, char *argv[]) {
+	size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) * MiB;
+	int rounds = argc > 2 ? atoi(argv[2]) : 10;
+	size_t line_lens[] = { 10, 200 };
+
+	LinesKernel kernels[] = {
+		{ "generic", lines_count_generic, lines_skip_forward_generic },
+#if LINES_KERNEL_X86
+		{ "sse2", lines_count_sse2, lines_skip_forward_sse2 },
+		{ "avx2", lines_count_avx2, lines_skip_forward_avx2 },
+#endif
+	};
+
+	char *buf = malloc(size);
+	if (!buf)
+		return 1;
+
+	printf("%-8s %5s %12s %12s\n", "kernel", "line", "count MiB/s", "skip MiB/s");
+	for (size_t l = 0; l < LENGTH(line_lens); l++) {
+		lines_generate(buf, size, line_lens[l]);
+		for (size_t k = 0; k < LENGTH(kernels); k++) {
+#if LINES_KERNEL_X86
+			if (kernels[k].count == lines_count_avx2 &&
+			    !(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")))
+				continue;
+#endif
+			bench_lines(&kernels[k], buf, size, line_lens[l], rounds);
+		}
+	}
+
+	free(buf);
+
+	printf("\n%-8s %5s %12s %12s\n", "motion", "MiB", "first ms", "repeated ms");
+	bench_columns(5 * MiB, 100);
+
+	printf("\n%-8s %10s %12s %12s\n", "file", "edit bytes", "write ms", "save ms");
+	size_t edits[] = { 1, 4096, MiB, 16 * MiB };
+	for (size_t e = 0; e < LENGTH(edits); e++)
+		bench_save("bench-save", size * 4, edits[e]);
+
+	printf("\n%-8s %12s %12s %12s\n", "filter", "slice MiB/s", "bulk MiB/s", "store MiB/s");
+	const char *filters[] = { "cat", "wc -l", "sort" };
+	for (size_t f = 0; f < LENGTH(filters); f++)
+		bench_filter("bench-filter", size, filters[f]);
+	return 0;
+}
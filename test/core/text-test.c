@@ -105,6 +105,41 @@ static bool text_save_method(Text *txt, const char *filename, enum TextSaveMetho
 	return text_save_commit(&ctx);
 }
 
+typedef struct {
+	size_t matches[8];
+	size_t len, max;
+} SearchAll;
+
+static bool search_all(RegexMatch pmatch[], void *data) {
+	SearchAll *s = data;
+	s->matches[s->len++] = pmatch[0].start;
+	return s->len < s->max;
+}
+
+/* compare a new line kernel with the generic implementation for all
+ * start offsets up to twice the vector width and lengths of arbitrary
+ * alignment, including those requiring the per byte counters to be
+ * summed up several times */
+static bool lines_kernel_check(const char *buf, size_t size,
+	size_t (*count)(const char *data, size_t len),
+	size_t (*skip_forward)(const char *data, size_t len, size_t lines, size_t *lines_skipped)) {
+	for (size_t off = 0; off < 64 && off < size; off++) {
+		for (size_t len = 0; off + len <= size; len += 1 + len / 4) {
+			const char *data = buf + off;
+			size_t lines = lines_count_generic(data, len);
+			if (count(data, len) != lines)
+				return false;
+			for (size_t n = 0; n <= lines + 1; n += 1 + n / 3) {
+				size_t skipped_generic, skipped;
+				size_t pos = lines_skip_forward_generic(data, len, n, &skipped_generic);
+				if (skip_forward(data, len, n, &skipped) != pos || skipped != skipped_generic)
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
 int main(int argc, char *argv[]) {
 	Text *txt;
 
@@ -172,6 +207,136 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
+		txt = text_load_method(vis, filename, TEXT_LOAD_MMAP);
+		ok(txt && insert(txt, 5, ",") && insert(txt, 0, "> ") && text_delete(txt, 8, 6) &&
+		   text_save_method(txt, filename, TEXT_SAVE_ATOMIC), "Save partly unchanged mmap-ed text");
+		snprintf(buf, sizeof buf, "> Hello,: (2, 2)\n");
+		ok(txt && compare(txt, buf), "Verify text after save");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && compare(txt, buf), "Verify saved file");
+		text_free(txt);
+
+		txt = text_load(vis, filename);
+		TextSave ctx = text_save_default(.txt = txt, .filename = filename, .method = TEXT_SAVE_ATOMIC);
+		ok(txt && insert(txt, 0, "<") && text_save_begin(&ctx) && insert(txt, 0, "<") &&
+		   text_save_write_range(&ctx, &(Filerange){ 1, text_size(txt) }) == (ssize_t)text_size(txt) - 1 &&
+		   text_save_commit(&ctx) && text_modified(txt), "Modify text while saving");
+		ok(txt && text_undo(txt) == 0 && !text_modified(txt), "Saved revision as of save begin");
+		text_free(txt);
+
+		char mapped_data[3] = { 0 }, mapped_buf[3] = { 0 };
+		txt = text_load_method(vis, filename, TEXT_LOAD_MMAP);
+		TextSpan *mapped = txt ? text_span_get(txt, &(Filerange){ 0, 2 }) : NULL;
+		ok(mapped && text_bytes_get(txt, 0, 2, mapped_data) == 2, "Span of mapped file");
+		text_free(txt);
+		ok(mapped && truncate(filename, 0) == 0 && text_span_bytes_get(mapped, 0, 2, mapped_buf) == 2 &&
+		   strcmp(mapped_buf, mapped_data) == 0, "Span of mapped file outlives truncation");
+		text_span_free(mapped);
+
+		const char *journal = "journal";
+		unlink(journal);
+		txt = text_load(vis, 0);
+		ok(txt && insert(txt, 0, "1\n2\n3\n") && text_save_method(txt, filename, TEXT_SAVE_AUTO), "Prepare journaled file");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		size_t cursors[] = { 0, 2, 4 };
+		TextEdit edits[] = {
+			{ .range = { 0, 3 }, .data = "one", .len = 3 },
+			{ .range = { 8, 12 }, .data = "", .len = 0 },
+		};
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && !text_modified(txt), "Open new journal");
+		ok(txt && text_insert_multi(vis, txt, cursors, LENGTH(cursors), "-", 1) &&
+		   text_insert_multi(vis, txt, (size_t[]){ 1, 4, 7 }, 3, ">", 1) && compare(txt, "->1\n->2\n->3\n"), "Journal grown pieces");
+		text_snapshot(txt);
+		ok(txt && text_edit(vis, txt, edits, LENGTH(edits)) && text_delete(txt, 4, 1) && compare(txt, "one\n>2\n"), "Journal several changes");
+		ok(txt && text_save_method(txt, filename, TEXT_SAVE_AUTO) && insert(txt, 0, "!"), "Journal save");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && compare(txt, "one\n>2\n") && !text_modified(txt), "Restore journal");
+		ok(txt && text_redo(txt) == 1 && compare(txt, "!one\n>2\n") && text_undo(txt) == 0, "Redo unsaved revision");
+		ok(txt && text_undo(txt) != EPOS && compare(txt, "->1\n->2\n->3\n") &&
+		   text_undo(txt) != EPOS && compare(txt, "1\n2\n3\n") && text_undo(txt) == EPOS, "Undo restored revisions");
+		ok(txt && text_redo(txt) != EPOS && text_redo(txt) != EPOS && compare(txt, "one\n>2\n") && !text_modified(txt), "Redo restored revisions");
+		ok(txt && text_undo(txt) != EPOS && insert(txt, 0, "#") && text_earlier(txt) != EPOS &&
+		   compare(txt, "!one\n>2\n"), "Branch off restored revisions");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && text_restore(txt, 0) != EPOS &&
+		   compare(txt, "1\n2\n3\n") && text_later(txt) != EPOS && text_later(txt) != EPOS && text_later(txt) != EPOS &&
+		   text_later(txt) != EPOS && compare(txt, "#->1\n->2\n->3\n"), "Restore branches");
+		ok(txt && insert(txt, 0, "changed") && text_save_method(txt, filename, TEXT_SAVE_AUTO), "Modify journaled file");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && text_undo(txt) == 0 &&
+		   compare(txt, "#->1\n->2\n->3\n"), "Undo journaled save");
+		text_free(txt);
+		txt = text_load(vis, 0);
+		ok(txt && insert(txt, 0, "other") && text_save_method(txt, filename, TEXT_SAVE_AUTO), "Modify file without journal");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && text_undo(txt) == EPOS, "Discard journal of modified file");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		struct stat journaled, synced;
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && !text_journal_pending(txt) &&
+		   stat(journal, &journaled) == 0 && insert(txt, 5, "!"), "Modify journaled text");
+		text_snapshot(txt);
+		ok(txt && text_journal_pending(txt) && stat(journal, &synced) == 0 && synced.st_size == journaled.st_size &&
+		   text_journal_sync(txt) && !text_journal_pending(txt) && stat(journal, &synced) == 0 &&
+		   synced.st_size > journaled.st_size, "Sync journal");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && text_journal_recoverable(txt) &&
+		   text_journal_recover(txt) == 6 && compare(txt, "other!") && text_modified(txt), "Recover unsaved changes");
+		ok(txt && text_save_method(txt, filename, TEXT_SAVE_AUTO), "Save recovered changes");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && !text_journal_recoverable(txt) &&
+		   text_journal_recover(txt) == EPOS, "Nothing to recover");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		Text *reloaded = NULL;
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && (reloaded = text_load(vis, filename)) &&
+		   !text_journal_open(reloaded, AT_FDCWD, journal) && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+		   close(open(journal, O_RDONLY)) == 0 && !text_journal_open(reloaded, AT_FDCWD, journal), "Lock journal");
+		ok(txt && reloaded && insert(txt, 0, "A") && text_journal_close(txt) && !text_journal_pending(txt) &&
+		   text_journal_open(reloaded, AT_FDCWD, journal) && text_journal_recover(reloaded) != EPOS &&
+		   compare(reloaded, "Aother!"), "Close journal");
+		text_free(txt);
+		ok(reloaded && text_undo(reloaded) == 0 && insert(reloaded, 5, "?") && compare(reloaded, "other?!"),
+		   "Journal after close");
+		text_free(reloaded);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && text_journal_recover(txt) != EPOS &&
+		   compare(txt, "other?!") && text_undo(txt) != EPOS && compare(txt, "other!"), "Restore journal after close");
+		text_free(txt);
+
+		unlink(journal);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal), "Open journal to compact");
+		const char *digits[] = { "1", "2", "3" };
+		for (size_t i = 0; txt && i < LENGTH(digits); i++) {
+			insert(txt, i, digits[i]);
+			text_snapshot(txt);
+		}
+		ok(txt && text_undo(txt) != EPOS && insert(txt, 2, "x") &&
+		   text_history_compact(txt, &(TextHistoryLimit){ .revisions = 2 }) == 2 &&
+		   compare(txt, "12xother!") && text_save_method(txt, filename, TEXT_SAVE_AUTO), "Journal compacted history");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && compare(txt, "12xother!") &&
+		   text_undo(txt) != EPOS && compare(txt, "12other!") && text_undo(txt) == EPOS && text_earlier(txt) == EPOS &&
+		   text_later(txt) != EPOS && compare(txt, "123other!") && text_later(txt) != EPOS &&
+		   compare(txt, "12xother!") && text_later(txt) == EPOS, "Restore compacted history");
+		ok(txt && insert(txt, 0, "y") && text_history_compact(txt, &(TextHistoryLimit){ .revisions = 1 }) == 3,
+		   "Compact saved revision");
+		text_free(txt);
+		txt = text_load(vis, filename);
+		ok(txt && text_journal_open(txt, AT_FDCWD, journal) && compare(txt, "12xother!") &&
+		   !text_journal_recoverable(txt) && text_undo(txt) == EPOS, "Discard journal without saved revision");
+		text_free(txt);
+
 		int (*creation[])(const char*, const char*) = { symlink, link };
 		const char *names[] = { "symlink", "hardlink" };
 
@@ -192,6 +357,25 @@ int main(int argc, char *argv[]) {
 			ok(txt && !text_save_method(txt, linkname, TEXT_SAVE_ATOMIC), "Text save %s atomic", names[i]);
 			text_free(txt);
 		}
+
+		int fds[2];
+		const char *piped = "Hello\nWorld\nfrom a pipe\n";
+		size_t piped_len = strlen(piped), loaded = 6;
+		txt = text_load(vis, 0);
+		ok(txt && pipe(fds) == 0 && write(fds[1], piped, piped_len) == (ssize_t)piped_len &&
+		   text_load_fd(vis, txt, fds[0], loaded) == (ssize_t)loaded && compare(txt, "Hello\n"), "Load from pipe");
+		Mark mark = text_mark_set(txt, 4);
+		ok(text_loading(txt) && !insert(txt, 0, ">") && !text_delete(txt, 0, 1) && compare(txt, "Hello\n"), "Modification while loading");
+		ssize_t len = 0;
+		for (; loaded < piped_len && len >= 0; loaded += len)
+			len = text_load_fd(vis, txt, fds[0], 5);
+		close(fds[1]);
+		ok(text_load_fd(vis, txt, fds[0], 5) == 0 && !text_loading(txt) && compare(txt, piped), "Load from pipe until end of file");
+		close(fds[0]);
+		ok(text_mark_get(txt, mark) == 4 && text_lineno_by_pos(txt, piped_len) == 4 && !text_modified(txt), "Loaded text state");
+		ok(insert(txt, 0, ">") && text_undo(txt) == 0 && compare(txt, piped) && text_undo(txt) == EPOS, "Undo after loading");
+		ok(text_load_fd(vis, txt, fds[0], 1) == -1 && errno == EBUSY, "Load into modified text");
+		text_free(txt);
 	}
 
 	txt = text_load(vis, 0);
@@ -307,6 +491,10 @@ int main(int argc, char *argv[]) {
 	ok(text_later(txt) != EPOS && compare(txt, "123456"), "Later 5");
 	ok(text_later(txt) != EPOS && compare(txt, "123456789"), "Later 6");
 	ok(text_later(txt) != EPOS && compare(txt, "1234567890"), "Later 7");
+	text_changed(txt);
+	ok(text_changed(txt) == EPOS && insert(txt, 8, "x") && text_delete(txt, 4, 1) &&
+	   text_changed(txt) == 4 && text_changed(txt) == EPOS, "Lowest changed position");
+	ok(text_undo(txt) != EPOS && text_changed(txt) == 4 && compare(txt, "1234567890"), "Changed position of undo");
 
 	/* test regular deletion (i.e. with multiple pieces) */
 	ok(text_delete(txt, 8, 2) && compare(txt, "12345678"), "Deleting midway start");
@@ -350,6 +538,21 @@ int main(int argc, char *argv[]) {
 		text_undo(txt);
 	}
 
+	Mark marks[8];
+	size_t mark_count = MIN(LENGTH(marks), text_size(txt));
+	for (size_t i = 0; i < mark_count; i++)
+		marks[i] = text_mark_set(txt, i);
+	for (size_t i = mark_count; i-- > 0; )
+		insert(txt, i, "-");
+	bool marks_moved = true, marks_restored = true;
+	for (size_t i = 0; i < mark_count; i++)
+		marks_moved &= text_mark_get(txt, marks[i]) == 2*i+1;
+	text_snapshot(txt);
+	text_undo(txt);
+	for (size_t i = 0; i < mark_count; i++)
+		marks_restored &= text_mark_get(txt, marks[i]) == i;
+	ok(mark_count > 0 && marks_moved && marks_restored, "Marks within many pieces");
+
 	text_snapshot(txt);
 
 	/* Test branching of the revision tree:
@@ -419,5 +622,274 @@ int main(int argc, char *argv[]) {
 
 	text_free(txt);
 
+	/* test position lookup in a long piece chain */
+	txt = text_load(vis, 0);
+	char expected[1024];
+	size_t expected_len = 0;
+	for (size_t i = 0; i < 256; i++) {
+		char c = 'a' + i % 26;
+		size_t pos = (i * 7) % (expected_len + 1);
+		memmove(expected + pos + 1, expected + pos, expected_len - pos);
+		expected[pos] = c;
+		expected_len++;
+		text_insert(vis, txt, pos, &c, 1);
+		text_snapshot(txt);
+	}
+	bool lookup_good = text_size(txt) == expected_len;
+	for (size_t pos = 0; pos < expected_len; pos++) {
+		char c;
+		if (!text_byte_get(txt, pos, &c) || c != expected[pos])
+			lookup_good = false;
+	}
+	ok(lookup_good, "Lookup in long piece chain");
+	while (text_undo(txt) != EPOS);
+	ok(isempty(txt), "Undo long piece chain");
+	text_free(txt);
+
+	/* test line number lookup across pieces */
+	txt = text_load(vis, 0);
+	bool lines_good = true;
+	for (size_t i = 0; i < 64; i++) {
+		if (text_lineno_by_pos(txt, text_size(txt)) != i + 1)
+			lines_good = false;
+		insert(txt, text_size(txt), i % 2 ? "line\n" : "\n");
+		text_snapshot(txt);
+	}
+	ok(lines_good, "Line number at end of file");
+	ok(insert(txt, 10, "\n\n"), "Inserting new lines in the middle");
+	lines_good = text_pos_by_lineno(txt, 1) == 0;
+	for (size_t pos = 0, line = 1; pos < text_size(txt); pos++) {
+		char c;
+		text_byte_get(txt, pos, &c);
+		if (text_lineno_by_pos(txt, pos) != line)
+			lines_good = false;
+		if (c == '\n' && text_pos_by_lineno(txt, ++line) != pos + 1)
+			lines_good = false;
+	}
+	ok(lines_good, "Line number lookup");
+	ok(text_pos_by_lineno(txt, 68) == EPOS, "Line number beyond end of file");
+	text_free(txt);
+
+	/* test regex search against matching the whole content at once */
+	txt = text_load(vis, 0);
+	const char content[] = "foo bar\n\nbarbaz\na long line with bar at the end bar\nbar";
+	for (size_t pos = 0; pos < sizeof(content) - 1; pos += 3) {
+		text_insert(vis, txt, pos, content + pos, MIN(3, sizeof(content) - 1 - pos));
+		text_snapshot(txt);
+	}
+	const char *patterns[] = { "bar", "ba[rz]+", "^b", "r$", "^$", "d b", "x" };
+	regex_t reference;
+	bool search_good = compare(txt, content);
+	for (size_t i = 0; i < LENGTH(patterns) && search_good; i++) {
+		Regex *regex = text_regex_new();
+		text_regex_compile(regex, patterns[i], REG_EXTENDED|REG_NEWLINE);
+		regcomp(&reference, patterns[i], REG_EXTENDED|REG_NEWLINE);
+		for (size_t pos = 0; pos < sizeof(content) - 1; pos++) {
+			RegexMatch match[1];
+			regmatch_t expected[1];
+			int eflags = pos > 0 && content[pos-1] != '\n' ? REG_NOTBOL : 0;
+			int ret = text_search_range_forward(txt, pos, text_size(txt) - pos, regex, 1, match, eflags);
+			if (ret != regexec(&reference, content + pos, 1, expected, eflags))
+				search_good = false;
+			else if (!ret && (match[0].start != pos + expected[0].rm_so || match[0].end != pos + expected[0].rm_eo))
+				search_good = false;
+		}
+		regfree(&reference);
+		text_regex_free(regex);
+	}
+	ok(search_good, "Search forward across pieces");
+	RegexMatch match[1];
+	Regex *regex = text_regex_new();
+	text_regex_compile(regex, "bar", REG_EXTENDED|REG_NEWLINE);
+	ok(!text_search_range_backward(txt, 0, text_size(txt), regex, 1, match, 0) &&
+	   match[0].start == text_size(txt) - 3, "Search backward across pieces");
+	ok(!text_search_range_backward(txt, 0, 20, regex, 1, match, 0) &&
+	   match[0].start == 9, "Search backward in range");
+	Filerange all = text_range_new(0, text_size(txt));
+	SearchAll found = { .max = LENGTH(found.matches) };
+	ok(text_search_all(txt, &all, regex, 1, 0, search_all, &found) == 5 && found.matches[0] == 4 &&
+	   found.matches[1] == 9 && found.matches[4] == text_size(txt) - 3, "Search all matches");
+	found = (SearchAll){ .max = 2 };
+	ok(text_search_all(txt, &all, regex, 1, 0, search_all, &found) == 2, "Search all matches stopped early");
+	text_regex_free(regex);
+	text_free(txt);
+
+	/* test applying multiple edits at once */
+	txt = text_load(vis, 0);
+	ok(insert(txt, 0, "1234") && insert(txt, 4, "5678") && insert(txt, 8, "9"), "Inserting pieces to edit");
+	text_snapshot(txt);
+	TextEdit edits[] = {
+		{ .range = { 0, 0 }, .data = "<", .len = 1 },
+		{ .range = { 1, 3 }, .data = "x", .len = 1 },
+		{ .range = { 3, 6 } },
+		{ .range = { 6, 6 }, .data = "yy", .len = 2 },
+		{ .range = { 6, 6 }, .data = "z", .len = 1 },
+		{ .range = { 9, 9 }, .data = ">", .len = 1 },
+	};
+	ok(text_edit(vis, txt, edits, LENGTH(edits)) && compare(txt, "<1xyyz789>"), "Edit multiple ranges");
+	text_snapshot(txt);
+	ok(text_undo(txt) != EPOS && compare(txt, "123456789"), "Undo multiple edits at once");
+	ok(text_redo(txt) != EPOS && compare(txt, "<1xyyz789>"), "Redo multiple edits at once");
+	TextEdit unordered[] = {
+		{ .range = { 2, 4 } },
+		{ .range = { 3, 5 } },
+	};
+	ok(!text_edit(vis, txt, unordered, LENGTH(unordered)) && compare(txt, "<1xyyz789>"), "Reject overlapping edits");
+
+	text_snapshot(txt);
+	ok(text_delete(txt, 0, text_size(txt)) && insert(txt, 0, "abc"), "Insert at multiple cursors: init");
+	text_snapshot(txt);
+	size_t cursors[] = { 0, 1, 3 };
+	ok(text_insert_multi(vis, txt, cursors, LENGTH(cursors), "x", 1) && compare(txt, "xaxbcx"), "Insert at multiple cursors");
+	size_t pieces = 0;
+	for (Piece *p = txt->begin.next; p != &txt->end; p = p->next)
+		pieces++;
+	for (size_t i = 0; i < LENGTH(cursors); i++)
+		cursors[i] += i + 1;
+	bool grown = text_insert_multi(vis, txt, cursors, LENGTH(cursors), "y", 1) && text_delete(txt, 8, 1);
+	for (Piece *p = txt->begin.next; p != &txt->end; p = p->next)
+		pieces--;
+	ok(grown && pieces == 0 && compare(txt, "xyaxybcx"), "Insert at multiple cursors in place");
+	text_snapshot(txt);
+	ok(text_undo(txt) != EPOS && compare(txt, "abc"), "Undo insertion at multiple cursors");
+	ok(text_redo(txt) != EPOS && compare(txt, "xyaxybcx"), "Redo insertion at multiple cursors");
+	for (size_t i = 0; i < LENGTH(cursors); i++)
+		cursors[i] += i + 1;
+	cursors[2]--;
+	ok(text_insert_multi(vis, txt, cursors, LENGTH(cursors), "z", 1) && compare(txt, "xyzaxyzbcxz"), "Insert at multiple cursors after snapshot");
+	text_free(txt);
+
+	/* control characters are displayed as ^{char} */
+	txt = text_load(vis, 0);
+	insert(txt, 0, "first\n");
+	for (int i = 0; i < 8; i++)
+		insert(txt, text_size(txt), "ab\001\tc");
+	insert(txt, text_size(txt), "\nlast");
+	size_t bol = 6, eol = text_size(txt) - 5;
+	ok(text_line_width_get(txt, eol) == 48 && text_line_width_get(txt, bol + 13) == 16, "Line width");
+	ok(text_line_width_set(txt, bol, 15) == bol + 12 && text_line_width_set(txt, bol, 17) == bol + 13, "Line width set");
+	ok(text_line_width_set(txt, bol, 100) == eol && text_line_width_set(txt, eol + 1, 100) == text_size(txt), "Line width set beyond end");
+	ok(insert(txt, bol + 1, "\001") && text_line_width_get(txt, eol + 1) == 50, "Line width after modification");
+	ok(text_line_down(txt, eol - 4) == text_size(txt) && text_line_up(txt, text_size(txt) - 1) == bol + 1, "Line up/down");
+	text_free(txt);
+
+	/* test discarding old history, state 6 branches off state 3:
+	 *
+	 *  0 -- 1 -- 2 -- 3 -- 4 -- 5
+	 *                  \
+	 *                   `-- 6 -- 7
+	 */
+	txt = text_load(vis, 0);
+	char states[8][4];
+	for (size_t i = 0; i < LENGTH(states); i++) {
+		snprintf(states[i], sizeof states[i], "%zu%zu%zu", i, i, i);
+		if (i == 6) {
+			text_undo(txt);
+			text_undo(txt);
+		}
+		text_delete(txt, 0, text_size(txt));
+		insert(txt, 0, states[i]);
+		text_snapshot(txt);
+	}
+	VisDACount blocks = txt->count;
+	TextHistoryLimit limit = { .revisions = 3 };
+	ok(text_history_compact(txt, &limit) == 4 && compare(txt, states[7]), "Compact history");
+	ok(txt->count < blocks, "Compact unreferenced blocks");
+	ok(text_undo(txt) != EPOS && text_undo(txt) != EPOS && compare(txt, states[3]), "Undo to new root");
+	ok(text_undo(txt) == EPOS && compare(txt, states[3]), "Undo beyond new root");
+	for (size_t i = 4; i < LENGTH(states); i++)
+		ok(text_later(txt) != EPOS && compare(txt, states[i]), "Later to compacted state %zu", i);
+	for (size_t i = LENGTH(states)-1; i > 3; i--)
+		ok(text_earlier(txt) != EPOS && compare(txt, states[i-1]), "Earlier to compacted state %zu", i-1);
+	ok(text_earlier(txt) == EPOS, "Earlier beyond new root");
+	ok(text_restore(txt, time(NULL) + 1) != EPOS && compare(txt, states[7]), "Restore latest compacted state");
+	limit.revisions = 1;
+	ok(text_history_compact(txt, &limit) == 4 && text_undo(txt) == EPOS && compare(txt, states[7]), "Compact abandoned branch");
+	ok(insert(txt, 1, "x") && compare(txt, "7x77"), "Insert after compaction");
+	ok(text_undo(txt) != EPOS && compare(txt, states[7]), "Undo after compaction");
+	text_free(txt);
+
+	/* test referencing the content of ranges without copying it */
+	txt = text_load(vis, 0);
+	ok(insert(txt, 0, "123") && insert(txt, 3, "456789"), "Inserting pieces to span");
+	Filerange spanned = { 2, 7 };
+	TextSpan *span = text_span_get(txt, &spanned);
+	char span_buf[16] = "";
+	ok(span && text_span_size(span) == 5 && text_span_bytes_get(span, 0, sizeof span_buf, span_buf) == 5 &&
+	   strcmp(span_buf, "34567") == 0, "Span of a range");
+	ok(insert(txt, 5, "x") && text_delete(txt, 2, 1) && compare(txt, "1245x6789"), "Modify spanned range");
+	memset(span_buf, 0, sizeof span_buf);
+	ok(text_span_bytes_get(span, 1, 3, span_buf) == 3 && strcmp(span_buf, "456") == 0, "Span unaffected by modifications");
+	Mark span_mark = text_mark_set(txt, 2);
+	ok(text_delete(txt, 0, text_size(txt)) && text_mark_get(txt, span_mark) == EPOS, "Delete spanned range");
+	ok(text_span_insert(vis, txt, 0, span) && compare(txt, "34567") && text_mark_get(txt, span_mark) == 1,
+	   "Insert span without copying");
+	ok(text_span_insert(vis, txt, 2, span) && compare(txt, "3434567567") && text_mark_get(txt, span_mark) == 1,
+	   "Insert span while its content is part of the text");
+	ok(text_undo(txt) != EPOS && compare(txt, ""), "Undo span insertion");
+	text_free(txt);
+	memset(span_buf, 0, sizeof span_buf);
+	ok(text_span_bytes_get(span, 0, sizeof span_buf, span_buf) == 5 && strcmp(span_buf, "34567") == 0, "Span outlives text");
+	text_span_free(span);
+
+	/* test reading data into the storage of a text, to insert it later on */
+	txt = text_load(vis, 0);
+	int span_pipe[2];
+	TextSpan *read_span = NULL;
+	ok(insert(txt, 0, "<>") && pipe(span_pipe) == 0 && write(span_pipe[1], "ab\n", 3) == 3 &&
+	   text_span_read(vis, txt, &read_span, span_pipe[0], 16) == 2 &&
+	   text_span_read(vis, txt, &read_span, span_pipe[0], 16) == 1 && write(span_pipe[1], "cd", 2) == 2 &&
+	   text_span_read(vis, txt, &read_span, span_pipe[0], 2) == 2 && close(span_pipe[1]) == 0 &&
+	   text_span_size(read_span) == 5 && read_span->count == 2 && compare(txt, "<>"), "Read into text storage");
+	VisDACount read_blocks = txt->count;
+	ok(text_span_read(vis, txt, &read_span, span_pipe[0], 16) == 0 && close(span_pipe[0]) == 0 &&
+	   txt->count == read_blocks, "Read end of file without allocating storage");
+	TextEdit span_edits[] = {
+		{ .range = { 1, 1 }, .span = read_span },
+		{ .range = { 1, 2 }, .data = "]", .len = 1 },
+	};
+	Mark read_mark = 0;
+	ok(text_edit(vis, txt, span_edits, LENGTH(span_edits)) && compare(txt, "<ab\ncd]") &&
+	   (read_mark = text_mark_set(txt, 1)) == (Mark)read_span->entries[0].data, "Edit with read data without copying");
+	ok(text_edit(vis, txt, span_edits, 1) && compare(txt, "<ab\ncdab\ncd]") && text_mark_get(txt, read_mark) == 6,
+	   "Edit with read data which is part of the text");
+	text_free(txt);
+	text_span_free(read_span);
+
+	/* test every compiled new line kernel against the generic implementation */
+	static char lines_mixed[16384], lines_none[16384], lines_only[16384];
+	for (size_t i = 0; i < sizeof lines_mixed; i++)
+		lines_mixed[i] = (i * 7919) % 13 < 3 ? '\n' : 'x';
+	memset(lines_none, 'x', sizeof lines_none);
+	memset(lines_only, '\n', sizeof lines_only);
+	const struct {
+		const char *name;
+		bool supported;
+		size_t (*count)(const char *data, size_t len);
+		size_t (*skip_forward)(const char *data, size_t len, size_t lines, size_t *lines_skipped);
+	} kernels[] = {
+		{ "generic", true, lines_count_generic, lines_skip_forward_generic },
+#if LINES_KERNEL_X86
+		{ "SSE2", true, lines_count_sse2, lines_skip_forward_sse2 },
+		{ "AVX2", __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"),
+		  lines_count_avx2, lines_skip_forward_avx2 },
+#endif
+	};
+	for (size_t i = 0; i < LENGTH(kernels); i++) {
+		if (!kernels[i].supported) {
+			skip(3, "%s new line kernel not supported", kernels[i].name);
+			continue;
+		}
+		ok(lines_kernel_check(lines_mixed, sizeof lines_mixed, kernels[i].count, kernels[i].skip_forward),
+		   "%s new line kernel with some new lines", kernels[i].name);
+		ok(lines_kernel_check(lines_none, sizeof lines_none, kernels[i].count, kernels[i].skip_forward),
+		   "%s new line kernel without new lines", kernels[i].name);
+		ok(lines_kernel_check(lines_only, sizeof lines_only, kernels[i].count, kernels[i].skip_forward),
+		   "%s new line kernel with only new lines", kernels[i].name);
+	}
+	lines_kernel_init();
+	ok(lines_kernel_check(lines_mixed, sizeof lines_mixed, lines_kernel.count, lines_kernel.skip_forward),
+	   "Runtime chosen new line kernel");
+
 	return exit_status();
 }
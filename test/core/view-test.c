@@ -0,0 +1,102 @@
+#include "util.h"
+
+#include "tap.h"
+
+/* the view is exercised without libtermkey and a user interface */
+typedef struct TermKey TermKey;
+typedef struct TermKeyKey TermKeyKey;
+
+#include "vis-core.h"
+
+#include "util.c"
+#include "buffer.c"
+#include "text.c"
+
+static int file_save_progress(File *file) { return -1; }
+
+#include "view.c"
+
+void ui_window_style_set(Ui *ui, int win_id, Cell *cell, enum UiStyle id, bool keep_non_default) { }
+void ui_window_options_set(Win *win, enum UiOption options) { }
+void ui_window_status(Win *win, const char *status) { }
+bool vis_macro_recording(Vis *vis) { return false; }
+const char *file_name_get(File *file) { return NULL; }
+
+static Vis vis[1];
+
+/* a view whose previous frame is reused and one which is drawn from scratch */
+static Win reused, fresh;
+
+static bool insert(Text *txt, size_t pos, const char *data) {
+	return text_insert(vis, txt, pos, data, strlen(data));
+}
+
+static bool lines_equal(const Line *a, const Line *b, int width) {
+	if (a->len != b->len || a->width != b->width || a->lineno != b->lineno)
+		return false;
+	for (int x = 0; x < width; x++) {
+		const Cell *c = &a->cells[x], *d = &b->cells[x];
+		if (c->len != d->len || c->width != d->width || strcmp(c->data, d->data))
+			return false;
+	}
+	return true;
+}
+
+/* redraw both views and check that reusing cells yields the same screen */
+static bool redraw(void) {
+	View *a = &reused.view, *b = &fresh.view;
+	bool frame = a->frame.count > 0;
+	view_draw(a);
+	view_invalidate(b);
+	view_draw(b);
+	if (!frame || a->start != b->start || a->end != b->end)
+		return false;
+	int rows = 0;
+	for (const Line *l = a->topline; l != a->lastline->next; l = l->next)
+		rows++;
+	for (const Line *l = b->topline; l != b->lastline->next; l = l->next)
+		rows--;
+	if (rows != 0)
+		return false;
+	for (const Line *l = a->topline, *m = b->topline; l; l = l->next, m = m->next) {
+		if (!lines_equal(l, m, a->width))
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	plan_no_plan();
+	setlocale(LC_CTYPE, "C.UTF-8");
+
+	Text *txt = text_load(vis, NULL);
+	for (int i = 0; i < 40; i++) {
+		char line[128];
+		snprintf(line, sizeof line, "%d\tcontrol \x01 combining e\xcc\x81\t\xcc\x81 wide \xe6\x97\xa5\xe6\x9c\xac %s\n",
+		         i, i % 3 ? "" : "a line long enough to be wrapped across several screen lines");
+		insert(txt, text_size(txt), line);
+	}
+	reused.vis = fresh.vis = vis;
+	ok(view_init(&reused, txt) && view_init(&fresh, txt) &&
+	   view_resize(&reused.view, 30, 12) && view_resize(&fresh.view, 30, 12), "Initialize views");
+	size_t start = text_pos_by_lineno(txt, 10);
+	reused.view.start = fresh.view.start = start;
+	view_draw(&reused.view);
+	ok(redraw(), "Redraw unchanged frame");
+
+	ok(insert(txt, 0, "before\n") && redraw(), "Redraw after insertion before the view");
+	ok(text_delete(txt, 2, 10) && redraw(), "Redraw after deletion before the view");
+	size_t inside = fresh.view.start + 40;
+	ok(insert(txt, inside, "inside\n\t\x02") && redraw(), "Redraw after insertion inside the view");
+	ok(text_delete(txt, inside + 3, 20) && redraw(), "Redraw after deletion inside the view");
+	ok(insert(txt, fresh.view.end - 5, "\xcc\x81") && redraw(), "Redraw after insertion of combining character");
+	ok(insert(txt, text_size(txt), "after\n") && redraw(), "Redraw after insertion after the view");
+	ok(text_delete(txt, fresh.view.end + 10, 30) && redraw(), "Redraw after deletion after the view");
+	reused.view.start = fresh.view.start = fresh.view.end;
+	ok(redraw(), "Redraw scrolled view");
+
+	view_free(&reused.view);
+	view_free(&fresh.view);
+	text_free(txt);
+	return exit_status();
+}
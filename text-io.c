@@ -6,6 +6,25 @@
  * directly. Hence the former can be truncated, while doing so on the latter
  * results in havoc. */
 #define BLOCK_MMAP_SIZE (1 << 26)
+/* The number of new lines preceding every multiple of this offset within
+ * a block is recorded, once needed, to speed up line number calculations. */
+#ifndef BLOCK_LINES_INTERVAL
+#define BLOCK_LINES_INTERVAL (1 << 14)
+#endif
+/* size of the blocks holding data read from a file descriptor */
+#ifndef BLOCK_LOAD_SIZE
+#define BLOCK_LOAD_SIZE (1 << 24)
+#endif
+/* Data inserted at multiple positions at once is followed by up to this many
+ * bytes, which are reserved to extend it in place by subsequent insertions. */
+#ifndef BLOCK_RESERVE
+#define BLOCK_RESERVE 64
+#endif
+/* descriptors of mmap(2)-ed files are only kept below this number, such that
+ * those of pipes created later on remain usable with select(2) */
+#ifndef BLOCK_FD_MAX
+#define BLOCK_FD_MAX (FD_SETSIZE / 2)
+#endif
 
 /* allocate a new block of MAX(size, BLOCK_SIZE) bytes */
 static Block *block_alloc(size_t size)
@@ -21,6 +40,7 @@ static Block *block_alloc(size_t size)
 	}
 	blk->type = BLOCK_TYPE_MALLOC;
 	blk->size = size;
+	blk->fd = -1;
 	return blk;
 }
 
@@ -28,10 +48,18 @@ static void block_free(Block *blk)
 {
 	if (!blk)
 		return;
+	/* spans outlive the text, the block is freed together with the last of them */
+	if (blk->spans > 0) {
+		blk->released = true;
+		return;
+	}
 	if (blk->type == BLOCK_TYPE_MALLOC)
 		free(blk->data);
 	else if ((blk->type == BLOCK_TYPE_MMAP_ORIG || blk->type == BLOCK_TYPE_MMAP) && blk->data)
 		munmap(blk->data, blk->size);
+	if (blk->fd != -1)
+		close(blk->fd);
+	free(blk->lines);
 	free(blk);
 }
 
@@ -73,13 +101,14 @@ static Block *block_mmap(size_t size, int fd, off_t offset)
 	blk->type = BLOCK_TYPE_MMAP_ORIG;
 	blk->size = size;
 	blk->len = size;
+	blk->fd = -1;
 	return blk;
 }
 
 static Block *block_load(int dirfd, const char *filename, enum TextLoadMethod method, struct stat *info)
 {
 	Block *block = NULL;
-	int fd = openat(dirfd, filename, O_RDONLY);
+	int fd = openat(dirfd, filename, O_RDONLY|O_CLOEXEC);
 	if (fd == -1)
 		goto out;
 	if (fstat(fd, info) == -1)
@@ -95,8 +124,12 @@ static Block *block_load(int dirfd, const char *filename, enum TextLoadMethod me
 		goto out;
 	if (method == TEXT_LOAD_READ || (method == TEXT_LOAD_AUTO && size < BLOCK_MMAP_SIZE))
 		block = block_read(size, fd);
-	else
-		block = block_mmap(size, fd, 0);
+	else if ((block = block_mmap(size, fd, 0)) && (CONFIG_COPY_FILE_RANGE || CONFIG_SPLICE) && fd < BLOCK_FD_MAX) {
+		/* keep the file open to copy unchanged ranges when saving and to
+		 * splice them into the pipes of filters */
+		block->fd = fd;
+		fd = -1;
+	}
 out:
 	if (fd != -1)
 		close(fd);
@@ -117,6 +150,39 @@ static const char *block_append(Block *blk, const char *data, size_t len)
 	return dest;
 }
 
+/* returns the number of new lines in data[0, off) of the block, records the
+ * counts of all preceding intervals which were not yet known */
+static size_t block_lines(Block *blk, size_t off)
+{
+	size_t n = off / BLOCK_LINES_INTERVAL;
+	if (n > blk->lines_len) {
+		if (n > blk->lines_size) {
+			size_t size = MAX(n, 2 * blk->lines_size);
+			size_t *lines = realloc(blk->lines, size * sizeof *lines);
+			if (lines) {
+				blk->lines = lines;
+				blk->lines_size = size;
+			}
+		}
+		/* if allocation failed, count the remainder from the last known interval */
+		size_t lines = blk->lines_len ? blk->lines[blk->lines_len-1] : 0;
+		for (size_t i = blk->lines_len; i < MIN(n, blk->lines_size); i++) {
+			lines += lines_count(blk->data + i * BLOCK_LINES_INTERVAL, BLOCK_LINES_INTERVAL);
+			blk->lines[i] = lines;
+			blk->lines_len = i + 1;
+		}
+	}
+	size_t i = MIN(n, blk->lines_len);
+	size_t start = i * BLOCK_LINES_INTERVAL;
+	return (i ? blk->lines[i-1] : 0) + lines_count(blk->data + start, off - start);
+}
+
+/* forget the new line counts of all intervals extending beyond pos */
+static void block_lines_invalidate(Block *blk, size_t pos)
+{
+	blk->lines_len = MIN(blk->lines_len, pos / BLOCK_LINES_INTERVAL);
+}
+
 /* insert data into block at an arbitrary position, this should only be used with
  * data of the most recently created piece. */
 static bool block_insert(Block *blk, size_t pos, const char *data, size_t len)
@@ -125,6 +191,7 @@ static bool block_insert(Block *blk, size_t pos, const char *data, size_t len)
 		return false;
 	if (blk->len == pos)
 		return block_append(blk, data, len);
+	block_lines_invalidate(blk, pos);
 	char *insert = blk->data + pos;
 	memmove(insert + len, insert, blk->len - pos);
 	memcpy(insert, data, len);
@@ -139,6 +206,7 @@ static bool block_delete(Block *blk, size_t pos, size_t len)
 	size_t end;
 	if (!addu(pos, len, &end) || end > blk->len)
 		return false;
+	block_lines_invalidate(blk, pos);
 	if (blk->len == pos) {
 		blk->len -= len;
 		return true;
@@ -161,17 +229,22 @@ static Block *text_block_mmaped(Text *txt)
  * means of undo/redo operations */
 void text_snapshot(Text *txt)
 {
-	if (txt->current_revision)
+	if (txt->current_revision) {
+		journal_revision(txt, txt->current_revision);
 		txt->last_revision = txt->current_revision;
+	}
 	txt->current_revision = NULL;
 	txt->cache = NULL;
+	txt->snapshots++;
 }
 
-static void text_saved(Text *txt, struct stat *meta)
+static void text_saved(Text *txt, struct stat *meta, Revision *rev)
 {
-	if (meta)
+	if (meta) {
 		txt->info = *meta;
-	txt->saved_revision = txt->history;
+		journal_saved(txt, rev);
+	}
+	txt->saved_revision = rev;
 	text_snapshot(txt);
 }
 
@@ -185,6 +258,71 @@ Text *text_load_method(Vis *vis, const char *filename, enum TextLoadMethod metho
 	return text_loadat_method(vis, AT_FDCWD, filename, method);
 }
 
+/* Data read from a file descriptor is stored in large blocks and appended to
+ * the last piece, which is extended in place as long as its block has space
+ * left. No change is recorded, instead the text can not be modified until
+ * the end of file is reached. Hence the data is part of every revision. */
+ssize_t text_load_fd(Vis *vis, Text *txt, int fd, size_t len)
+{
+	if (!txt->loading) {
+		if (txt->current_revision || txt->last_revision->seq != 0) {
+			errno = EBUSY;
+			return -1;
+		}
+		txt->loading = true;
+	}
+
+	Piece *p = txt->end.prev;
+	Block *blk = txt->count > 0 ? txt->data[txt->count - 1] : 0;
+	if (!blk || blk->type != BLOCK_TYPE_MALLOC || !block_capacity(blk, 1)) {
+		if (!(blk = block_alloc(BLOCK_LOAD_SIZE)))
+			return -1;
+		*da_push(vis, txt) = blk;
+	}
+
+	ssize_t n;
+	char *data = blk->data + blk->len;
+	while ((n = read(fd, data, MIN(len, blk->size - blk->len))) == -1 && errno == EINTR);
+	if (n <= 0) {
+		if (n == 0 || errno != EAGAIN)
+			txt->loading = false;
+		return n;
+	}
+	blk->len += n;
+	text_changed_at(txt, txt->size);
+
+	if (!p->block) {
+		/* the initial empty piece of a new text */
+		p->block = blk;
+		p->data = data;
+		blk->refs++;
+	}
+	if (p->block == blk && p->data + p->len == data) {
+		if (p->lines != LINES_UNKNOWN)
+			p->lines += lines_count(data, n);
+		p->len += n;
+		index_resize(p);
+		if (p->len == (size_t)n)
+			mark_index_insert(txt, p);
+	} else {
+		Piece *new = piece_alloc(txt);
+		if (!new)
+			return -1;
+		piece_init(new, p, &txt->end, blk, data, n);
+		p->next = new;
+		txt->end.prev = new;
+		index_insert(txt, &txt->end, new, new);
+	}
+	txt->size += n;
+	txt->version++;
+	return n;
+}
+
+bool text_loading(const Text *txt)
+{
+	return txt->loading;
+}
+
 ssize_t write_all(int fd, const char *buf, size_t count) {
 	size_t rem = count;
 	while (rem > 0) {
@@ -367,7 +505,7 @@ static bool text_save_commit_atomic(TextSave *ctx) {
 	if (close(dir) == -1)
 		return false;
 
-	text_saved(ctx->txt, &meta);
+	text_saved(ctx->txt, &meta, ctx->txt->save_revision);
 	return true;
 }
 
@@ -405,6 +543,10 @@ static bool text_save_begin_inplace(TextSave *ctx) {
 		if (close_failed)
 			goto err;
 		block->type = BLOCK_TYPE_MMAP;
+		if (block->fd != -1) {
+			close(block->fd);
+			block->fd = -1;
+		}
 	}
 	/* overwrite the existing file content, if something goes wrong
 	 * here we are screwed, TODO: make a backup before? */
@@ -427,12 +569,16 @@ static bool text_save_commit_inplace(TextSave *ctx) {
 		return false;
 	if (close(ctx->fd) == -1)
 		return false;
-	text_saved(ctx->txt, &meta);
+	text_saved(ctx->txt, &meta, ctx->txt->save_revision);
 	return true;
 }
 
 bool text_save_begin(TextSave *ctx) {
 	enum TextSaveMethod type = ctx->method;
+	/* the content as of now is written, later changes form a new revision */
+	text_snapshot(ctx->txt);
+	ctx->txt->save_revision = ctx->txt->history;
+	journal_save_begin(ctx->txt);
 	errno = 0;
 	if ((type == TEXT_SAVE_AUTO || type == TEXT_SAVE_ATOMIC) && text_save_begin_atomic(ctx)) {
 		ctx->method = TEXT_SAVE_ATOMIC;
@@ -451,6 +597,7 @@ err:
 
 void text_save_cancel(TextSave *ctx) {
 	int saved_errno = errno;
+	ctx->txt->save_revision = NULL;
 	if (ctx->fd != -1)
 		close(ctx->fd);
 	if (ctx->tmpname.data && ctx->tmpname.data[0])
@@ -470,13 +617,31 @@ bool text_save_commit(TextSave *ctx) {
 	return result;
 }
 
-void text_mark_current_revision(Text *txt) { text_saved(txt, 0); }
+void text_mark_current_revision(Text *txt) { text_saved(txt, 0, txt->history); }
 
-ssize_t text_save_write_range(TextSave *ctx, const Filerange *range) {
-	return text_write_range(ctx->txt, range, ctx->fd);
+/* copy len bytes of the file underlying an mmap(2)-ed block, starting at
+ * data, to the current position of fd without passing them through user
+ * space. Returns the number of bytes copied, which might be less than len. */
+static size_t block_copy(const Block *blk, const char *data, size_t len, int fd)
+{
+	size_t rem = len;
+#if CONFIG_COPY_FILE_RANGE
+	off_t off = data - blk->data;
+	while (rem > 0) {
+		ssize_t copied = copy_file_range(blk->fd, &off, fd, NULL, rem, 0);
+		if (copied == -1 && errno == EINTR)
+			continue;
+		if (copied <= 0)
+			break;
+		rem -= copied;
+	}
+#endif
+	return len - rem;
 }
 
-ssize_t text_write_range(const Text *txt, const Filerange *range, int fd) {
+/* write a range of the text, if copy is set unchanged parts of an mmap(2)-ed
+ * file are copied in kernel space, which allows file systems to share them */
+static ssize_t text_write_range_copy(const Text *txt, const Filerange *range, int fd, bool copy) {
 	size_t size = text_range_size(range), rem = size;
 	for (Iterator it = text_iterator_get(txt, range->start);
 	     rem > 0 && text_iterator_valid(&it);
@@ -484,12 +649,74 @@ ssize_t text_write_range(const Text *txt, const Filerange *range, int fd) {
 		size_t prem = it.end - it.text;
 		if (prem > rem)
 			prem = rem;
-		ssize_t written = write_all(fd, it.text, prem);
+		const Block *blk = it.piece->block;
+		size_t copied = 0;
+		if (copy && blk && blk->type == BLOCK_TYPE_MMAP_ORIG && blk->fd != -1) {
+			copied = block_copy(blk, it.text, prem, fd);
+			/* fall back to write(2) for the rest of the range */
+			copy = copied == prem;
+			rem -= copied;
+			if (copy)
+				continue;
+		}
+		ssize_t written = write_all(fd, it.text + copied, prem - copied);
 		if (written == -1)
 			return -1;
 		rem -= written;
-		if ((size_t)written != prem)
+		if ((size_t)written != prem - copied)
 			break;
 	}
 	return size - rem;
 }
+
+/* move len bytes starting at data to the pipe fd, the pages of the file
+ * underlying an mmap(2)-ed block are spliced from the page cache. Those of
+ * other blocks are copied, mapping them into the pipe with vmsplice(2) would
+ * leave them referenced by the pipe after the block was reused or freed. */
+static ssize_t block_pipe(const Block *blk, const char *data, size_t len, int fd)
+{
+#if CONFIG_SPLICE
+	if (blk && blk->type == BLOCK_TYPE_MMAP_ORIG && blk->fd != -1) {
+		loff_t off = data - blk->data;
+		ssize_t spliced = splice(blk->fd, &off, fd, NULL, len, SPLICE_F_NONBLOCK);
+		/* fall back to write(2) if fd is not a pipe */
+		if (spliced != -1 || errno == EAGAIN || errno == EINTR)
+			return spliced;
+	}
+#endif
+	return write(fd, data, len);
+}
+
+ssize_t text_pipe_range(const Text *txt, const Filerange *range, int fd) {
+	size_t size = text_range_size(range), rem = size;
+	for (Iterator it = text_iterator_get(txt, range->start);
+	     rem > 0 && text_iterator_valid(&it);
+	     text_iterator_next(&it)) {
+		const char *data = it.text;
+		size_t prem = it.end - it.text;
+		if (prem > rem)
+			prem = rem;
+		while (prem > 0) {
+			ssize_t written = block_pipe(it.piece->block, data, prem, fd);
+			if (written == -1 && errno == EINTR)
+				continue;
+			if (written == -1 && rem == size)
+				return -1;
+			if (written <= 0)
+				return size - rem;
+			data += written;
+			prem -= written;
+			rem -= written;
+		}
+	}
+	return size - rem;
+}
+
+ssize_t text_save_write_range(TextSave *ctx, const Filerange *range) {
+	/* only a new file is guaranteed not to alias the mmap(2)-ed one */
+	return text_write_range_copy(ctx->txt, range, ctx->fd, ctx->method == TEXT_SAVE_ATOMIC);
+}
+
+ssize_t text_write_range(const Text *txt, const Filerange *range, int fd) {
+	return text_write_range_copy(txt, range, fd, false);
+}
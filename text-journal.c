@@ -0,0 +1,583 @@
+/* The history of a text can be recorded in an append-only journal, such that
+ * it survives the text being closed. Every snapshot appends the changes of the
+ * completed revision, every save the revision written together with a hash of
+ * its content. Once the journal is opened again, only the record headers are
+ * read to rebuild the revision graph. The changes of a revision are loaded
+ * when it is first undone or redone, their pieces refer to the mmap(2)-ed
+ * journal content.
+ *
+ * The journal starts with JOURNAL_MAGIC, followed by records consisting of a
+ * type byte, the size of the record body and the body itself. All numbers are
+ * stored as unsigned LEB128:
+ *
+ *  - JOURNAL_REVISION: distance to the identifier of the parent revision (zero
+ *    for the root), time and number of changes. For every change in the order
+ *    they were applied: position, deleted and inserted length, deleted and
+ *    inserted data.
+ *  - JOURNAL_OMITTED: a revision whose changes exceed JOURNAL_REVISION_MAX
+ *    bytes, only consisting of the parent distance and time. It can not be
+ *    undone, the history leading up to it is lost.
+ *  - JOURNAL_SAVED: identifier of the revision saved, size and content hash.
+ *  - JOURNAL_COMPACTED: identifier of the root chosen by text_history_compact.
+ *    The history preceding it and all revisions not descending from it are
+ *    dropped when the journal is opened again, their records remain in the
+ *    file until a new journal is started.
+ *
+ * Revisions are identified by the index of their record which is also used as
+ * their sequence number.
+ *
+ * Records are collected in memory and written by text_journal_sync, such that
+ * the caller can batch the writes and fsync(2) calls off the path of handling
+ * user input. A journal which is not closed properly thus ends with the last
+ * synced record, or a truncated one which is discarded when opened again.
+ */
+#define JOURNAL_MAGIC "vis-undo1\n"
+/* revisions whose changes swap more bytes in and out are not journaled */
+#ifndef JOURNAL_REVISION_MAX
+#define JOURNAL_REVISION_MAX (1 << 26)
+#endif
+/* maximal length of an encoded number and the header of a record */
+#define JOURNAL_NUMBER_MAX 10
+#define JOURNAL_HEADER_MAX (1 + JOURNAL_NUMBER_MAX)
+
+enum {
+	JOURNAL_REVISION = 'r',
+	JOURNAL_OMITTED = 'o',
+	JOURNAL_SAVED = 's',
+	JOURNAL_COMPACTED = 'c',
+};
+
+/* a revision record as read when opening the journal */
+typedef struct {
+	size_t offset;          /* offset of the change count */
+	size_t parent;          /* identifier of the parent revision */
+	time_t time;
+	bool omitted;
+} JournalRevision;
+
+/* a change of a revision record */
+typedef struct {
+	size_t pos;
+	const char *old, *new;  /* deleted and inserted data */
+	size_t old_len, new_len;
+} JournalChange;
+
+static bool journal_reserve(JournalBuffer *buf, size_t len) {
+	if (buf->size - buf->len >= len)
+		return true;
+	size_t size;
+	if (!addu(buf->len, len, &size))
+		return false;
+	if (size < 2 * buf->size)
+		size = 2 * buf->size;
+	char *data = realloc(buf->data, size);
+	if (!data)
+		return false;
+	buf->data = data;
+	buf->size = size;
+	return true;
+}
+
+/* append n as unsigned LEB128, the space has to be reserved beforehand */
+static void journal_put_number(JournalBuffer *buf, uint64_t n) {
+	do {
+		buf->data[buf->len++] = (n & 0x7f) | (n > 0x7f ? 0x80 : 0);
+		n >>= 7;
+	} while (n);
+}
+
+static void journal_put_span(JournalBuffer *buf, const Span *span) {
+	for (Piece *p = span->start; p; p = p->next) {
+		memcpy(buf->data + buf->len, p->data, p->len);
+		buf->len += p->len;
+		if (p == span->end)
+			break;
+	}
+}
+
+static bool journal_get_number(const char **data, const char *end, uint64_t *n) {
+	*n = 0;
+	for (int shift = 0; *data < end && shift < 64; shift += 7) {
+		unsigned char byte = *(*data)++;
+		*n |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+/* get a number which does not exceed max */
+static bool journal_get_size(const char **data, const char *end, size_t max, size_t *n) {
+	uint64_t value;
+	if (!journal_get_number(data, end, &value) || value > max)
+		return false;
+	*n = value;
+	return true;
+}
+
+/* the lock is released explicitly, it would otherwise be held by the
+ * mapping of the journal until the text is freed */
+static void journal_close(Journal *j) {
+	flock(j->fd, LOCK_UN);
+	close(j->fd);
+	j->fd = -1;
+}
+
+/* write the pending records, the journal remains consistent up to the last
+ * complete one if that fails */
+static bool journal_flush(Journal *j) {
+	if (j->fd == -1)
+		return false;
+	if (j->pending.len == 0)
+		return true;
+	bool written = write_all(j->fd, j->pending.data, j->pending.len) == (ssize_t)j->pending.len;
+	j->pending.len = 0;
+	j->unsynced = true;
+	if (!written)
+		journal_close(j);
+	return written;
+}
+
+/* stop journaling, the records completed so far are kept */
+static void journal_fail(Journal *j) {
+	journal_flush(j);
+	if (j->fd != -1)
+		journal_close(j);
+	free(j->pending.data);
+	j->pending = (JournalBuffer){ 0 };
+}
+
+/* start a pending record whose body takes at most len bytes, its header is
+ * written once the body is complete */
+static size_t journal_begin(Journal *j, size_t len) {
+	size_t start = j->pending.len;
+	if (len > SIZE_MAX - JOURNAL_HEADER_MAX || !journal_reserve(&j->pending, JOURNAL_HEADER_MAX + len)) {
+		journal_fail(j);
+		return EPOS;
+	}
+	j->pending.len += JOURNAL_HEADER_MAX;
+	return start;
+}
+
+static void journal_end(Journal *j, int type, size_t start) {
+	char data[JOURNAL_HEADER_MAX];
+	JournalBuffer header = { .data = data };
+	char *body = j->pending.data + start + JOURNAL_HEADER_MAX;
+	size_t len = j->pending.data + j->pending.len - body;
+	header.data[header.len++] = type;
+	journal_put_number(&header, len);
+	memmove(j->pending.data + start + header.len, body, len);
+	memcpy(j->pending.data + start, header.data, header.len);
+	j->pending.len = start + header.len + len;
+}
+
+/* hash of the text content, independent of how it is split into pieces */
+static uint64_t journal_hash(const Text *txt) {
+	uint64_t hash = txt->size, word = 0;
+	size_t len = 0;
+	for (Piece *p = txt->begin.next; p->next; p = p->next) {
+		for (size_t i = 0; i < p->len; i++) {
+			word = (word << 8) | (unsigned char)p->data[i];
+			if (++len % 8 == 0) {
+				hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+				hash ^= hash >> 32;
+				word = 0;
+			}
+		}
+	}
+	hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+	return hash ^ (hash >> 32);
+}
+
+/* position of a change within the state it is applied to */
+static size_t journal_change_pos(Text *txt, TextChange *c) {
+	if (c->old.start)
+		return index_pos(c->old.start);
+	Piece *prev = c->new.start->prev;
+	return prev == &txt->begin ? 0 : index_pos(prev) + prev->len;
+}
+
+/* Append a completed revision to the journal. Its changes are undone and
+ * redone one at a time to determine their positions in the states they were
+ * applied to, which also accounts for pieces grown in place since. */
+static void journal_revision(Text *txt, Revision *rev) {
+	Journal *j = txt->journal;
+	if (!j || j->fd == -1)
+		return;
+	size_t count = 0, size = 0;
+	TextChange *first = NULL;
+	for (TextChange *c = rev->change; c; c = c->next) {
+		if (c->old.start || c->new.start)
+			count++;
+		size += c->old.len + c->new.len;
+		first = c;
+	}
+
+	bool omitted = size > JOURNAL_REVISION_MAX;
+	size_t len = 3 * JOURNAL_NUMBER_MAX;
+	if (!omitted)
+		len += 3 * JOURNAL_NUMBER_MAX * count + size;
+	size_t start = journal_begin(j, len);
+	if (start == EPOS)
+		return;
+	JournalBuffer *buf = &j->pending;
+	journal_put_number(buf, rev->prev ? rev->seq - rev->prev->seq : 0);
+	journal_put_number(buf, rev->time);
+	if (!omitted) {
+		journal_put_number(buf, count);
+		size_t version = txt->version;
+		for (TextChange *c = rev->change; c; c = c->next)
+			span_swap(txt, &c->new, &c->old);
+		for (TextChange *c = first; c; c = c->prev) {
+			if (c->old.start || c->new.start) {
+				journal_put_number(buf, journal_change_pos(txt, c));
+				journal_put_number(buf, c->old.len);
+				journal_put_number(buf, c->new.len);
+				journal_put_span(buf, &c->old);
+				journal_put_span(buf, &c->new);
+			}
+			span_swap(txt, &c->old, &c->new);
+		}
+		/* the content is the same as before */
+		txt->version = version;
+	}
+	journal_end(j, omitted ? JOURNAL_OMITTED : JOURNAL_REVISION, start);
+}
+
+/* remember the content about to be saved, a background save might commit
+ * once the text has been modified further */
+static void journal_save_begin(Text *txt) {
+	Journal *j = txt->journal;
+	if (!j || j->fd == -1)
+		return;
+	j->save_size = txt->size;
+	j->save_hash = journal_hash(txt);
+}
+
+static void journal_saved(Text *txt, Revision *rev) {
+	Journal *j = txt->journal;
+	if (!j || j->fd == -1 || !rev)
+		return;
+	size_t start = journal_begin(j, 3 * JOURNAL_NUMBER_MAX);
+	if (start == EPOS)
+		return;
+	journal_put_number(&j->pending, rev->seq);
+	journal_put_number(&j->pending, j->save_size);
+	journal_put_number(&j->pending, j->save_hash);
+	journal_end(j, JOURNAL_SAVED, start);
+}
+
+static void journal_compacted(Text *txt, Revision *root) {
+	Journal *j = txt->journal;
+	if (!j || j->fd == -1)
+		return;
+	size_t start = journal_begin(j, JOURNAL_NUMBER_MAX);
+	if (start == EPOS)
+		return;
+	journal_put_number(&j->pending, root->seq);
+	journal_end(j, JOURNAL_COMPACTED, start);
+}
+
+/* Load the changes of a revision which is either part of the current state
+ * (applied) or a child of it. Their inverse is applied in the former case,
+ * themselves in the latter. The resulting changes are attached to the
+ * revision and undone again, the text content remains unchanged. */
+static bool journal_load(Text *txt, Revision *rev, bool applied) {
+	if (!rev->journal)
+		return true;
+	Block *blk = txt->journal->block;
+	const char *data = blk->data + rev->journal, *end = blk->data + blk->len;
+	size_t count;
+	/* every change takes at least three bytes */
+	if (!journal_get_size(&data, end, (end - data) / 3, &count))
+		return false;
+	JournalChange *changes = calloc(count + 1, sizeof *changes);
+	if (!changes)
+		return false;
+	for (size_t i = 0; i < count; i++) {
+		JournalChange *c = &changes[i];
+		if (!journal_get_size(&data, end, SIZE_MAX, &c->pos) ||
+		    !journal_get_size(&data, end, SIZE_MAX, &c->old_len) ||
+		    !journal_get_size(&data, end, SIZE_MAX, &c->new_len) ||
+		    c->old_len > (size_t)(end - data) || c->new_len > (size_t)(end - data) - c->old_len) {
+			free(changes);
+			return false;
+		}
+		c->old = data;
+		c->new = data + c->old_len;
+		data = c->new + c->new_len;
+	}
+
+	/* the changes are recorded in rev, without creating a new revision */
+	bool success = true;
+	txt->current_revision = rev;
+	for (size_t i = 0; i < count && success; i++) {
+		JournalChange *c = &changes[applied ? count - 1 - i : i];
+		TextEdit edit = {
+			.range = { c->pos, c->pos + (applied ? c->new_len : c->old_len) },
+			.data = applied ? c->old : c->new,
+			.len = applied ? c->old_len : c->new_len,
+		};
+		success = text_edit_reserve(NULL, txt, &edit, 1, 0, blk);
+	}
+	if (success && !rev->change)
+		success = text_change_alloc(txt, EPOS) != NULL;
+	txt->current_revision = NULL;
+	free(changes);
+
+	for (TextChange *c = rev->change; c; c = c->next)
+		span_swap(txt, &c->new, &c->old);
+	if (!success) {
+		for (TextChange *next, *c = rev->change; c; c = next) {
+			next = c->next;
+			span_free(txt, &c->new);
+			pool_free(&txt->changes, c);
+		}
+		rev->change = NULL;
+		return false;
+	}
+
+	if (applied) {
+		/* the inverse changes become those leading to the revision */
+		TextChange *list = NULL;
+		for (TextChange *next, *c = rev->change; c; c = next) {
+			next = c->next;
+			Span span = c->old;
+			c->old = c->new;
+			c->new = span;
+			c->prev = NULL;
+			c->next = list;
+			if (list)
+				list->prev = c;
+			list = c;
+		}
+		rev->change = list;
+	}
+	rev->journal = 0;
+	return true;
+}
+
+/* Rebuild the history from the journal, provided it contains a saved revision
+ * matching the text content. The most recent such revision becomes the current
+ * one. Returns the size of the journal prefix consisting of complete records
+ * or zero if the journal does not apply. */
+static size_t journal_restore(Text *txt, Journal *j) {
+	const char *start = j->block->data, *data = start, *end = start + j->block->len;
+	size_t magic = sizeof(JOURNAL_MAGIC) - 1;
+	if (j->block->len < magic || memcmp(data, JOURNAL_MAGIC, magic))
+		return 0;
+	data += magic;
+
+	JournalRevision *revs = NULL;
+	Revision **restored = NULL;
+	size_t count = 0, capacity = 0, saved = SIZE_MAX, compacted = 0, valid = 0;
+	bool hashed = false;
+	uint64_t hash = 0;
+	while (data < end) {
+		const char *body = data + 1;
+		size_t len;
+		if (!journal_get_size(&body, end, SIZE_MAX, &len) || len > (size_t)(end - body))
+			break;
+		const char *body_end = body + len;
+		int type = *data;
+		data = body_end;
+		if (type == JOURNAL_REVISION || type == JOURNAL_OMITTED) {
+			uint64_t parent, time;
+			if (!journal_get_number(&body, body_end, &parent) ||
+			    !journal_get_number(&body, body_end, &time) ||
+			    parent > count || (count > 0) != (parent > 0))
+				goto out;
+			if (count == capacity) {
+				capacity = capacity ? 2 * capacity : 1024;
+				JournalRevision *new = realloc(revs, capacity * sizeof *revs);
+				if (!new)
+					goto out;
+				revs = new;
+			}
+			revs[count] = (JournalRevision){
+				.offset = body - start,
+				.parent = count - parent,
+				.time = time,
+				.omitted = type == JOURNAL_OMITTED,
+			};
+			count++;
+		} else if (type == JOURNAL_SAVED) {
+			uint64_t id, size, content;
+			if (!journal_get_number(&body, body_end, &id) ||
+			    !journal_get_number(&body, body_end, &size) ||
+			    !journal_get_number(&body, body_end, &content) || id >= count)
+				goto out;
+			if (size != txt->size)
+				continue;
+			if (!hashed) {
+				hash = journal_hash(txt);
+				hashed = true;
+			}
+			if (content == hash)
+				saved = id;
+		} else if (type == JOURNAL_COMPACTED) {
+			uint64_t id;
+			if (!journal_get_number(&body, body_end, &id) || id >= count)
+				goto out;
+			compacted = id;
+		} else {
+			goto out;
+		}
+	}
+	if (saved == SIZE_MAX || !(restored = calloc(count, sizeof *restored)))
+		goto out;
+
+	/* the history preceding the most recent omitted revision or the root of
+	 * the last compaction is lost, the saved revision might have been dropped
+	 * by the latter */
+	size_t root = saved;
+	while (root > compacted && !revs[root].omitted)
+		root = revs[root].parent;
+	size_t ancestor = root;
+	while (ancestor > compacted)
+		ancestor = revs[ancestor].parent;
+	if (ancestor != compacted)
+		goto out;
+
+	Revision *earlier = NULL;
+	for (size_t i = root; i < count; i++) {
+		Revision *parent = i == root ? NULL : restored[revs[i].parent];
+		if (i != root && (!parent || revs[i].omitted))
+			continue;
+		Revision *rev = pool_alloc(&txt->revisions);
+		if (!rev)
+			goto out;
+		rev->seq = i;
+		rev->time = revs[i].time;
+		rev->journal = parent ? revs[i].offset : 0;
+		rev->prev = parent;
+		if (parent)
+			parent->next = rev;
+		rev->earlier = earlier;
+		if (earlier)
+			earlier->later = rev;
+		earlier = rev;
+		restored[i] = rev;
+	}
+
+	/* replace the initial revision of the text */
+	Revision *initial = txt->history;
+	for (TextChange *next, *c = initial->change; c; c = next) {
+		next = c->next;
+		pool_free(&txt->changes, c);
+	}
+	pool_free(&txt->revisions, initial);
+	txt->history = txt->saved_revision = restored[saved];
+	txt->last_revision = earlier;
+	history_change_branch(txt->history);
+	j->revisions = count;
+	valid = data - start;
+out:
+	free(revs);
+	free(restored);
+	return valid;
+}
+
+bool text_journal_open(Text *txt, int dirfd, const char *filename) {
+	if (txt->journal || txt->loading || txt->current_revision || txt->last_revision->seq != 0) {
+		errno = EBUSY;
+		return false;
+	}
+	Journal *j = calloc(1, sizeof *j);
+	if (!j)
+		return false;
+	struct stat info;
+	/* unlike fcntl(2) locks, which belong to the process and are released
+	 * once any of its descriptors of the file is closed, the lock is held
+	 * by this descriptor */
+	j->fd = openat(dirfd, filename, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0600);
+	if (j->fd == -1 || flock(j->fd, LOCK_EX|LOCK_NB) == -1 || fstat(j->fd, &info) == -1)
+		goto err;
+
+	size_t valid = 0;
+	if (info.st_size > 0) {
+		if (!(j->block = block_mmap(info.st_size, j->fd, 0)))
+			goto err;
+		/* kept until the text is freed, unloaded changes refer to it */
+		j->block->refs++;
+		valid = journal_restore(txt, j);
+	}
+
+	txt->journal = j;
+	if (valid > 0) {
+		if (valid < (size_t)info.st_size && ftruncate(j->fd, valid) == -1)
+			goto err;
+		return true;
+	}
+
+	/* start a new journal with the current state as root */
+	block_free(j->block);
+	j->block = NULL;
+	j->revisions = 1;
+	if (ftruncate(j->fd, 0) == -1)
+		goto err;
+	size_t magic = sizeof(JOURNAL_MAGIC) - 1;
+	if (write_all(j->fd, JOURNAL_MAGIC, magic) != (ssize_t)magic)
+		goto err;
+	journal_revision(txt, txt->history);
+	journal_save_begin(txt);
+	journal_saved(txt, txt->history);
+	if (!journal_flush(j))
+		goto err;
+	return true;
+err:
+	txt->journal = NULL;
+	journal_free(j);
+	return false;
+}
+
+bool text_journal_sync(Text *txt) {
+	Journal *j = txt->journal;
+	if (!j)
+		return true;
+	if (!journal_flush(j))
+		return false;
+	if (j->unsynced && fsync(j->fd) == -1) {
+		journal_fail(j);
+		return false;
+	}
+	j->unsynced = false;
+	return true;
+}
+
+bool text_journal_close(Text *txt) {
+	Journal *j = txt->journal;
+	if (!j || j->fd == -1)
+		return true;
+	text_snapshot(txt);
+	bool synced = text_journal_sync(txt);
+	/* the mapping remains, the changes not yet loaded refer to it */
+	journal_fail(j);
+	return synced;
+}
+
+bool text_journal_pending(const Text *txt) {
+	Journal *j = txt->journal;
+	return j && j->fd != -1 && (j->pending.len > 0 || j->unsynced);
+}
+
+bool text_journal_recoverable(const Text *txt) {
+	return txt->journal && txt->history != txt->last_revision;
+}
+
+size_t text_journal_recover(Text *txt) {
+	if (!text_journal_recoverable(txt))
+		return EPOS;
+	return history_traverse_to(txt, txt->last_revision);
+}
+
+/* the pending records are written, but not synced */
+static void journal_free(Journal *j) {
+	if (!j)
+		return;
+	if (journal_flush(j))
+		journal_close(j);
+	free(j->pending.data);
+	block_free(j->block);
+	free(j);
+}
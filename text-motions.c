@@ -162,80 +162,81 @@ int text_line_char_get(Text *txt, size_t pos) {
 	return count;
 }
 
-int text_line_width_get(Text *txt, size_t pos) {
-	int width = 0;
-	mbstate_t ps = { 0 };
-	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
+/* Measure the display width of the line starting at line, until either the
+ * position stop, the end of the line or the given width limit is reached.
+ * Returns the position of the codepoint at which it stopped, widths up to
+ * it are stored in *width. Measuring resumes from the closest checkpoint
+ * and records new ones along the way, to make repeated calls on long lines
+ * cheap. */
+static size_t line_width_walk(Text *txt, size_t line, size_t stop, int limit, int *width) {
+	LineWidths *widths = line_widths_get(txt, line);
+	LineWidth cp = line_widths_find(widths, stop, limit);
+	size_t next = (widths->count ? widths->data[widths->count-1].pos : line) + LINE_WIDTH_INTERVAL;
+	size_t pos = cp.pos;
+	int w = cp.width;
+	bool codepoint = false; /* whether continuation bytes belong to a preceding codepoint */
+
+	for (Iterator it = text_iterator_get(txt, pos); it.text; text_iterator_next(&it)) {
+		for (const char *s = it.text; s < it.end; s++) {
+			unsigned char c = *s;
+			pos = it.pos + (s - it.text);
+			if (pos >= stop || c == '\n')
+				goto out;
+			if (!ISUTF8(c) && codepoint)
+				continue;
+			if (pos >= next && ISUTF8(c)) {
+				line_widths_add(widths, pos, w);
+				next = pos + LINE_WIDTH_INTERVAL;
+			}
 
-	while (it.pos < pos) {
-		char buf[MB_LEN_MAX];
-		size_t len = text_bytes_get(txt, it.pos, sizeof buf, buf);
-		if (len == 0 || buf[0] == '\n')
-			break;
-		wchar_t wc;
-		size_t wclen = mbrtowc(&wc, buf, len, &ps);
-		if (wclen == (size_t)-1 && errno == EILSEQ) {
-			ps = (mbstate_t){0};
-			/* assume a replacement symbol will be displayed */
-			width++;
-		} else if (wclen == (size_t)-2) {
-			/* do nothing, advance to next character */
-		} else if (wclen == 0) {
-			/* assume NUL byte will be displayed as ^@ */
-			width += 2;
-		} else if (buf[0] == '\t') {
-			width++;
-		} else {
-			int w = wcwidth(wc);
-			if (w == -1)
-				w = 2; /* assume non-printable will be displayed as ^{char} */
-			width += w;
-		}
+			int cw;
+			if (ISASCII(c)) {
+				/* non-printable characters will be displayed as ^{char} */
+				cw = (c == '\t' || (c >= 0x20 && c != 0x7f)) ? 1 : 2;
+			} else {
+				char buf[MB_LEN_MAX];
+				const char *mb = s;
+				size_t len = it.end - s;
+				if (len < sizeof buf) {
+					/* the codepoint might continue in the next piece */
+					len = text_bytes_get(txt, pos, sizeof buf, buf);
+					mb = buf;
+				}
+				wchar_t wc;
+				mbstate_t ps = { 0 };
+				size_t wclen = mbrtowc(&wc, mb, len, &ps);
+				if (wclen == (size_t)-1) {
+					/* assume a replacement symbol will be displayed */
+					cw = 1;
+				} else if (wclen == (size_t)-2) {
+					/* an incomplete codepoint at the end of the text */
+					cw = 0;
+				} else if ((cw = wcwidth(wc)) == -1) {
+					cw = 2;
+				}
+			}
 
-		if (!text_iterator_codepoint_next(&it, NULL))
-			break;
+			if (w + cw >= limit)
+				goto out;
+			w += cw;
+			codepoint = true;
+		}
+		pos = it.pos + (it.end - it.text);
 	}
+out:
+	*width = w;
+	return pos;
+}
 
+int text_line_width_get(Text *txt, size_t pos) {
+	int width;
+	line_width_walk(txt, text_line_begin(txt, pos), pos, INT_MAX, &width);
 	return width;
 }
 
 size_t text_line_width_set(Text *txt, size_t pos, int width) {
-	int cur_width = 0;
-	mbstate_t ps = { 0 };
-	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
-
-	for (;;) {
-		char buf[MB_LEN_MAX];
-		size_t len = text_bytes_get(txt, it.pos, sizeof buf, buf);
-		if (len == 0 || buf[0] == '\n')
-			break;
-		wchar_t wc;
-		size_t wclen = mbrtowc(&wc, buf, len, &ps);
-		if (wclen == (size_t)-1 && errno == EILSEQ) {
-			ps = (mbstate_t){0};
-			/* assume a replacement symbol will be displayed */
-			cur_width++;
-		} else if (wclen == (size_t)-2) {
-			/* do nothing, advance to next character */
-		} else if (wclen == 0) {
-			/* assume NUL byte will be displayed as ^@ */
-			cur_width += 2;
-		} else if (buf[0] == '\t') {
-			cur_width++;
-		} else {
-			int w = wcwidth(wc);
-			if (w == -1)
-				w = 2; /* assume non-printable will be displayed as ^{char} */
-			cur_width += w;
-		}
-
-		if (cur_width >= width || !text_iterator_codepoint_next(&it, NULL))
-			break;
-	}
-
-	return it.pos;
+	int cur_width;
+	return line_width_walk(txt, text_line_begin(txt, pos), SIZE_MAX, width, &cur_width);
 }
 
 size_t text_line_char_next(Text *txt, size_t pos) {
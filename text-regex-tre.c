@@ -113,6 +113,7 @@ void text_regex_free(Regex *r) {
 }
 
 int text_regex_compile(Regex *regex, const char *string, int cflags) {
+	tre_regfree(&regex->regex);
 	int r = tre_regcomp(&regex->regex, string, cflags);
 	if (r)
 		tre_regcomp(&regex->regex, "\0\0", 0);
@@ -164,3 +165,22 @@ int text_search_range_backward(Text *txt, size_t pos, size_t len, Regex *r, size
 
 	return ret;
 }
+
+size_t text_search_all(Text *txt, Filerange *range, Regex *r, size_t nmatch, int eflags,
+                       bool (*handle)(RegexMatch pmatch[], void *data), void *data) {
+	size_t count = 0;
+	RegexMatch pmatch[MAX_REGEX_SUB];
+	nmatch = MAX(1, MIN(nmatch, MAX_REGEX_SUB));
+	for (size_t pos = range->start; pos < range->end; ) {
+		char c;
+		if (pos > range->start)
+			eflags = text_byte_get(txt, pos - 1, &c) && c != '\n' ? eflags | REG_NOTBOL : eflags & ~REG_NOTBOL;
+		if (text_search_range_forward(txt, pos, range->end - pos, r, nmatch, pmatch, eflags))
+			break;
+		count++;
+		if (!handle(pmatch, data))
+			break;
+		pos = pmatch[0].end + (pmatch[0].start == pmatch[0].end);
+	}
+	return count;
+}
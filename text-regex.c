@@ -1,7 +1,24 @@
+/* initial and maximal size of the windows copied out of the text while searching */
+#ifndef REGEX_WINDOW_MIN
+#define REGEX_WINDOW_MIN (1 << 12)
+#endif
+#ifndef REGEX_WINDOW_MAX
+#define REGEX_WINDOW_MAX (1 << 20)
+#endif
+
 struct Regex {
 	regex_t regex;
+	bool multiline; /* whether the pattern might match a new line */
+	char *buf;      /* search window, reused across searches */
+	size_t bufsize;
 };
 
+typedef struct {
+	size_t pos, len; /* text range currently held in the buffer */
+	size_t end;      /* end of the search range */
+	size_t size;     /* size of the next window */
+} RegexWindow;
+
 Regex *text_regex_new(void) {
 	Regex *r = calloc(1, sizeof(Regex));
 	if (!r)
@@ -10,10 +27,31 @@ Regex *text_regex_new(void) {
 	return r;
 }
 
+/* Conservatively determine whether a match might contain a new line. With
+ * REG_NEWLINE neither `.` nor non-matching lists match it, which leaves
+ * literal control characters, character classes and GNU escapes. */
+static bool regex_multiline(const char *pattern, int cflags) {
+	if (!(cflags & REG_NEWLINE))
+		return true;
+	for (const char *s = pattern; *s; s++) {
+		if ((unsigned char)*s < ' ')
+			return true;
+		if (s[0] == '\\' && s[1] && strchr("sW", s[1]))
+			return true;
+		if (!strncmp(s, "[:space:]", 9) || !strncmp(s, "[:cntrl:]", 9))
+			return true;
+		if (s[0] == '\\' && s[1])
+			s++;
+	}
+	return false;
+}
+
 int text_regex_compile(Regex *regex, const char *string, int cflags) {
+	regfree(&regex->regex);
 	int r = regcomp(&regex->regex, string, cflags);
 	if (r)
 		regcomp(&regex->regex, "\0\0", 0);
+	regex->multiline = r || regex_multiline(string, cflags);
 	return r;
 }
 
@@ -27,6 +65,7 @@ void text_regex_free(Regex *r) {
 	if (!r)
 		return;
 	regfree(&r->regex);
+	free(r->buf);
 	free(r);
 }
 
@@ -34,21 +73,57 @@ int text_regex_match(Regex *r, const char *data, int eflags) {
 	return regexec(&r->regex, data, 0, NULL, eflags);
 }
 
-int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
-	char *buf = text_bytes_alloc0(txt, pos, len);
-	if (!buf)
-		return REG_NOMATCH;
-	char *cur = buf, *end = buf + len;
-	int ret = REG_NOMATCH;
+/* Copy the next window of whole lines into the regex buffer. Unless the
+ * pattern might match across lines, the window size grows geometrically
+ * but is bounded by REGEX_WINDOW_MAX plus the length of the longest line. */
+static bool regex_window_next(Text *txt, Regex *r, RegexWindow *w) {
+	size_t pos = w->pos + w->len;
+	if (pos >= w->end)
+		return false;
+	size_t end = w->end;
+	if (!r->multiline && end - pos > w->size) {
+		Iterator it = text_iterator_get(txt, pos + w->size - 1);
+		if (text_iterator_byte_find_next(&it, '\n') && it.pos < end)
+			end = it.pos + 1;
+		if (w->size < REGEX_WINDOW_MAX)
+			w->size *= 2;
+	}
+	size_t len = end - pos;
+	if (len + 1 > r->bufsize) {
+		size_t size = MAX(len + 1, REGEX_WINDOW_MIN + 1);
+		char *buf = realloc(r->buf, size);
+		if (!buf)
+			return false;
+		r->buf = buf;
+		r->bufsize = size;
+	}
+	size_t got = text_bytes_get(txt, pos, len, r->buf);
+	if (got < len)
+		w->end = pos + got;
+	len = got;
+	r->buf[len] = '\0';
+	w->pos = pos;
+	w->len = len;
+	return len > 0;
+}
+
+/* search the current window, matches at its end are deferred to the next one */
+static int regex_window_forward(Regex *r, RegexWindow *w, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	char *cur = r->buf, *end = r->buf + w->len;
+	size_t pos = w->pos, len = w->len;
+	bool last = w->pos + w->len >= w->end;
+	if (!last)
+		eflags |= REG_NOTEOL;
 	regmatch_t match[MAX_REGEX_SUB];
 	for (size_t junk = len; len > 0; len -= junk, pos += junk) {
-		ret = regexec(&r->regex, cur, nmatch, match, eflags);
-		if (!ret) {
+		if (!regexec(&r->regex, cur, nmatch, match, eflags)) {
+			if (!last && nmatch > 0 && cur + match[0].rm_so == end)
+				return REG_NOMATCH;
 			for (size_t i = 0; i < nmatch; i++) {
 				pmatch[i].start = match[i].rm_so == -1 ? EPOS : pos + match[i].rm_so;
 				pmatch[i].end = match[i].rm_eo == -1 ? EPOS : pos + match[i].rm_eo;
 			}
-			break;
+			return 0;
 		}
 		char *next = memchr(cur, 0, len);
 		if (!next)
@@ -58,21 +133,23 @@ int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_
 		junk = next - cur;
 		cur = next;
 	}
-	free(buf);
-	return ret;
+	return REG_NOMATCH;
 }
 
-int text_search_range_backward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
-	char *buf = text_bytes_alloc0(txt, pos, len);
-	if (!buf)
-		return REG_NOMATCH;
-	char *cur = buf, *end = buf + len;
-	int ret = REG_NOMATCH;
+/* find the last match in the current window, returns whether one was found */
+static bool regex_window_backward(Regex *r, RegexWindow *w, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	char *cur = r->buf, *end = r->buf + w->len;
+	size_t pos = w->pos, len = w->len;
+	bool last = w->pos + w->len >= w->end, found = false;
+	if (!last)
+		eflags |= REG_NOTEOL;
 	regmatch_t match[MAX_REGEX_SUB];
 	for (size_t junk = len; len > 0; len -= junk, pos += junk) {
 		char *next;
 		if (!regexec(&r->regex, cur, nmatch, match, eflags)) {
-			ret = 0;
+			if (!last && nmatch > 0 && cur + match[0].rm_so == end)
+				break;
+			found = true;
 			for (size_t i = 0; i < nmatch; i++) {
 				pmatch[i].start = match[i].rm_so == -1 ? EPOS : pos + match[i].rm_so;
 				pmatch[i].end = match[i].rm_eo == -1 ? EPOS : pos + match[i].rm_eo;
@@ -101,6 +178,72 @@ int text_search_range_backward(Text *txt, size_t pos, size_t len, Regex *r, size
 		else
 			eflags |= REG_NOTBOL;
 	}
-	free(buf);
+	return found;
+}
+
+int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	RegexWindow w = { .pos = pos, .end = pos + len, .size = REGEX_WINDOW_MIN };
+	while (regex_window_next(txt, r, &w)) {
+		if (!regex_window_forward(r, &w, nmatch, pmatch, eflags))
+			return 0;
+		/* all but the first window start at the beginning of a line */
+		eflags &= ~REG_NOTBOL;
+	}
+	return REG_NOMATCH;
+}
+
+int text_search_range_backward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	int ret = REG_NOMATCH;
+	RegexWindow w = { .pos = pos, .end = pos + len, .size = REGEX_WINDOW_MAX };
+	while (regex_window_next(txt, r, &w)) {
+		if (regex_window_backward(r, &w, nmatch, pmatch, eflags))
+			ret = 0;
+		eflags &= ~REG_NOTBOL;
+	}
 	return ret;
 }
+
+size_t text_search_all(Text *txt, Filerange *range, Regex *r, size_t nmatch, int eflags,
+                       bool (*handle)(RegexMatch pmatch[], void *data), void *data) {
+	size_t count = 0, pos = range->start;
+	RegexMatch pmatch[MAX_REGEX_SUB];
+	regmatch_t match[MAX_REGEX_SUB];
+	nmatch = MAX(1, MIN(nmatch, MAX_REGEX_SUB));
+	RegexWindow w = { .pos = pos, .end = range->end, .size = REGEX_WINDOW_MIN };
+	while (regex_window_next(txt, r, &w)) {
+		char *end = r->buf + w.len;
+		bool last = w.pos + w.len >= w.end;
+		int wflags = last ? eflags : eflags | REG_NOTEOL;
+		if (pos < w.pos)
+			pos = w.pos;
+		while (pos < w.pos + w.len) {
+			char *cur = r->buf + (pos - w.pos);
+			if (cur > r->buf)
+				wflags = cur[-1] == '\n' ? wflags & ~REG_NOTBOL : wflags | REG_NOTBOL;
+			if (regexec(&r->regex, cur, nmatch, match, wflags)) {
+				/* continue after an embedded NUL byte, if any */
+				char *next = memchr(cur, 0, end - cur);
+				if (!next)
+					break;
+				while (!*next && next != end)
+					next++;
+				pos = w.pos + (next - r->buf);
+				continue;
+			}
+			if (!last && cur + match[0].rm_so == end)
+				break;
+			for (size_t i = 0; i < nmatch; i++) {
+				pmatch[i].start = match[i].rm_so == -1 ? EPOS : pos + match[i].rm_so;
+				pmatch[i].end = match[i].rm_eo == -1 ? EPOS : pos + match[i].rm_eo;
+			}
+			count++;
+			if (!handle(pmatch, data))
+				return count;
+			/* skip over empty matches to guarantee progress */
+			pos = pmatch[0].end + (pmatch[0].start == pmatch[0].end);
+		}
+		/* all but the first window start at the beginning of a line */
+		eflags &= ~REG_NOTBOL;
+	}
+	return count;
+}
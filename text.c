@@ -2,20 +2,95 @@
 
 #include "text.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  #include <immintrin.h>
+  #define LINES_KERNEL_X86 1
+#else
+  #define LINES_KERNEL_X86 0
+#endif
+
+/* Block holding the file content, either readonly mmap(2)-ed from the original
+ * file or heap allocated to store the modifications.
+ */
+typedef struct {
+	size_t size;               /* maximal capacity */
+	size_t len;                /* current used length / insertion position */
+	char *data;                /* actual data */
+	size_t *lines;             /* lines[i]: number of '\n' in data[0, (i+1)*BLOCK_LINES_INTERVAL) */
+	size_t lines_size;         /* capacity of the lines array */
+	size_t lines_len;          /* number of valid entries in the lines array */
+	size_t refs;               /* number of allocated pieces referring to the block */
+	size_t spans;              /* number of span entries referring to the block */
+	bool released;             /* whether the text freed the block while spans still refer to it */
+	int fd;                    /* the mmap(2)-ed file of a BLOCK_TYPE_MMAP_ORIG block or -1 */
+	enum {                     /* type of allocation */
+		BLOCK_TYPE_MMAP_ORIG, /* mmap(2)-ed from an external file */
+		BLOCK_TYPE_MMAP,      /* mmap(2)-ed from a temporary file only known to this process */
+		BLOCK_TYPE_MALLOC,    /* heap allocated block using malloc(3) */
+	} type;
+} Block;
+
+/* Pieces, changes and revisions are carved out of slabs of geometrically
+ * increasing size. The slabs are only released as a whole once the text is
+ * freed, objects discarded while compacting the history are reused.
+ */
+#define SLAB_OBJECTS_MIN 32
+#define SLAB_OBJECTS_MAX (1 << 14)
+
+typedef union {                /* maximal alignment of the objects stored in a slab */
+	void *ptr;
+	long long ll;
+	long double ld;
+} SlabAlign;
+
+typedef struct Slab Slab;
+struct Slab {
+	Slab *next;                /* previously allocated slab */
+	size_t size;               /* number of objects the slab can hold */
+	size_t used;               /* number of objects handed out so far */
+	SlabAlign data[];          /* storage of the objects */
+};
+
+typedef struct {
+	size_t size;               /* object size, a multiple of the alignment */
+	Slab *slabs;               /* most recently allocated slab */
+	void *free;                /* list of released objects, linked through their first word */
+} Pool;
+
+/* marks the new line count of a piece as not yet determined */
+#define LINES_UNKNOWN SIZE_MAX
+/* distance in bytes between display width checkpoints of long lines */
+#ifndef LINE_WIDTH_INTERVAL
+#define LINE_WIDTH_INTERVAL (1 << 14)
+#endif
+
+typedef struct TextChange TextChange;
+
 /* A piece holds a reference (but doesn't itself store) a certain amount of data.
  * All active pieces chained together form the whole content of the document.
  * At the beginning there exists only one piece, spanning the whole document.
  * Upon insertion/deletion new pieces will be created to represent the changes.
  * Generally pieces are never destroyed, but kept around to perform undo/redo
- * operations.
+ * operations. Only compacting the history releases those no longer needed.
  */
 struct Piece {
 	Text *text;             /* text to which this piece belongs */
 	Piece *prev, *next;     /* pointers to the logical predecessor/successor */
-	Piece *global_prev;     /* double linked list in order of allocation, */
-	Piece *global_next;     /* used to free individual pieces */
+	Piece *parent;          /* position in the balanced search tree indexing */
+	Piece *left, *right;    /* all pieces which are currently part of the chain */
+	size_t size;            /* sum of the lengths of all pieces in this subtree */
+	size_t size_lines;      /* sum of the new lines of all pieces in this subtree */
+	uint32_t priority;      /* random heap priority used to keep the tree balanced */
+	Piece *mark_parent;     /* position in the search tree indexing all non-empty */
+	Piece *mark_left;       /* pieces of the chain by data address, used to */
+	Piece *mark_right;      /* resolve marks */
+	Block *block;           /* the Block holding the data */
 	const char *data;       /* pointer into a Block holding the data */
 	size_t len;             /* the length in number of bytes of the data */
+	size_t lines;           /* number of '\n' in data or LINES_UNKNOWN */
+	TextChange *change;     /* change which introduced the piece, if it has reserved space */
+	size_t reserved;        /* bytes following data which are reserved to grow the piece */
+	size_t snapshot;        /* the reserved space is only valid until the next snapshot */
 };
 
 /* used to transform a global position (byte offset starting from the beginning
@@ -34,8 +109,36 @@ typedef struct {
 	size_t len;             /* the sum of the lengths of the pieces which form this span */
 } Span;
 
+/* state of a set of edits being applied to consecutive pieces */
+typedef struct {
+	Piece *before;          /* piece preceding the affected pieces */
+	Piece *first, *last;    /* affected pieces which are swapped out, first is NULL if none */
+	size_t pos;             /* current position, relative to the unmodified text */
+	size_t end;             /* position after the last affected piece */
+	Span new;               /* pieces which are swapped in */
+} EditCluster;
+
+/* An entry of a TextSpan, the data is never modified once it is referenced. */
+typedef struct {
+	Block *block;           /* the Block holding the data */
+	const char *data;       /* pointer into the block */
+	size_t len;             /* the length in number of bytes of the data */
+} TextSpanEntry;
+
+/* A TextSpan references the content of a range as it was at the time it was
+ * taken. It keeps the blocks alive, even once the text itself is freed. Data
+ * mapped from a file is copied at that point, because the file can then be
+ * modified without anyone noticing. */
+struct TextSpan {
+	TextSpan *next;         /* next span referring to mapped data of the same text */
+	TextSpan **link;        /* reference to this span in that list or NULL */
+	size_t len;             /* sum of the lengths of all entries */
+	size_t count;           /* number of entries */
+	size_t size;            /* number of entries which fit into the allocation */
+	TextSpanEntry entries[];
+};
+
 /* A Change keeps all needed information to redo/undo an insertion/deletion. */
-typedef struct TextChange TextChange;
 struct TextChange {
 	Span old;               /* all pieces which are being modified/swapped out by the change */
 	Span new;               /* all pieces which are introduced/swapped in by the change */
@@ -56,26 +159,42 @@ struct Revision {
 	Revision *later;        /* the next Revision, chronologically */
 	time_t time;            /* when the first change of this revision was performed */
 	size_t seq;             /* a unique, strictly increasing identifier */
+	size_t journal;         /* offset of the changes in the journal, if they are not yet loaded */
+	bool dropped;           /* whether the revision is discarded by a history compaction */
 };
 
+/* records of a journal, the one being built starts at len */
 typedef struct {
-	size_t pos;             /* position in bytes from start of file */
-	size_t lineno;          /* line number in file i.e. number of '\n' in [0, pos) */
-} LineCache;
+	char *data;
+	size_t len;
+	size_t size;
+} JournalBuffer;
 
-/* Block holding the file content, either readonly mmap(2)-ed from the original
- * file or heap allocated to store the modifications.
- */
+/* append-only on-disk record of the history, see text-journal.c */
 typedef struct {
-	size_t size;               /* maximal capacity */
-	size_t len;                /* current used length / insertion position */
-	char *data;                /* actual data */
-	enum {                     /* type of allocation */
-		BLOCK_TYPE_MMAP_ORIG, /* mmap(2)-ed from an external file */
-		BLOCK_TYPE_MMAP,      /* mmap(2)-ed from a temporary file only known to this process */
-		BLOCK_TYPE_MALLOC,    /* heap allocated block using malloc(3) */
-	} type;
-} Block;
+	int fd;                 /* journal opened for appending or -1 once writing failed */
+	Block *block;           /* its content as of opening, mmap(2)-ed */
+	JournalBuffer pending;  /* complete records not yet written */
+	bool unsynced;          /* whether records were written since the last fsync(2) */
+	size_t revisions;       /* number of revisions recorded, identifier of the next one */
+	size_t save_size;       /* size and content hash of the revision being saved */
+	uint64_t save_hash;
+} Journal;
+
+/* the display width of a line up to the codepoint at pos */
+typedef struct {
+	size_t pos;
+	int width;
+} LineWidth;
+
+/* display width checkpoints of a long line, spaced LINE_WIDTH_INTERVAL bytes apart */
+typedef struct {
+	LineWidth *data;
+	VisDACount count;
+	VisDACount capacity;
+	size_t line;            /* start of the line they belong to */
+	size_t version;         /* modification count of the text when they were recorded */
+} LineWidths;
 
 /* The main struct holding all information of a given file */
 struct Text {
@@ -86,62 +205,121 @@ struct Text {
 	VisDACount   count;
 	VisDACount   capacity;
 
-	Piece *pieces;          /* all pieces which have been allocated, used to free them */
+	Pool pieces;            /* allocators for all pieces, changes and revisions */
+	Pool changes;
+	Pool revisions;
 	Piece *cache;           /* most recently modified piece */
+	size_t snapshots;       /* number of snapshots taken, invalidates reserved space */
 	Piece begin, end;       /* sentinel nodes which always exists but don't hold any data */
+	Piece *tree;            /* root of the search tree over all pieces in the chain */
+	Piece *marks;           /* root of the search tree over their data addresses */
+	uint32_t seed;          /* state of the generator for tree priorities */
 	Revision *history;        /* undo tree */
 	Revision *current_revision; /* revision holding all file changes until a snapshot is performed */
 	Revision *last_revision;    /* the last revision added to the tree, chronologically */
 	Revision *saved_revision;   /* the last revision at the time of the save operation */
+	Revision *save_revision;    /* the revision written by the save operation in progress */
 	size_t size;            /* current file content size in bytes */
+	size_t version;         /* number of modifications, invalidates the width checkpoints */
+	bool loading;           /* whether content is still appended by text_load_fd */
+	size_t changed;         /* lowest position modified since text_changed was last called */
+	LineWidths widths[4];   /* checkpoints of the most recently measured lines, most recent first */
 	struct stat info;       /* stat as probed at load time */
-	LineCache lines;        /* mapping between absolute pos in bytes and logical line breaks */
+	Journal *journal;       /* on-disk record of the history or NULL */
+	TextSpan *spans;        /* spans referring to data mapped from a file */
 };
 
-#include "text-common.c"
-#include "text-util.c"
-#include "text-io.c"
-#include "text-iterator.c"
-#include "text-motions.c"
-#include "text-objects.c"
-#if CONFIG_TRE
-  #include "text-regex-tre.c"
-#else
-  #include "text-regex.c"
-#endif
-
 /* cache layer */
 static void cache_piece(Text *txt, Piece *p);
 static bool cache_contains(Text *txt, Piece *p);
 static bool cache_insert(Text *txt, Piece *p, size_t off, const char *data, size_t len);
 static bool cache_delete(Text *txt, Piece *p, size_t off, size_t len);
+static void reserve_piece(Text *txt, Piece *p, TextChange *c, size_t size);
+static bool reserve_contains(Text *txt, Piece *p);
+static bool reserve_insert(Text *txt, Piece *p, size_t off, const char *data, size_t len);
+static bool reserve_delete(Text *txt, Piece *p, size_t off, size_t len);
 /* piece management */
 static Piece *piece_alloc(Text *txt);
-static void piece_free(Piece *p);
-static void piece_init(Piece *p, Piece *prev, Piece *next, const char *data, size_t len);
+static void piece_free(Text *txt, Piece *p);
+static void piece_init(Piece *p, Piece *prev, Piece *next, Block *block, const char *data, size_t len);
+static size_t piece_lines(Piece *p, size_t off, size_t len);
+static size_t piece_lines_skip(Piece *p, size_t lines, size_t *lines_skipped);
 static Location piece_get_intern(Text *txt, size_t pos);
 static Location piece_get_extern(const Text *txt, size_t pos);
+/* piece index */
+static void index_update(Piece *p);
+static void index_split(Text *txt, Piece *p, Piece **left, Piece **right);
+static Piece *index_join(Piece *left, Piece *right);
+static Piece *index_build(Text *txt, Piece *start, Piece *end);
+static void index_insert(Text *txt, Piece *next, Piece *start, Piece *end);
+static void index_remove(Text *txt, Piece *start, Piece *end);
+static void index_resize(Piece *p);
+static Location index_get(const Text *txt, size_t pos);
+static size_t index_lines(Piece *p);
+static size_t index_lines_skip(Piece *p, size_t pos, size_t *lines);
+static size_t index_pos(Piece *p);
+static void mark_index_insert(Text *txt, Piece *p);
+static void mark_index_remove(Text *txt, Piece *p);
+static Piece *mark_index_get(const Text *txt, Mark mark);
 /* span management */
 static void span_init(Span *span, Piece *start, Piece *end);
 static void span_swap(Text *txt, Span *old, Span *new);
+static void span_free(Text *txt, Span *span);
 /* change management */
 static TextChange *text_change_alloc(Text *txt, size_t pos);
-static void text_change_free(TextChange *c);
+static void text_changed_at(Text *txt, size_t pos);
 /* revision management */
 static Revision *revision_alloc(Text *txt);
-static void revision_free(Revision *rev);
-/* logical line counting cache */
-static void lineno_cache_invalidate(LineCache *cache);
-static size_t lines_skip_forward(Text *txt, size_t pos, size_t lines, size_t *lines_skipped);
-static size_t lines_count(Text *txt, size_t pos, size_t len);
-
-/* stores the given data in a block, allocates a new one if necessary. Returns
- * a pointer to the storage location or NULL if allocation failed. */
-static const char *block_store(Vis *vis, Text *txt, const char *data, size_t len)
+static bool history_change_branch(Revision *rev);
+static size_t history_traverse_to(Text *txt, Revision *rev);
+/* memory management */
+static void pool_init(Pool *pool, size_t size);
+static void *pool_alloc(Pool *pool);
+static void pool_free(Pool *pool, void *obj);
+static void pool_release(Pool *pool);
+/* logical line counting */
+static size_t lines_count(const char *data, size_t len);
+static size_t lines_skip_forward(const char *data, size_t len, size_t lines, size_t *lines_skipped);
+static size_t block_lines(Block *blk, size_t off);
+/* display width checkpoints */
+static LineWidths *line_widths_get(Text *txt, size_t line);
+static LineWidth line_widths_find(const LineWidths *widths, size_t pos, int width);
+static void line_widths_add(LineWidths *widths, size_t pos, int width);
+
+/* history journal */
+static void journal_revision(Text *txt, Revision *rev);
+static void journal_save_begin(Text *txt);
+static void journal_saved(Text *txt, Revision *rev);
+static void journal_compacted(Text *txt, Revision *root);
+static bool journal_load(Text *txt, Revision *rev, bool applied);
+static void journal_free(Journal *j);
+
+static bool text_edit_reserve(Vis *vis, Text *txt, const TextEdit *edits, size_t count, size_t reserve, Block *block);
+
+#include "text-common.c"
+#include "text-util.c"
+#include "text-io.c"
+#include "text-iterator.c"
+#include "text-journal.c"
+#include "text-motions.c"
+#include "text-objects.c"
+#if CONFIG_TRE
+  #include "text-regex-tre.c"
+#else
+  #include "text-regex.c"
+#endif
+
+/* stores the given data in a block, allocates a new one if necessary. The
+ * block is guaranteed to have space for another reserve bytes after it.
+ * Returns a pointer to the storage location or NULL if allocation failed. */
+static const char *block_store(Vis *vis, Text *txt, const char *data, size_t len, size_t reserve)
 {
 	Block *b = txt->count > 0 ? txt->data[txt->count - 1] : 0;
-	if (!b || !block_capacity(b, len)) {
-		b = block_alloc(len);
+	size_t size;
+	if (!addu(len, reserve, &size))
+		return 0;
+	if (!b || !block_capacity(b, size)) {
+		b = block_alloc(size);
 		if (!b)
 			return 0;
 		*da_push(vis, txt) = b;
@@ -189,9 +367,15 @@ static bool cache_insert(Text *txt, Piece *p, size_t off, const char *data, size
 	size_t bufpos = p->data + off - blk->data;
 	if (!block_insert(blk, bufpos, data, len))
 		return false;
+	if (p->lines != LINES_UNKNOWN)
+		p->lines += lines_count(data, len);
 	p->len += len;
+	index_resize(p);
+	if (p->len == len)
+		mark_index_insert(txt, p);
 	txt->current_revision->change->new.len += len;
 	txt->size += len;
+	txt->version++;
 	return true;
 }
 
@@ -206,14 +390,160 @@ static bool cache_delete(Text *txt, Piece *p, size_t off, size_t len)
 	Block *blk = txt->data[txt->count - 1];
 	size_t end;
 	size_t bufpos = p->data + off - blk->data;
-	if (!addu(off, len, &end) || end > p->len || !block_delete(blk, bufpos, len))
+	if (!addu(off, len, &end) || end > p->len)
+		return false;
+	size_t lines = p->lines == LINES_UNKNOWN ? 0 : lines_count(p->data + off, len);
+	if (!block_delete(blk, bufpos, len))
 		return false;
+	if (p->lines != LINES_UNKNOWN)
+		p->lines -= lines;
 	p->len -= len;
+	index_resize(p);
+	if (p->len == 0)
+		mark_index_remove(txt, p);
 	txt->current_revision->change->new.len -= len;
 	txt->size -= len;
+	txt->version++;
 	return true;
 }
 
+/* reserve size bytes following the data of the given piece, which was just
+ * stored at the end of its block, to grow it in place */
+static void reserve_piece(Text *txt, Piece *p, TextChange *c, size_t size)
+{
+	Block *blk = p->block;
+	if (!blk || p->data + p->len != blk->data + blk->len)
+		return;
+	size = MIN(size, blk->size - blk->len);
+	if (size == 0)
+		return;
+	memset(blk->data + blk->len, 0, size);
+	blk->len += size;
+	p->change = c;
+	p->reserved = size;
+	p->snapshot = txt->snapshots;
+}
+
+/* check whether the given piece can still be grown in place, that is the
+ * change which introduced it is part of the current revision */
+static bool reserve_contains(Text *txt, Piece *p)
+{
+	return p->change && p->snapshot == txt->snapshots;
+}
+
+/* an offset at the end of a piece might as well refer to the start of the
+ * next one, prefer whichever of them has reserved space */
+static Piece *reserve_locate(Text *txt, Piece *p, size_t *off)
+{
+	if (*off == p->len && p->next && reserve_contains(txt, p->next)) {
+		*off = 0;
+		return p->next;
+	}
+	return reserve_contains(txt, p) ? p : NULL;
+}
+
+/* try to insert a chunk of data at a given piece offset, using the space
+ * reserved after it. The length of the piece, the span containing it and
+ * the whole text is adjusted accordingly */
+static bool reserve_insert(Text *txt, Piece *p, size_t off, const char *data, size_t len)
+{
+	if (!(p = reserve_locate(txt, p, &off)) || p->reserved < len)
+		return false;
+	Block *blk = p->block;
+	char *insert = blk->data + (p->data - blk->data) + off;
+	block_lines_invalidate(blk, insert - blk->data);
+	memmove(insert + len, insert, p->len - off);
+	memcpy(insert, data, len);
+	if (p->lines != LINES_UNKNOWN)
+		p->lines += lines_count(data, len);
+	p->len += len;
+	p->reserved -= len;
+	index_resize(p);
+	if (p->len == len)
+		mark_index_insert(txt, p);
+	p->change->new.len += len;
+	txt->size += len;
+	txt->version++;
+	return true;
+}
+
+/* try to delete a chunk of data at a given piece offset, the whole affected
+ * range has to lie within a piece with reserved space, to which it is added */
+static bool reserve_delete(Text *txt, Piece *p, size_t off, size_t len)
+{
+	size_t end;
+	if (!(p = reserve_locate(txt, p, &off)) || !addu(off, len, &end) || end > p->len)
+		return false;
+	Block *blk = p->block;
+	char *delete = blk->data + (p->data - blk->data) + off;
+	if (p->lines != LINES_UNKNOWN)
+		p->lines -= lines_count(delete, len);
+	block_lines_invalidate(blk, delete - blk->data);
+	memmove(delete, delete + len, p->len - end);
+	p->len -= len;
+	p->reserved += len;
+	index_resize(p);
+	if (p->len == 0)
+		mark_index_remove(txt, p);
+	p->change->new.len -= len;
+	txt->size -= len;
+	txt->version++;
+	return true;
+}
+
+/* get the width checkpoints of the line starting at the given position. They
+ * are discarded once the text is modified. */
+static LineWidths *line_widths_get(Text *txt, size_t line)
+{
+	LineWidths *widths = txt->widths;
+	size_t i = 0;
+	while (i < LENGTH(txt->widths) - 1 && (widths[i].line != line || widths[i].version != txt->version))
+		i++;
+	LineWidths found = widths[i];
+	if (found.line != line || found.version != txt->version) {
+		/* reuse the storage of the least recently used entry */
+		found.count = 0;
+		found.line = line;
+		found.version = txt->version;
+	}
+	memmove(widths + 1, widths, i * sizeof *widths);
+	widths[0] = found;
+	return widths;
+}
+
+/* find the last checkpoint before pos whose width is less than the given
+ * one, defaults to the start of the line */
+static LineWidth line_widths_find(const LineWidths *widths, size_t pos, int width)
+{
+	LineWidth found = { widths->line, 0 };
+	size_t lo = 0, hi = widths->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const LineWidth *cp = &widths->data[mid];
+		if (cp->pos <= pos && cp->width < width) {
+			found = *cp;
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return found;
+}
+
+/* record a checkpoint, they have to be added in ascending order */
+static void line_widths_add(LineWidths *widths, size_t pos, int width)
+{
+	if (widths->count == widths->capacity) {
+		VisDACount capacity = widths->capacity ? 2 * widths->capacity : DA_INITIAL_CAP;
+		LineWidth *data = realloc(widths->data, capacity * sizeof *data);
+		if (!data)
+			return;
+		widths->data = data;
+		widths->capacity = capacity;
+	}
+	widths->data[widths->count++] = (LineWidth){ pos, width };
+}
+
 /* initialize a span and calculate its length */
 static void span_init(Span *span, Piece *start, Piece *end) {
 	size_t len = 0;
@@ -229,19 +559,23 @@ static void span_init(Span *span, Piece *start, Piece *end) {
 
 /* swap out an old span and replace it with a new one.
  *
- *  - if old is an empty span do not remove anything, just insert the new one
- *  - if new is an empty span do not insert anything, just remove the old one
+ *  - if old holds no pieces do not remove anything, just insert the new one
+ *  - if new holds no pieces do not insert anything, just remove the old one
  *
- * adjusts the document size accordingly.
+ * Pieces which were shrunk to zero length in place are still swapped, a span
+ * is part of the chain exactly if the change introducing it is applied.
+ * Adjusts the document size and the piece index accordingly.
  */
 static void span_swap(Text *txt, Span *old, Span *new) {
-	if (old->len == 0 && new->len == 0) {
+	if (!old->start && !new->start)
 		return;
-	} else if (old->len == 0) {
+	if (old->start)
+		index_remove(txt, old->start, old->end);
+	if (!old->start) {
 		/* insert new span */
 		new->start->prev->next = new->start;
 		new->end->next->prev = new->end;
-	} else if (new->len == 0) {
+	} else if (!new->start) {
 		/* delete old span */
 		old->start->prev->next = old->end->next;
 		old->end->next->prev = old->start->prev;
@@ -250,21 +584,35 @@ static void span_swap(Text *txt, Span *old, Span *new) {
 		old->start->prev->next = new->start;
 		old->end->next->prev = new->end;
 	}
+	if (new->start)
+		index_insert(txt, new->end->next, new->start, new->end);
 	txt->size -= old->len;
 	txt->size += new->len;
+	txt->version++;
+}
+
+/* release all pieces of a span. Its pieces must still be linked as they were
+ * when the span was swapped out for the last time. */
+static void span_free(Text *txt, Span *span) {
+	for (Piece *next, *p = span->start; p; p = next) {
+		next = p == span->end ? NULL : p->next;
+		piece_free(txt, p);
+	}
 }
 
 /* Allocate a new revision and place it in the revision graph.
  * All further changes will be associated with this revision. */
 static Revision *revision_alloc(Text *txt) {
-	Revision *rev = calloc(1, sizeof *rev);
+	Revision *rev = pool_alloc(&txt->revisions);
 	if (!rev)
 		return NULL;
 	rev->time = time(NULL);
 	txt->current_revision = rev;
 
-	/* set sequence number */
-	if (!txt->last_revision)
+	/* set sequence number, those of a journal identify its records */
+	if (txt->journal)
+		rev->seq = txt->journal->revisions++;
+	else if (!txt->last_revision)
 		rev->seq = 0;
 	else
 		rev->seq = txt->last_revision->seq + 1;
@@ -286,47 +634,132 @@ static Revision *revision_alloc(Text *txt) {
 	return rev;
 }
 
-static void revision_free(Revision *rev) {
-	if (!rev)
-		return;
-	for (TextChange *next, *c = rev->change; c; c = next) {
-		next = c->next;
-		text_change_free(c);
+static void pool_init(Pool *pool, size_t size) {
+	pool->size = (size + sizeof(SlabAlign) - 1) / sizeof(SlabAlign) * sizeof(SlabAlign);
+	pool->slabs = NULL;
+	pool->free = NULL;
+}
+
+/* returns a zero initialized object or NULL if allocation failed */
+static void *pool_alloc(Pool *pool) {
+	void *obj = pool->free;
+	if (obj) {
+		pool->free = *(void**)obj;
+		memset(obj, 0, pool->size);
+		return obj;
+	}
+	Slab *slab = pool->slabs;
+	if (!slab || slab->used == slab->size) {
+		size_t size = slab ? MIN(2 * slab->size, SLAB_OBJECTS_MAX) : SLAB_OBJECTS_MIN;
+		if (!(slab = malloc(sizeof *slab + size * pool->size)))
+			return NULL;
+		slab->next = pool->slabs;
+		slab->size = size;
+		slab->used = 0;
+		pool->slabs = slab;
+	}
+	obj = (char*)slab->data + slab->used++ * pool->size;
+	memset(obj, 0, pool->size);
+	return obj;
+}
+
+/* make an object available for reuse by subsequent allocations */
+static void pool_free(Pool *pool, void *obj) {
+	*(void**)obj = pool->free;
+	pool->free = obj;
+}
+
+static void pool_release(Pool *pool) {
+	for (Slab *next, *slab = pool->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
 	}
-	free(rev);
+	pool->slabs = NULL;
+	pool->free = NULL;
 }
 
 static Piece *piece_alloc(Text *txt) {
-	Piece *p = calloc(1, sizeof *p);
+	Piece *p = pool_alloc(&txt->pieces);
 	if (!p)
 		return NULL;
 	p->text = txt;
-	p->global_next = txt->pieces;
-	if (txt->pieces)
-		txt->pieces->global_prev = p;
-	txt->pieces = p;
 	return p;
 }
 
-static void piece_free(Piece *p) {
-	if (!p)
+/* release a piece, its block is freed once no other piece refers to it */
+static void piece_free(Text *txt, Piece *p) {
+	Block *blk = p->block;
+	pool_free(&txt->pieces, p);
+	if (!blk || --blk->refs > 0)
 		return;
-	if (p->global_prev)
-		p->global_prev->global_next = p->global_next;
-	if (p->global_next)
-		p->global_next->global_prev = p->global_prev;
-	if (p->text->pieces == p)
-		p->text->pieces = p->global_next;
-	if (p->text->cache == p)
-		p->text->cache = NULL;
-	free(p);
-}
-
-static void piece_init(Piece *p, Piece *prev, Piece *next, const char *data, size_t len) {
+	for (VisDACount i = 0; i < txt->count; i++) {
+		if (txt->data[i] == blk) {
+			da_ordered_remove(txt, i);
+			break;
+		}
+	}
+	block_free(blk);
+}
+
+static void piece_init(Piece *p, Piece *prev, Piece *next, Block *block, const char *data, size_t len) {
 	p->prev = prev;
 	p->next = next;
+	p->block = block;
 	p->data = data;
 	p->len = len;
+	p->lines = LINES_UNKNOWN;
+	if (block)
+		block->refs++;
+	/* only count new lines if it is cheap, otherwise defer it until needed */
+	if (!block || len <= BLOCK_LINES_INTERVAL ||
+	    (size_t)(data + len - block->data) / BLOCK_LINES_INTERVAL <= block->lines_len)
+		p->lines = piece_lines(p, 0, len);
+}
+
+/* count the new lines in the range [off, off+len) of the piece data */
+static size_t piece_lines(Piece *p, size_t off, size_t len) {
+	Block *blk = p->block;
+	if (!blk || len == 0)
+		return 0;
+	size_t start = p->data + off - blk->data;
+	if (start / BLOCK_LINES_INTERVAL <= blk->lines_len)
+		return block_lines(blk, start + len) - block_lines(blk, start);
+	return lines_count(p->data + off, len);
+}
+
+/* skip the given number of new lines from the start of the piece, returns the
+ * offset after the last skipped new line. If the piece contains fewer new lines,
+ * its length is returned. The number of skipped new lines is stored in
+ * lines_skipped. */
+static size_t piece_lines_skip(Piece *p, size_t lines, size_t *lines_skipped) {
+	Block *blk = p->block;
+	size_t skipped = 0, off = 0;
+	if (!blk || lines == 0) {
+		*lines_skipped = 0;
+		return 0;
+	}
+	size_t start = p->data - blk->data, end = start + p->len;
+	size_t lo = start / BLOCK_LINES_INTERVAL;
+	if (lo <= blk->lines_len) {
+		/* binary search the last recorded line count preceding the target */
+		size_t base = block_lines(blk, start), target = base + lines;
+		size_t hi = MIN(end / BLOCK_LINES_INTERVAL, blk->lines_len);
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo + 1) / 2;
+			if (blk->lines[mid-1] < target)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		if (lo * BLOCK_LINES_INTERVAL > start) {
+			off = lo * BLOCK_LINES_INTERVAL - start;
+			skipped = blk->lines[lo-1] - base;
+		}
+	}
+	size_t rem;
+	off += lines_skip_forward(p->data + off, p->len - off, lines - skipped, &rem);
+	*lines_skipped = skipped + rem;
+	return off;
 }
 
 /* returns the piece holding the text at byte offset pos. If pos happens to
@@ -338,14 +771,12 @@ static void piece_init(Piece *p, Piece *prev, Piece *next, const char *data, siz
  * in particular if pos is zero, the begin sentinel piece is returned.
  */
 static Location piece_get_intern(Text *txt, size_t pos) {
-	size_t cur = 0;
-	for (Piece *p = &txt->begin; p->next; p = p->next) {
-		if (cur <= pos && pos <= cur + p->len)
-			return (Location){ .piece = p, .off = pos - cur };
-		cur += p->len;
-	}
-
-	return (Location){ 0 };
+	if (pos == 0)
+		return (Location){ .piece = &txt->begin, .off = 0 };
+	Location loc = index_get(txt, pos - 1);
+	if (loc.piece)
+		loc.off++;
+	return loc;
 }
 
 /* similar to piece_get_intern but usable as a public API. Returns the piece
@@ -354,21 +785,289 @@ static Location piece_get_intern(Text *txt, size_t pos) {
  * the last piece holding data is returned.
  */
 static Location piece_get_extern(const Text *txt, size_t pos) {
-	size_t cur = 0;
-	Piece *p;
+	Location loc = index_get(txt, pos);
+	if (loc.piece)
+		return loc;
+	if (pos == txt->size)
+		return (Location){ .piece = txt->end.prev, .off = txt->end.prev->len };
+	return (Location){ 0 };
+}
 
-	for (p = txt->begin.next; p->next; p = p->next) {
-		if (cur <= pos && pos < cur + p->len)
-			return (Location){ .piece = p, .off = pos - cur };
-		cur += p->len;
+/* recompute the length of the subtree rooted at p from its children */
+static void index_update(Piece *p) {
+	Piece *children[] = { p->left, p->right };
+	p->size = p->len;
+	p->size_lines = p->lines;
+	for (size_t i = 0; i < LENGTH(children); i++) {
+		Piece *child = children[i];
+		if (!child)
+			continue;
+		p->size += child->size;
+		if (child->size_lines == LINES_UNKNOWN)
+			p->size_lines = LINES_UNKNOWN;
+		else if (p->size_lines != LINES_UNKNOWN)
+			p->size_lines += child->size_lines;
+	}
+}
+
+/* split the index into the pieces preceding p and the remaining ones. p
+ * is either an indexed piece or the end sentinel. The split proceeds bottom
+ * up from p, hence only its ancestors are visited. */
+static void index_split(Text *txt, Piece *p, Piece **left, Piece **right) {
+	if (p == &txt->end) {
+		*left = txt->tree;
+		*right = NULL;
+		return;
+	}
+	Piece *l = p->left, *r = p;
+	p->left = NULL;
+	index_update(p);
+	for (Piece *cur = p, *parent = p->parent; parent; cur = parent, parent = parent->parent) {
+		if (parent->left == cur) {
+			parent->left = r;
+			r->parent = parent;
+			r = parent;
+		} else {
+			parent->right = l;
+			if (l)
+				l->parent = parent;
+			l = parent;
+		}
+		index_update(parent);
+	}
+	if (l)
+		l->parent = NULL;
+	r->parent = NULL;
+	*left = l;
+	*right = r;
+}
+
+/* concatenate two trees, all pieces of left precede those of right */
+static Piece *index_join(Piece *left, Piece *right) {
+	if (!left || !right)
+		return left ? left : right;
+	if (left->priority > right->priority) {
+		left->right = index_join(left->right, right);
+		left->right->parent = left;
+		index_update(left);
+		return left;
+	}
+	right->left = index_join(left, right->left);
+	right->left->parent = right;
+	index_update(right);
+	return right;
+}
+
+/* build a tree from the pieces [start, end] in linear time. The right spine
+ * of the tree built so far serves as stack of insertion candidates. */
+static Piece *index_build(Text *txt, Piece *start, Piece *end) {
+	Piece *last = NULL, *root = NULL;
+	for (Piece *p = start; ; p = p->next) {
+		/* xorshift32, the state is never zero */
+		txt->seed ^= txt->seed << 13;
+		txt->seed ^= txt->seed >> 17;
+		txt->seed ^= txt->seed << 5;
+
+		Piece *child = NULL, *parent = last;
+		while (parent && parent->priority < txt->seed) {
+			index_update(parent);
+			child = parent;
+			parent = parent->parent;
+		}
+		p->priority = txt->seed;
+		p->left = child;
+		p->right = NULL;
+		p->parent = parent;
+		if (child)
+			child->parent = p;
+		if (parent)
+			parent->right = p;
+		last = p;
+		if (p == end)
+			break;
+	}
+	for (Piece *p = last; p; p = p->parent) {
+		index_update(p);
+		root = p;
+	}
+	return root;
+}
+
+/* insert the pieces [start, end] into the index such that they directly
+ * precede next, which is either an indexed piece or the end sentinel */
+static void index_insert(Text *txt, Piece *next, Piece *start, Piece *end) {
+	Piece *left, *right;
+	index_split(txt, next, &left, &right);
+	txt->tree = index_join(index_join(left, index_build(txt, start, end)), right);
+	txt->tree->parent = NULL;
+	for (Piece *p = start; p; p = p->next) {
+		if (p->len > 0)
+			mark_index_insert(txt, p);
+		if (p == end)
+			break;
+	}
+}
+
+/* remove the indexed pieces [start, end] which are part of the chain */
+static void index_remove(Text *txt, Piece *start, Piece *end) {
+	Piece *left, *middle, *right;
+	index_split(txt, start, &left, &txt->tree);
+	index_split(txt, end->next, &middle, &right);
+	txt->tree = index_join(left, right);
+	if (txt->tree)
+		txt->tree->parent = NULL;
+	for (Piece *p = start; p; p = p->next) {
+		p->parent = p->left = p->right = NULL;
+		if (p->len > 0)
+			mark_index_remove(txt, p);
+		if (p == end)
+			break;
 	}
+}
 
-	if (cur == pos)
-		return (Location){ .piece = p->prev, .off = p->prev->len };
+/* propagate a length or new line count change of p to all its ancestors */
+static void index_resize(Piece *p) {
+	for (; p; p = p->parent)
+		index_update(p);
+}
 
+/* returns the piece holding the byte at pos together with the offset into it.
+ * Pieces of zero length are never returned. */
+static Location index_get(const Text *txt, size_t pos) {
+	size_t cur = 0;
+	for (Piece *p = txt->tree; p; ) {
+		size_t left = p->left ? p->left->size : 0;
+		if (pos < cur + left) {
+			p = p->left;
+		} else if (pos < cur + left + p->len) {
+			return (Location){ .piece = p, .off = pos - cur - left };
+		} else {
+			cur += left + p->len;
+			p = p->right;
+		}
+	}
 	return (Location){ 0 };
 }
 
+/* returns the number of new lines in the subtree rooted at p, those of
+ * pieces which were deferred so far are determined on demand */
+static size_t index_lines(Piece *p) {
+	if (!p)
+		return 0;
+	if (p->size_lines == LINES_UNKNOWN) {
+		index_lines(p->left);
+		index_lines(p->right);
+		if (p->lines == LINES_UNKNOWN)
+			p->lines = piece_lines(p, 0, p->len);
+		index_update(p);
+	}
+	return p->size_lines;
+}
+
+/* returns the position after the given number of new lines within the
+ * subtree rooted at p which starts at position pos. If the subtree holds
+ * fewer new lines, EPOS is returned and lines is decreased accordingly.
+ * Subtrees with a known new line count are skipped entirely, others are
+ * traversed in order such that only the text preceding the match is scanned. */
+static size_t index_lines_skip(Piece *p, size_t pos, size_t *lines) {
+	if (!p)
+		return EPOS;
+	if (p->size_lines != LINES_UNKNOWN && p->size_lines < *lines) {
+		*lines -= p->size_lines;
+		return EPOS;
+	}
+	size_t found = index_lines_skip(p->left, pos, lines);
+	if (found != EPOS)
+		return found;
+	pos += p->left ? p->left->size : 0;
+	if (p->lines == LINES_UNKNOWN || p->lines >= *lines) {
+		size_t skipped, off = piece_lines_skip(p, *lines, &skipped);
+		if (skipped == *lines)
+			return pos + off;
+		p->lines = skipped;
+	}
+	*lines -= p->lines;
+	return index_lines_skip(p->right, pos + p->len, lines);
+}
+
+/* returns the position of the first byte of an indexed piece */
+static size_t index_pos(Piece *p) {
+	size_t pos = p->left ? p->left->size : 0;
+	for (; p->parent; p = p->parent) {
+		if (p->parent->right == p)
+			pos += p->parent->size - p->size;
+	}
+	return pos;
+}
+
+/* move p above its parent in the tree ordered by data address */
+static void mark_index_rotate(Text *txt, Piece *p) {
+	Piece *parent = p->mark_parent, *grandparent = parent->mark_parent;
+	if (parent->mark_left == p) {
+		parent->mark_left = p->mark_right;
+		if (p->mark_right)
+			p->mark_right->mark_parent = parent;
+		p->mark_right = parent;
+	} else {
+		parent->mark_right = p->mark_left;
+		if (p->mark_left)
+			p->mark_left->mark_parent = parent;
+		p->mark_left = parent;
+	}
+	parent->mark_parent = p;
+	p->mark_parent = grandparent;
+	if (!grandparent)
+		txt->marks = p;
+	else if (grandparent->mark_left == parent)
+		grandparent->mark_left = p;
+	else
+		grandparent->mark_right = p;
+}
+
+/* add a non-empty piece of the chain, its heap priority was assigned when
+ * it was indexed by position. The data of such pieces never overlaps. */
+static void mark_index_insert(Text *txt, Piece *p) {
+	Piece **link = &txt->marks, *parent = NULL;
+	while (*link) {
+		parent = *link;
+		link = (Mark)p->data < (Mark)parent->data ? &parent->mark_left : &parent->mark_right;
+	}
+	*link = p;
+	p->mark_parent = parent;
+	p->mark_left = p->mark_right = NULL;
+	while (p->mark_parent && p->mark_parent->priority < p->priority)
+		mark_index_rotate(txt, p);
+}
+
+static void mark_index_remove(Text *txt, Piece *p) {
+	while (p->mark_left || p->mark_right) {
+		Piece *left = p->mark_left, *right = p->mark_right;
+		mark_index_rotate(txt, !right || (left && left->priority > right->priority) ? left : right);
+	}
+	Piece *parent = p->mark_parent;
+	if (!parent)
+		txt->marks = NULL;
+	else if (parent->mark_left == p)
+		parent->mark_left = NULL;
+	else
+		parent->mark_right = NULL;
+	p->mark_parent = NULL;
+}
+
+/* returns the piece of the chain whose data holds the mark */
+static Piece *mark_index_get(const Text *txt, Mark mark) {
+	for (Piece *p = txt->marks; p; ) {
+		Mark start = (Mark)p->data;
+		if (mark < start)
+			p = p->mark_left;
+		else if (mark < start + p->len)
+			return p;
+		else
+			p = p->mark_right;
+	}
+	return NULL;
+}
+
 /* allocate a new change, associate it with current revision or a newly
  * allocated one if none exists. */
 static TextChange *text_change_alloc(Text *txt, size_t pos) {
@@ -378,7 +1077,7 @@ static TextChange *text_change_alloc(Text *txt, size_t pos) {
 		if (!rev)
 			return NULL;
 	}
-	TextChange *c = calloc(1, sizeof *c);
+	TextChange *c = pool_alloc(&txt->changes);
 	if (!c)
 		return NULL;
 	c->pos = pos;
@@ -389,14 +1088,10 @@ static TextChange *text_change_alloc(Text *txt, size_t pos) {
 	return c;
 }
 
-static void text_change_free(TextChange *c) {
-	if (!c)
-		return;
-	/* only free the new part of the span, the old one is still in use */
-	if (c->new.start != c->new.end)
-		piece_free(c->new.end);
-	piece_free(c->new.start);
-	free(c);
+/* lower the position reported by text_changed */
+static void text_changed_at(Text *txt, size_t pos) {
+	if (pos < txt->changed)
+		txt->changed = pos;
 }
 
 /* When inserting new data there are 2 cases to consider.
@@ -430,25 +1125,25 @@ bool text_insert(Vis *vis, Text *txt, size_t pos, const char *data, size_t len)
 {
 	if (len == 0)
 		return true;
-	if (pos > txt->size)
+	if (pos > txt->size || txt->loading)
 		return false;
-	if (pos < txt->lines.pos)
-		lineno_cache_invalidate(&txt->lines);
 
 	Location loc = piece_get_intern(txt, pos);
 	Piece *p = loc.piece;
 	if (!p)
 		return false;
+	text_changed_at(txt, pos);
 	size_t off = loc.off;
-	if (cache_insert(txt, p, off, data, len))
+	if (cache_insert(txt, p, off, data, len) || reserve_insert(txt, p, off, data, len))
 		return true;
 
 	TextChange *c = text_change_alloc(txt, pos);
 	if (!c)
 		return false;
 
-	if (!(data = block_store(vis, txt, data, len)))
+	if (!(data = block_store(vis, txt, data, len, 0)))
 		return false;
+	Block *blk = txt->data[txt->count - 1];
 
 	Piece *new = NULL;
 
@@ -457,7 +1152,7 @@ bool text_insert(Vis *vis, Text *txt, size_t pos, const char *data, size_t len)
 		 * remove, just add a new piece holding the extra text */
 		if (!(new = piece_alloc(txt)))
 			return false;
-		piece_init(new, p, p->next, data, len);
+		piece_init(new, p, p->next, blk, data, len);
 		span_init(&c->new, new, new);
 		span_init(&c->old, NULL, NULL);
 	} else {
@@ -471,9 +1166,9 @@ bool text_insert(Vis *vis, Text *txt, size_t pos, const char *data, size_t len)
 		Piece *after = piece_alloc(txt);
 		if (!before || !new || !after)
 			return false;
-		piece_init(before, p->prev, new, p->data, off);
-		piece_init(new, before, after, data, len);
-		piece_init(after, new, p->next, p->data + off, p->len - off);
+		piece_init(before, p->prev, new, p->block, p->data, off);
+		piece_init(new, before, after, blk, data, len);
+		piece_init(after, new, p->next, p->block, p->data + off, p->len - off);
 
 		span_init(&c->new, before, after);
 		span_init(&c->old, p, p);
@@ -488,6 +1183,7 @@ static size_t revision_undo(Text *txt, Revision *rev) {
 	size_t pos = EPOS;
 	for (TextChange *c = rev->change; c; c = c->next) {
 		span_swap(txt, &c->new, &c->old);
+		text_changed_at(txt, c->pos);
 		pos = c->pos;
 	}
 	return pos;
@@ -500,6 +1196,7 @@ static size_t revision_redo(Text *txt, Revision *rev) {
 		c = c->next;
 	for ( ; c; c = c->prev) {
 		span_swap(txt, &c->old, &c->new);
+		text_changed_at(txt, c->pos);
 		pos = c->pos;
 		if (c->new.len > c->old.len)
 			pos += c->new.len - c->old.len;
@@ -507,29 +1204,39 @@ static size_t revision_redo(Text *txt, Revision *rev) {
 	return pos;
 }
 
-size_t text_undo(Text *txt) {
-	size_t pos = EPOS;
+/* undo the current revision, changes not yet loaded from the journal are
+ * loaded first. Returns false if that failed or there is nothing to undo. */
+static bool history_undo(Text *txt, size_t *pos) {
 	/* taking rev snapshot makes sure that txt->current_revision is reset */
 	text_snapshot(txt);
 	Revision *rev = txt->history->prev;
-	if (!rev)
-		return pos;
-	pos = revision_undo(txt, txt->history);
+	if (!rev || !journal_load(txt, txt->history, true))
+		return false;
+	*pos = revision_undo(txt, txt->history);
 	txt->history = rev;
-	lineno_cache_invalidate(&txt->lines);
-	return pos;
+	return true;
 }
 
-size_t text_redo(Text *txt) {
-	size_t pos = EPOS;
+static bool history_redo(Text *txt, size_t *pos) {
 	/* taking a snapshot makes sure that txt->current_revision is reset */
 	text_snapshot(txt);
 	Revision *rev = txt->history->next;
-	if (!rev)
-		return pos;
-	pos = revision_redo(txt, rev);
+	if (!rev || !journal_load(txt, rev, false))
+		return false;
+	*pos = revision_redo(txt, rev);
 	txt->history = rev;
-	lineno_cache_invalidate(&txt->lines);
+	return true;
+}
+
+size_t text_undo(Text *txt) {
+	size_t pos = EPOS;
+	history_undo(txt, &pos);
+	return pos;
+}
+
+size_t text_redo(Text *txt) {
+	size_t pos = EPOS;
+	history_redo(txt, &pos);
 	return pos;
 }
 
@@ -552,22 +1259,19 @@ static size_t history_traverse_to(Text *txt, Revision *rev) {
 	bool changed = history_change_branch(rev);
 	if (!changed) {
 		if (rev->seq == txt->history->seq) {
-			return txt->lines.pos;
+			return rev->change ? rev->change->pos : EPOS;
 		} else if (rev->seq > txt->history->seq) {
-			while (txt->history != rev)
-				pos = text_redo(txt);
+			while (txt->history != rev && history_redo(txt, &pos));
 			return pos;
 		} else if (rev->seq < txt->history->seq) {
-			while (txt->history != rev)
-				pos = text_undo(txt);
+			while (txt->history != rev && history_undo(txt, &pos));
 			return pos;
 		}
 	} else {
-		while (txt->history->prev && txt->history->prev->next == txt->history)
-			text_undo(txt);
-		pos = text_undo(txt);
-		while (txt->history != rev)
-			pos = text_redo(txt);
+		while (txt->history->prev && txt->history->prev->next == txt->history &&
+		       history_undo(txt, &pos));
+		history_undo(txt, &pos);
+		while (txt->history != rev && history_redo(txt, &pos));
 		return pos;
 	}
 	return pos;
@@ -599,16 +1303,87 @@ time_t text_state(const Text *txt) {
 	return txt->history->time;
 }
 
+size_t text_history_compact(Text *txt, const TextHistoryLimit *limit) {
+	text_snapshot(txt);
+	/* find the oldest state along the current branch which is still within the limits */
+	time_t now = time(NULL);
+	size_t revisions = 1, bytes = 0;
+	Revision *root = txt->history;
+	for (Revision *rev = root; rev->prev; rev = rev->prev) {
+		for (TextChange *c = rev->change; c; c = c->next)
+			bytes += c->old.len + c->new.len;
+		if ((limit->revisions && ++revisions > limit->revisions) ||
+		    (limit->age && rev->prev->time < now - limit->age) ||
+		    (limit->bytes && bytes > limit->bytes))
+			break;
+		root = rev->prev;
+	}
+	if (!root->prev)
+		return 0;
+
+	/* it becomes the new root, everything not descending from it is dropped */
+	Revision *first = txt->last_revision;
+	while (first->earlier)
+		first = first->earlier;
+	for (Revision *rev = first; rev; rev = rev->later)
+		rev->dropped = rev != root && (!rev->prev || rev->prev->dropped);
+
+	/* The changes leading up to the new root are all applied, the pieces
+	 * they swapped out are no longer needed. Those they introduced are either
+	 * part of the chain or swapped out by a later change along the branch. */
+	for (Revision *rev = root; rev; rev = rev->prev) {
+		for (TextChange *next, *c = rev->change; c; c = next) {
+			next = c->next;
+			span_free(txt, &c->old);
+			pool_free(&txt->changes, c);
+		}
+		rev->change = NULL;
+	}
+	root->prev = NULL;
+
+	/* Changes of abandoned branches are not applied, the pieces they
+	 * introduced are referenced nowhere else. */
+	size_t dropped = 0;
+	Revision *earlier = NULL;
+	for (Revision *next, *rev = first; rev; rev = next) {
+		next = rev->later;
+		if (!rev->dropped) {
+			rev->earlier = earlier;
+			if (earlier)
+				earlier->later = rev;
+			earlier = rev;
+			continue;
+		}
+		for (TextChange *c = rev->change, *c_next; c; c = c_next) {
+			c_next = c->next;
+			span_free(txt, &c->new);
+			pool_free(&txt->changes, c);
+		}
+		if (txt->saved_revision == rev)
+			txt->saved_revision = NULL;
+		if (txt->save_revision == rev)
+			txt->save_revision = NULL;
+		pool_free(&txt->revisions, rev);
+		dropped++;
+	}
+	earlier->later = NULL;
+	txt->last_revision = earlier;
+	journal_compacted(txt, root);
+	return dropped;
+}
+
 Text *text_loadat_method(Vis *vis, int dirfd, const char *filename, enum TextLoadMethod method)
 {
 	Text *txt = calloc(1, sizeof *txt);
 	if (!txt)
 		return NULL;
+	pool_init(&txt->pieces, sizeof(Piece));
+	pool_init(&txt->changes, sizeof(TextChange));
+	pool_init(&txt->revisions, sizeof(Revision));
 	Piece *p = piece_alloc(txt);
 	if (!p)
 		goto out;
 	Block *block = 0;
-	lineno_cache_invalidate(&txt->lines);
 	if (filename) {
 		errno = 0;
 		block = block_load(dirfd, filename, method, &txt->info);
@@ -618,12 +1393,15 @@ Text *text_loadat_method(Vis *vis, int dirfd, const char *filename, enum TextLoa
 	}
 
 	if (!block)
-		piece_init(p, &txt->begin, &txt->end, "\0", 0);
+		piece_init(p, &txt->begin, &txt->end, NULL, "\0", 0);
 	else
-		piece_init(p, &txt->begin, &txt->end, block->data, block->len);
+		piece_init(p, &txt->begin, &txt->end, block, block->data, block->len);
 
-	piece_init(&txt->begin, NULL, p, NULL, 0);
-	piece_init(&txt->end, p, NULL, NULL, 0);
+	piece_init(&txt->begin, NULL, p, NULL, NULL, 0);
+	piece_init(&txt->end, p, NULL, NULL, NULL, 0);
+	txt->seed = 2463534242;
+	txt->changed = EPOS;
+	index_insert(txt, &txt->end, p, p);
 	txt->size = p->len;
 	/* write an empty revision */
 	text_change_alloc(txt, EPOS);
@@ -658,17 +1436,16 @@ bool text_delete(Text *txt, size_t pos, size_t len) {
 	if (len == 0)
 		return true;
 	size_t pos_end;
-	if (!addu(pos, len, &pos_end) || pos_end > txt->size)
+	if (!addu(pos, len, &pos_end) || pos_end > txt->size || txt->loading)
 		return false;
-	if (pos < txt->lines.pos)
-		lineno_cache_invalidate(&txt->lines);
 
 	Location loc = piece_get_intern(txt, pos);
 	Piece *p = loc.piece;
 	if (!p)
 		return false;
+	text_changed_at(txt, pos);
 	size_t off = loc.off;
-	if (cache_delete(txt, p, off, len))
+	if (cache_delete(txt, p, off, len) || reserve_delete(txt, p, off, len))
 		return true;
 	TextChange *c = text_change_alloc(txt, pos);
 	if (!c)
@@ -711,12 +1488,12 @@ bool text_delete(Text *txt, size_t pos, size_t len) {
 		after = piece_alloc(txt);
 		if (!after)
 			return false;
-		piece_init(after, before, p->next, p->data + p->len - (cur - len), cur - len);
+		piece_init(after, before, p->next, p->block, p->data + p->len - (cur - len), cur - len);
 	}
 
 	if (midway_start) {
 		/* we finally know which piece follows our newly allocated before piece */
-		piece_init(before, start->prev, after, start->data, off);
+		piece_init(before, start->prev, after, start->block, start->data, off);
 	}
 
 	Piece *new_start = NULL, *new_end = NULL;
@@ -743,32 +1520,469 @@ bool text_delete_range(Text *txt, const Filerange *r) {
 	return text_delete(txt, r->start, text_range_size(r));
 }
 
+/* append a piece referring to the given data to the new span */
+static bool edit_append(Text *txt, EditCluster *ec, Block *block, const char *data, size_t len) {
+	if (len == 0)
+		return true;
+	Piece *p = piece_alloc(txt);
+	if (!p)
+		return false;
+	Span *span = &ec->new;
+	piece_init(p, span->end ? span->end : ec->before, NULL, block, data, len);
+	if (span->end)
+		span->end->next = p;
+	else
+		span->start = p;
+	span->end = p;
+	span->len += len;
+	return true;
+}
+
+/* whether the pieces of the text may refer to the data of a span entry instead
+ * of a copy: the block still belongs to the text and none of the data is part
+ * of the current content, which would break the uniqueness of marks */
+static bool span_entry_shareable(Text *txt, const TextSpanEntry *e) {
+	bool owned = txt->journal && txt->journal->block == e->block;
+	for (VisDACount i = 0; !owned && i < txt->count; i++)
+		owned = txt->data[i] == e->block;
+	if (!owned)
+		return false;
+	for (Piece *p = txt->marks; p; ) {
+		if (p->data + p->len <= e->data)
+			p = p->mark_right;
+		else if (e->data + e->len <= p->data)
+			p = p->mark_left;
+		else
+			return false;
+	}
+	return true;
+}
+
+/* append the content of a span, its data is referred to if possible */
+static bool edit_append_span(Vis *vis, Text *txt, EditCluster *ec, const TextSpan *span) {
+	for (size_t i = 0; i < span->count; i++) {
+		const TextSpanEntry *e = &span->entries[i];
+		Block *blk = e->block;
+		const char *data = e->data;
+		if (!span_entry_shareable(txt, e)) {
+			if (!(data = block_store(vis, txt, e->data, e->len, 0)))
+				return false;
+			blk = txt->data[txt->count - 1];
+		}
+		if (!edit_append(txt, ec, blk, data, e->len))
+			return false;
+	}
+	return true;
+}
+
+/* advance to pos, affected content is either kept or dropped */
+static bool edit_advance(Text *txt, EditCluster *ec, size_t pos, bool keep) {
+	while (ec->pos < pos) {
+		if (ec->pos == ec->end) {
+			ec->last = ec->last->next;
+			if (!ec->first)
+				ec->first = ec->last;
+			ec->end += ec->last->len;
+		}
+		Piece *p = ec->last;
+		size_t len = MIN(pos, ec->end) - ec->pos;
+		if (keep && !edit_append(txt, ec, p->block, p->data + p->len - (ec->end - ec->pos), len))
+			return false;
+		ec->pos += len;
+	}
+	return true;
+}
+
+/* Edits are grouped into clusters affecting consecutive pieces. Each cluster
+ * is applied as one change: the affected pieces are swapped out for a new span
+ * consisting of their unmodified fragments interleaved with the new data.
+ *
+ *      /-+ --> +-----------------------+ --> +-\
+ *      | |     | existing text content |     | |
+ *      \-+ <-- +-----------------------+ <-- +-/
+ *                 ^  ^      ^   ^
+ *                 |--|      |---|  replaced by "a" and "b"
+ *
+ *      /-+ --> +--+ --> +-+ --> +------+ --> +-+ --> +-----------+ --> +-\
+ *      | |     | e|     |a|     |ing te|     |b|     | content   |     | |
+ *      \-+ <-- +--+ <-- +-+ <-- +------+ <-- +-+ <-- +-----------+ <-- +-/
+ *
+ * Hence every piece is visited at most once and the number of changes is
+ * bounded by the number of affected pieces, rather than the number of edits.
+ * Inserted data is optionally followed by reserved space to grow it in place.
+ * Data which is already stored in the given block is referred to, not copied,
+ * so is the data of spans if it is not part of the current content.
+ */
+static bool text_edit_reserve(Vis *vis, Text *txt, const TextEdit *edits, size_t count, size_t reserve, Block *block) {
+	if (txt->loading)
+		return false;
+	for (size_t i = 0; i < count; i++) {
+		const Filerange *r = &edits[i].range;
+		if (!text_range_valid(r) || r->end > txt->size ||
+		    (i > 0 && r->start < edits[i-1].range.end))
+			return false;
+	}
+	if (count > 0)
+		text_changed_at(txt, edits[0].range.start);
+
+	ptrdiff_t delta = 0; /* size difference caused by the already applied clusters */
+	for (size_t i = 0; i < count; ) {
+		const TextEdit *e = &edits[i];
+		if (e->range.start == e->range.end && (e->span ? e->span->len : e->len) == 0) {
+			i++;
+			continue;
+		}
+
+		Location loc = piece_get_intern(txt, e->range.start + delta);
+		if (!loc.piece)
+			return false;
+		TextChange *c = text_change_alloc(txt, e->range.start + delta);
+		if (!c)
+			return false;
+
+		EditCluster ec = { .pos = e->range.start };
+		if (loc.off == loc.piece->len) {
+			/* cluster starts at a piece boundary */
+			ec.before = ec.last = loc.piece;
+			ec.end = ec.pos;
+		} else {
+			ec.first = ec.last = loc.piece;
+			ec.before = loc.piece->prev;
+			ec.end = ec.pos - loc.off + loc.piece->len;
+			if (!edit_append(txt, &ec, loc.piece->block, loc.piece->data, loc.off))
+				return false;
+		}
+
+		do {
+			e = &edits[i];
+			const char *data = e->data;
+			Block *blk = e->len > 0 ? block : NULL;
+			if (!edit_advance(txt, &ec, e->range.start, true))
+				return false;
+			if (e->span) {
+				if (!edit_append_span(vis, txt, &ec, e->span))
+					return false;
+			} else {
+				if (e->len > 0 && !block) {
+					if (!(data = block_store(vis, txt, e->data, e->len, reserve)))
+						return false;
+					blk = txt->data[txt->count - 1];
+				}
+				if (!edit_append(txt, &ec, blk, data, e->len))
+					return false;
+				if (e->len > 0 && reserve > 0)
+					reserve_piece(txt, ec.new.end, c, reserve);
+			}
+			if (!edit_advance(txt, &ec, e->range.end, false))
+				return false;
+		} while (++i < count && edits[i].range.start <= ec.end);
+
+		/* keep the remaining content of the last affected piece */
+		if (ec.first && !edit_advance(txt, &ec, ec.end, true))
+			return false;
+		if (ec.new.end) {
+			ec.new.end->next = ec.first ? ec.last->next : ec.before->next;
+			span_init(&c->new, ec.new.start, ec.new.end);
+		}
+		span_init(&c->old, ec.first, ec.first ? ec.last : NULL);
+		delta += (ptrdiff_t)c->new.len - (ptrdiff_t)c->old.len;
+		span_swap(txt, &c->old, &c->new);
+	}
+	return true;
+}
+
+bool text_edit(Vis *vis, Text *txt, const TextEdit *edits, size_t count) {
+	return text_edit_reserve(vis, txt, edits, count, 0, NULL);
+}
+
+bool text_insert_multi(Vis *vis, Text *txt, const size_t *pos, size_t count, const char *data, size_t len) {
+	if (txt->loading)
+		return false;
+	for (size_t i = 0; i < count; i++) {
+		if (pos[i] > txt->size || (i > 0 && pos[i] < pos[i-1]))
+			return false;
+	}
+	if (len == 0)
+		return true;
+
+	/* grow the pieces of preceding insertions in place, collect the rest */
+	TextEditList edits = {0};
+	size_t grown = 0;
+	for (size_t i = 0; i < count; i++) {
+		size_t at = pos[i] + grown * len;
+		Location loc = piece_get_intern(txt, at);
+		if (loc.piece && reserve_insert(txt, loc.piece, loc.off, data, len)) {
+			grown++;
+			continue;
+		}
+		*da_push(vis, &edits) = (TextEdit){ .range = { at, at }, .data = data, .len = len };
+	}
+	bool ret = text_edit_reserve(vis, txt, edits.data, edits.count, BLOCK_RESERVE, NULL);
+	da_release(&edits);
+	return ret;
+}
+
+TextSpan *text_span_get(Text *txt, const Filerange *r) {
+	if (!text_range_valid(r) || r->end > txt->size)
+		return NULL;
+	Location loc = piece_get_extern(txt, r->start);
+	size_t len = text_range_size(r), rem = len, count = 0, off = loc.off;
+	for (Piece *p = loc.piece; rem > 0 && p; p = p->next, off = 0) {
+		if (p->len > off) {
+			rem -= MIN(rem, p->len - off);
+			count++;
+		}
+	}
+	TextSpan *span = malloc(sizeof *span + count * sizeof span->entries[0]);
+	if (!span)
+		return NULL;
+	bool mapped = false;
+	span->len = len;
+	span->count = 0;
+	span->size = count;
+	rem = len;
+	off = loc.off;
+	for (Piece *p = loc.piece; rem > 0 && p; p = p->next, off = 0) {
+		if (p->len <= off)
+			continue;
+		size_t n = MIN(rem, p->len - off);
+		/* the data must no longer be modified in place */
+		if (txt->cache == p)
+			txt->cache = NULL;
+		p->change = NULL;
+		p->block->spans++;
+		span->entries[span->count++] = (TextSpanEntry){ p->block, p->data + off, n };
+		rem -= n;
+		if (p->block->type == BLOCK_TYPE_MMAP_ORIG)
+			mapped = true;
+	}
+	span->next = NULL;
+	span->link = NULL;
+	if (mapped) {
+		span->next = txt->spans;
+		if (txt->spans)
+			txt->spans->link = &span->next;
+		span->link = &txt->spans;
+		txt->spans = span;
+	}
+	return span;
+}
+
+/* copy the data of the spans mapped from the file of a text which is about
+ * to be freed into a block of their own */
+static void span_unmap(Text *txt) {
+	size_t len = 0;
+	for (TextSpan *s = txt->spans; s; s = s->next) {
+		for (size_t i = 0; i < s->count; i++) {
+			if (s->entries[i].block->type == BLOCK_TYPE_MMAP_ORIG)
+				len += s->entries[i].len;
+		}
+	}
+	/* the mappings are kept if memory is exhausted */
+	Block *blk = len > 0 ? block_alloc(len) : NULL;
+	for (TextSpan *next, *s = txt->spans; s; s = next) {
+		next = s->next;
+		s->next = NULL;
+		s->link = NULL;
+		for (size_t i = 0; blk && i < s->count; i++) {
+			TextSpanEntry *e = &s->entries[i];
+			if (e->block->type != BLOCK_TYPE_MMAP_ORIG)
+				continue;
+			e->block->spans--;
+			e->block = blk;
+			e->data = block_append(blk, e->data, e->len);
+			blk->spans++;
+		}
+	}
+	txt->spans = NULL;
+	/* no text owns the block, it is freed together with the last span */
+	if (blk)
+		blk->released = true;
+}
+
+size_t text_span_size(const TextSpan *span) {
+	return span->len;
+}
+
+size_t text_span_bytes_get(const TextSpan *span, size_t pos, size_t len, char *buf) {
+	size_t copied = 0;
+	for (size_t i = 0; i < span->count && copied < len; i++) {
+		const TextSpanEntry *e = &span->entries[i];
+		if (pos >= e->len) {
+			pos -= e->len;
+			continue;
+		}
+		size_t n = MIN(len - copied, e->len - pos);
+		memcpy(buf + copied, e->data + pos, n);
+		copied += n;
+		pos = 0;
+	}
+	return copied;
+}
+
+bool text_span_insert(Vis *vis, Text *txt, size_t pos, const TextSpan *span) {
+	if (span->len == 0)
+		return true;
+	if (pos > txt->size || txt->loading)
+		return false;
+
+	Location loc = piece_get_intern(txt, pos);
+	Piece *p = loc.piece;
+	if (!p)
+		return false;
+	text_changed_at(txt, pos);
+	size_t off = loc.off;
+
+	TextChange *c = text_change_alloc(txt, pos);
+	if (!c)
+		return false;
+
+	/* inserting into the middle of an existing piece splits it in two */
+	Piece *before = p, *after = p->next;
+	if (off < p->len) {
+		before = piece_alloc(txt);
+		after = piece_alloc(txt);
+		if (!before || !after)
+			return false;
+	}
+
+	Piece *first = NULL, *last = before;
+	for (size_t i = 0; i < span->count; i++) {
+		const TextSpanEntry *e = &span->entries[i];
+		Block *blk = e->block;
+		const char *data = e->data;
+		if (!span_entry_shareable(txt, e)) {
+			if (!(data = block_store(vis, txt, e->data, e->len, 0)))
+				return false;
+			blk = txt->data[txt->count - 1];
+		}
+		Piece *new = piece_alloc(txt);
+		if (!new)
+			return false;
+		piece_init(new, last, NULL, blk, data, e->len);
+		if (first)
+			last->next = new;
+		else
+			first = new;
+		last = new;
+	}
+	last->next = after;
+
+	if (off < p->len) {
+		piece_init(before, p->prev, first, p->block, p->data, off);
+		piece_init(after, last, p->next, p->block, p->data + off, p->len - off);
+		span_init(&c->new, before, after);
+		span_init(&c->old, p, p);
+	} else {
+		span_init(&c->new, first, last);
+		span_init(&c->old, NULL, NULL);
+	}
+
+	span_swap(txt, &c->old, &c->new);
+	return true;
+}
+
+/* The data is read into the free space of the most recent block, just like
+ * the one of an insertion would be stored. It is never modified once read. */
+ssize_t text_span_read(Vis *vis, Text *txt, TextSpan **span, int fd, size_t len) {
+	/* the free space of the last block is used first, a new one is only
+	 * allocated once data arrives which does not fit, such that reaching
+	 * the end of file does not allocate anything */
+	Block *blk = txt->count > 0 ? txt->data[txt->count - 1] : 0;
+	if (blk && (blk->type != BLOCK_TYPE_MALLOC || !block_capacity(blk, 1)))
+		blk = NULL;
+
+	/* data following the last entry extends it, otherwise room for another one is needed */
+	TextSpan *s = *span;
+	TextSpanEntry *e = s && s->count > 0 ? &s->entries[s->count - 1] : NULL;
+	bool extend = blk && e && e->block == blk && e->data + e->len == blk->data + blk->len;
+	if (!extend && (!s || s->count == s->size)) {
+		size_t size = s ? 2 * s->size : 1;
+		if (!(s = realloc(s, sizeof *s + size * sizeof s->entries[0])))
+			return -1;
+		if (!*span) {
+			s->next = NULL;
+			s->link = NULL;
+			s->len = 0;
+			s->count = 0;
+		} else if (s->link) {
+			*s->link = s;
+			if (s->next)
+				s->next->link = &s->next;
+		}
+		s->size = size;
+		*span = s;
+	}
+
+	ssize_t n;
+	char buf[BUFSIZ];
+	char *data = blk ? blk->data + blk->len : buf;
+	while ((n = read(fd, data, blk ? blk->size - blk->len : sizeof buf)) == -1 && errno == EINTR);
+	if (n <= 0)
+		return n;
+	if (!blk) {
+		if (!(blk = block_alloc(MAX(len, (size_t)n))))
+			return -1;
+		*da_push(vis, txt) = blk;
+		data = memcpy(blk->data, buf, n);
+	}
+	blk->len += n;
+	if (extend) {
+		e->len += n;
+	} else {
+		blk->spans++;
+		s->entries[s->count++] = (TextSpanEntry){ blk, data, n };
+	}
+	s->len += n;
+	return n;
+}
+
+void text_span_free(TextSpan *span) {
+	if (!span)
+		return;
+	if (span->link) {
+		*span->link = span->next;
+		if (span->next)
+			span->next->link = span->link;
+	}
+	for (size_t i = 0; i < span->count; i++) {
+		Block *blk = span->entries[i].block;
+		if (--blk->spans == 0 && blk->released)
+			block_free(blk);
+	}
+	free(span);
+}
+
 void text_free(Text *txt) {
 	if (!txt)
 		return;
 
-	// free history
-	Revision *hist = txt->history;
-	while (hist && hist->prev)
-		hist = hist->prev;
-	while (hist) {
-		Revision *later = hist->later;
-		revision_free(hist);
-		hist = later;
-	}
+	/* complete the journal with the changes since the last snapshot */
+	if (txt->journal)
+		text_snapshot(txt);
+	span_unmap(txt);
 
-	for (Piece *next, *p = txt->pieces; p; p = next) {
-		next = p->global_next;
-		piece_free(p);
-	}
+	/* free history and all pieces */
+	pool_release(&txt->revisions);
+	pool_release(&txt->changes);
+	pool_release(&txt->pieces);
 
 	for (VisDACount i = 0; i < txt->count; i++)
 		block_free(txt->data[i]);
 	da_release(txt);
+	journal_free(txt->journal);
+	for (size_t i = 0; i < LENGTH(txt->widths); i++)
+		da_release(&txt->widths[i]);
 
 	free(txt);
 }
 
+size_t text_changed(Text *txt) {
+	size_t pos = txt->changed;
+	txt->changed = EPOS;
+	return pos;
+}
+
 bool text_modified(const Text *txt) {
 	return txt->saved_revision != txt->history;
 }
@@ -781,7 +1995,8 @@ bool text_mmaped(const Text *txt, const char *ptr) {
 		    (uintptr_t)(blk->data) <= addr && addr < (uintptr_t)(blk->data + blk->size))
 			return true;
 	}
-	return false;
+	Block *blk = txt->journal ? txt->journal->block : NULL;
+	return blk && (uintptr_t)(blk->data) <= addr && addr < (uintptr_t)(blk->data + blk->size);
 }
 
 static bool iterator_init(Iterator *it, size_t pos, Piece *p, size_t off) {
@@ -838,100 +2053,206 @@ size_t text_size(const Text *txt) {
 	return txt->size;
 }
 
-/* count the number of new lines '\n' in range [pos, pos+len) */
-static size_t lines_count(Text *txt, size_t pos, size_t len) {
+/* count the number of new lines '\n' in data[0, len) */
+static size_t lines_count_generic(const char *data, size_t len) {
 	size_t lines = 0;
-	for (Iterator it = text_iterator_get(txt, pos);
-	     text_iterator_valid(&it);
-	     text_iterator_next(&it)) {
-		const char *start = it.text;
-		while (len > 0 && start < it.end) {
-			size_t n = MIN(len, (size_t)(it.end - start));
-			const char *end = memchr(start, '\n', n);
-			if (!end) {
-				len -= n;
-				break;
-			}
-			lines++;
-			len -= end - start + 1;
-			start = end + 1;
-		}
-
-		if (len == 0)
+	for (const char *end = data + len; data < end; lines++) {
+		data = memchr(data, '\n', end - data);
+		if (!data)
 			break;
+		data++;
 	}
 	return lines;
 }
 
-/* skip n lines forward and return position afterwards */
-static size_t lines_skip_forward(Text *txt, size_t pos, size_t lines, size_t *lines_skipped) {
+/* skip n lines forward and return the offset afterwards, or len if there are
+ * fewer new lines in data[0, len) */
+static size_t lines_skip_forward_generic(const char *data, size_t len, size_t lines, size_t *lines_skipped) {
 	size_t lines_old = lines;
-	for (Iterator it = text_iterator_get(txt, pos);
-	     text_iterator_valid(&it);
-	     text_iterator_next(&it)) {
-		const char *start = it.text;
-		while (lines > 0 && start < it.end) {
-			size_t n = it.end - start;
-			const char *end = memchr(start, '\n', n);
-			if (!end) {
-				pos += n;
-				break;
-			}
-			pos += end - start + 1;
-			start = end + 1;
+	const char *cur = data, *end = data + len;
+	while (lines > 0 && cur < end) {
+		const char *nl = memchr(cur, '\n', end - cur);
+		if (!nl) {
+			cur = end;
+			break;
+		}
+		cur = nl + 1;
+		lines--;
+	}
+	if (lines_skipped)
+		*lines_skipped = lines_old - lines;
+	return cur - data;
+}
+
+#if LINES_KERNEL_X86
+/* The vectorized variants compare a whole register worth of bytes at once.
+ * For counting, the comparison results are accumulated in per byte counters
+ * which are summed up before they can overflow (4 * 63 < 256). For skipping, the bit mask
+ * of matches is consulted to locate the n-th new line. */
+
+static size_t lines_count_sse2(const char *data, size_t len) {
+	const __m128i nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+	__m128i total = zero;
+	size_t i = 0, lines = 0;
+	while (len - i >= 64) {
+		__m128i counts = zero;
+		size_t end = i + 64 * MIN(63, (len - i) / 64);
+		for (; i < end; i += 64) {
+			const __m128i *v = (const __m128i*)(data + i);
+			counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_loadu_si128(v + 0), nl));
+			counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_loadu_si128(v + 1), nl));
+			counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_loadu_si128(v + 2), nl));
+			counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_loadu_si128(v + 3), nl));
+		}
+		total = _mm_add_epi64(total, _mm_sad_epu8(counts, zero));
+	}
+	uint64_t sums[2];
+	_mm_storeu_si128((__m128i*)sums, total);
+	lines = sums[0] + sums[1];
+	for (; i < len; i++)
+		lines += data[i] == '\n';
+	return lines;
+}
+
+static size_t lines_skip_forward_sse2(const char *data, size_t len, size_t lines, size_t *lines_skipped) {
+	const __m128i nl = _mm_set1_epi8('\n');
+	size_t lines_old = lines, i = 0;
+	while (lines > 0 && len - i >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+		size_t n = mask ? __builtin_popcount(mask) : 0;
+		if (n < lines) {
+			lines -= n;
+			i += 16;
+			continue;
+		}
+		for (; lines > 1; lines--)
+			mask &= mask - 1;
+		i += __builtin_ctz(mask) + 1;
+		lines = 0;
+	}
+	for (; lines > 0 && i < len; i++) {
+		if (data[i] == '\n')
 			lines--;
+	}
+	if (lines_skipped)
+		*lines_skipped = lines_old - lines;
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t lines_count_avx2(const char *data, size_t len) {
+	const __m256i nl = _mm256_set1_epi8('\n'), zero = _mm256_setzero_si256();
+	__m256i total = zero;
+	size_t i = 0, lines = 0;
+	while (len - i >= 128) {
+		__m256i counts = zero;
+		size_t end = i + 128 * MIN(63, (len - i) / 128);
+		for (; i < end; i += 128) {
+			const __m256i *v = (const __m256i*)(data + i);
+			counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(_mm256_loadu_si256(v + 0), nl));
+			counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(_mm256_loadu_si256(v + 1), nl));
+			counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(_mm256_loadu_si256(v + 2), nl));
+			counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(_mm256_loadu_si256(v + 3), nl));
 		}
+		total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, zero));
+	}
+	uint64_t sums[4];
+	_mm256_storeu_si256((__m256i*)sums, total);
+	lines = sums[0] + sums[1] + sums[2] + sums[3];
+	for (; i < len; i++)
+		lines += data[i] == '\n';
+	return lines;
+}
 
-		if (lines == 0)
-			break;
+__attribute__((target("avx2,popcnt")))
+static size_t lines_skip_forward_avx2(const char *data, size_t len, size_t lines, size_t *lines_skipped) {
+	const __m256i nl = _mm256_set1_epi8('\n');
+	size_t lines_old = lines, i = 0;
+	while (lines > 0 && len - i >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+		size_t n = __builtin_popcount(mask);
+		if (n < lines) {
+			lines -= n;
+			i += 32;
+			continue;
+		}
+		for (; lines > 1; lines--)
+			mask &= mask - 1;
+		i += __builtin_ctz(mask) + 1;
+		lines = 0;
+	}
+	for (; lines > 0 && i < len; i++) {
+		if (data[i] == '\n')
+			lines--;
 	}
 	if (lines_skipped)
 		*lines_skipped = lines_old - lines;
-	return pos;
+	return i;
+}
+#endif /* LINES_KERNEL_X86 */
+
+/* new line counting implementation, chosen at runtime based on CPU features */
+static struct {
+	size_t (*count)(const char *data, size_t len);
+	size_t (*skip_forward)(const char *data, size_t len, size_t lines, size_t *lines_skipped);
+} lines_kernel;
+
+static void lines_kernel_init(void) {
+	lines_kernel.count = lines_count_generic;
+	lines_kernel.skip_forward = lines_skip_forward_generic;
+#if LINES_KERNEL_X86
+	__builtin_cpu_init();
+	lines_kernel.count = lines_count_sse2;
+	lines_kernel.skip_forward = lines_skip_forward_sse2;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		lines_kernel.count = lines_count_avx2;
+		lines_kernel.skip_forward = lines_skip_forward_avx2;
+	}
+#endif
+}
+
+static size_t lines_count(const char *data, size_t len) {
+	if (!lines_kernel.count)
+		lines_kernel_init();
+	return lines_kernel.count(data, len);
 }
 
-static void lineno_cache_invalidate(LineCache *cache) {
-	cache->pos = 0;
-	cache->lineno = 1;
+static size_t lines_skip_forward(const char *data, size_t len, size_t lines, size_t *lines_skipped) {
+	if (!lines_kernel.skip_forward)
+		lines_kernel_init();
+	return lines_kernel.skip_forward(data, len, lines, lines_skipped);
 }
 
 size_t text_pos_by_lineno(Text *txt, size_t lineno) {
-	size_t lines_skipped;
-	LineCache *cache = &txt->lines;
 	if (lineno <= 1)
 		return 0;
-	if (lineno > cache->lineno) {
-		cache->pos = lines_skip_forward(txt, cache->pos, lineno - cache->lineno, &lines_skipped);
-		cache->lineno += lines_skipped;
-	} else if (lineno < cache->lineno) {
-	#if 0
-		// TODO does it make sense to scan memory backwards here?
-		size_t diff = cache->lineno - lineno;
-		if (diff < lineno) {
-			lines_skip_backward(txt, cache->pos, diff);
-		} else
-	#endif
-		cache->pos = lines_skip_forward(txt, 0, lineno - 1, &lines_skipped);
-		cache->lineno = lines_skipped + 1;
-	}
-	return cache->lineno == lineno ? cache->pos : EPOS;
+	size_t lines = lineno - 1;
+	return index_lines_skip(txt->tree, 0, &lines);
 }
 
 size_t text_lineno_by_pos(Text *txt, size_t pos) {
-	LineCache *cache = &txt->lines;
+	size_t cur = 0, lines = 0;
 	if (pos > txt->size)
 		pos = txt->size;
-	if (pos < cache->pos) {
-		size_t diff = cache->pos - pos;
-		if (diff < pos)
-			cache->lineno -= lines_count(txt, pos, diff);
-		else
-			cache->lineno = lines_count(txt, 0, pos) + 1;
-	} else if (pos > cache->pos) {
-		cache->lineno += lines_count(txt, cache->pos, pos - cache->pos);
+	for (Piece *p = txt->tree; p; ) {
+		size_t left = p->left ? p->left->size : 0;
+		if (pos < cur + left) {
+			p = p->left;
+			continue;
+		}
+		lines += index_lines(p->left);
+		cur += left;
+		if (pos < cur + p->len)
+			return lines + piece_lines(p, 0, pos - cur) + 1;
+		if (p->lines == LINES_UNKNOWN)
+			p->lines = piece_lines(p, 0, p->len);
+		lines += p->lines;
+		cur += p->len;
+		p = p->right;
 	}
-	cache->pos = text_line_begin(txt, pos);
-	return cache->lineno;
+	return lines + 1;
 }
 
 Mark text_mark_set(Text *txt, size_t pos) {
@@ -944,20 +2265,13 @@ Mark text_mark_set(Text *txt, size_t pos) {
 }
 
 size_t text_mark_get(const Text *txt, Mark mark) {
-	size_t cur = 0;
-
 	if (mark == EMARK)
 		return EPOS;
 	if (mark == (Mark)&txt->end)
 		return txt->size;
 
-	for (Piece *p = txt->begin.next; p->next; p = p->next) {
-		Mark start = (Mark)(p->data);
-		Mark end = start + p->len;
-		if (start <= mark && mark < end)
-			return cur + (mark - start);
-		cur += p->len;
-	}
-
-	return EPOS;
+	Piece *p = mark_index_get(txt, mark);
+	if (!p)
+		return EPOS;
+	return index_pos(p) + (mark - (Mark)p->data);
 }
@@ -103,6 +103,20 @@ VIS_INTERNAL Text *text_load(Vis *vis, const char *filename);
  */
 VIS_INTERNAL Text *text_load_method(Vis *vis, const char *filename, enum TextLoadMethod method);
 VIS_INTERNAL Text *text_loadat_method(Vis *vis, int dirfd, const char *filename, enum TextLoadMethod);
+/**
+ * Append data read from a file descriptor to a text without history.
+ *
+ * Until end of file is reached, the text is considered loading and all
+ * modifications are rejected. The appended content is not undoable.
+ *
+ * @param fd The file descriptor to read from, may be non-blocking.
+ * @param len The maximal number of bytes to read.
+ * @return The number of bytes appended, ``0`` at end of file or ``-1`` on
+ *         error, with ``errno`` set to ``EBUSY`` if the text was already modified.
+ */
+VIS_INTERNAL ssize_t text_load_fd(Vis *vis, Text *txt, int fd, size_t len);
+/** Check whether the text is still being loaded by means of ``text_load_fd``. */
+VIS_INTERNAL bool text_loading(const Text*);
 /** Release all resources associated with this text instance. */
 VIS_INTERNAL void text_free(Text*);
 /**
@@ -125,6 +139,13 @@ VIS_INTERNAL size_t text_size(const Text*);
 VIS_INTERNAL struct stat text_stat(const Text*);
 /** Query whether the text contains any unsaved modifications. */
 VIS_INTERNAL bool text_modified(const Text*);
+/**
+ * Get the lowest position modified since the last call, including undo
+ * and redo operations, such that state derived from the content beyond it
+ * can be discarded.
+ * @return The position or ``EPOS`` if the text was not modified.
+ */
+VIS_INTERNAL size_t text_changed(Text*);
 /**
  * @}
  * @defgroup modify Text Modification
@@ -151,6 +172,52 @@ VIS_INTERNAL bool text_insert(Vis *vis, Text *txt, size_t pos, const char *data,
  */
 VIS_INTERNAL bool text_delete(Text *txt, size_t pos, size_t len);
 VIS_INTERNAL bool text_delete_range(Text *txt, const Filerange*);
+/** A replacement of a range, as part of a set of edits. */
+typedef struct {
+	Filerange range;   /**< Range to replace, relative to the unmodified text. */
+	const char *data;  /**< Replacement data, might be ``NULL`` if ``len`` is zero. */
+	size_t len;        /**< Length of the replacement in bytes. */
+	const struct TextSpan *span; /**< Replacement used instead of ``data`` and ``len``, if not ``NULL``. */
+} TextEdit;
+
+typedef struct {
+	TextEdit   *data;
+	VisDACount  count;
+	VisDACount  capacity;
+} TextEditList;
+/**
+ * Apply a set of edits in a single pass over the piece chain.
+ *
+ * @param vis The editor instance.
+ * @param txt The text instance to modify.
+ * @param edits Edits sorted by position, each starting at or after the end
+ *              of its predecessor. Insertions at the same position are
+ *              applied in order.
+ * @param count The number of edits.
+ * @return Whether all edits were applied. Nothing is modified if the edits
+ *         are not well ordered.
+ * @rst
+ * .. note:: All modifications become part of the current revision.
+ * @endrst
+ */
+VIS_INTERNAL bool text_edit(Vis *vis, Text *txt, const TextEdit *edits, size_t count);
+/**
+ * Insert the same data at multiple positions, e.g. one per selection.
+ *
+ * @param vis The editor instance.
+ * @param txt The text instance to modify.
+ * @param pos Positions in ascending order, relative to the unmodified text.
+ * @param count The number of positions.
+ * @param data The data to insert.
+ * @param len The length of the data.
+ * @return Whether the data was inserted at all positions.
+ * @rst
+ * .. note:: The inserted data is followed by reserved space, subsequent
+ *           insertions and deletions at the same locations modify it in
+ *           place until the next snapshot.
+ * @endrst
+ */
+VIS_INTERNAL bool text_insert_multi(Vis *vis, Text *txt, const size_t *pos, size_t count, const char *data, size_t len);
 VIS_INTERNAL bool text_appendf(Vis *vis, Text *txt, const char *format, ...) __attribute__((format(printf, 3, 4)));
 /**
  * @}
@@ -192,6 +259,74 @@ VIS_INTERNAL size_t text_restore(Text*, time_t);
  * @endrst
  */
 VIS_INTERNAL time_t text_state(const Text*);
+/**
+ * Limits on the retained undo history, a value of zero means unlimited.
+ */
+typedef struct {
+	size_t revisions; /**< Number of states along the current branch. */
+	time_t age;       /**< Age in seconds of the oldest state. */
+	size_t bytes;     /**< Size of the text swapped in and out by the changes. */
+} TextHistoryLimit;
+/**
+ * Discard history exceeding the given limits.
+ *
+ * The oldest state along the current branch which is still within the limits
+ * becomes the new root of the history graph. All revisions not descending
+ * from it are dropped together with all pieces and blocks which are no
+ * longer referenced. The new root is recorded in the journal, such that the
+ * dropped revisions are not restored from it.
+ * @rst
+ * .. note:: Takes an implicit snapshot.
+ * @endrst
+ * @return The number of dropped revisions.
+ */
+VIS_INTERNAL size_t text_history_compact(Text*, const TextHistoryLimit*);
+/**
+ * Record the history in a journal file, such that it persists across sessions.
+ *
+ * If the journal holds a saved revision whose content matches the text, the
+ * history is restored and the most recently saved such revision becomes the
+ * current one. The changes of the restored revisions are only loaded once they
+ * are undone or redone. Otherwise a new journal is started with the current
+ * state as the oldest one.
+ *
+ * Every snapshot and save is subsequently recorded, the records are written
+ * by ``text_journal_sync`` or once the text is freed.
+ * @rst
+ * .. note:: Has to be called before the text is modified. The journal is
+ *           locked until it is closed or the text is freed.
+ * @endrst
+ * @return Whether the journal could be opened.
+ */
+VIS_INTERNAL bool text_journal_open(Text*, int dirfd, const char *filename);
+/**
+ * Write the records collected since the last call to the journal and
+ * ``fsync(2)`` it.
+ * @return Whether journaling is still possible, it is stopped if writing fails.
+ */
+VIS_INTERNAL bool text_journal_sync(Text*);
+/**
+ * Complete the journal with the changes since the last snapshot, write and
+ * sync it and release its lock. The history remains available, but is no
+ * longer recorded.
+ * @return Whether the records could be written.
+ */
+VIS_INTERNAL bool text_journal_close(Text*);
+/** Whether there are records which are not yet synced. */
+VIS_INTERNAL bool text_journal_pending(const Text*);
+/**
+ * Whether the restored journal holds revisions more recent than the current
+ * one, for example changes which were not saved before the editor crashed.
+ */
+VIS_INTERNAL bool text_journal_recoverable(const Text*);
+/**
+ * Restore the most recently journaled revision.
+ * @rst
+ * .. note:: Has to be called before the text is modified.
+ * @endrst
+ * @return The position of the last change or ``EPOS`` if there is nothing to recover.
+ */
+VIS_INTERNAL size_t text_journal_recover(Text*);
 /**
  * @}
  * @defgroup lines Line Operations
@@ -241,6 +376,54 @@ VIS_INTERNAL size_t text_bytes_get(const Text *txt, size_t pos, size_t len, char
  * @endrst
  */
 VIS_INTERNAL char *text_bytes_alloc0(const Text *txt, size_t pos, size_t len);
+/**
+ * @}
+ * @defgroup span Text Spans
+ * @{
+ */
+/**
+ * Content of a range which shares the storage of the text instead of copying
+ * it. It is unaffected by subsequent modifications and remains valid after
+ * the text is freed, data mapped from a file is copied at that point.
+ */
+typedef struct TextSpan TextSpan;
+/**
+ * Reference the content of a range.
+ * @return The span, or ``NULL`` if the range is invalid or memory allocation failed.
+ * @rst
+ * .. warning:: The returned span must be released with :c:func:`text_span_free()`.
+ * @endrst
+ */
+VIS_INTERNAL TextSpan *text_span_get(Text*, const Filerange*);
+/** Size of the span content in bytes. */
+VIS_INTERNAL size_t text_span_size(const TextSpan*);
+/**
+ * Store at most ``len`` bytes of the span content starting from ``pos`` into ``buf``.
+ * @return The number of bytes (``<= len``) stored at ``buf``.
+ */
+VIS_INTERNAL size_t text_span_bytes_get(const TextSpan*, size_t pos, size_t len, char *buf);
+/**
+ * Insert the span content at ``pos``.
+ *
+ * Content taken from this text which is no longer part of it, for example
+ * deleted text, is referenced without copying it.
+ * @return Whether the insertion succeeded.
+ */
+VIS_INTERNAL bool text_span_insert(Vis *vis, Text*, size_t pos, const TextSpan*);
+/**
+ * Read from a file descriptor into storage of the text and append the data to
+ * a span, which is created if ``*span`` is ``NULL``.
+ *
+ * The data is not inserted, but can be without copying it, provided the span
+ * is not inserted twice by the same :c:func:`text_edit()` call.
+ * @param len Once the free space of the storage is used up, new storage is
+ *            allocated with room for at least this many bytes, such that the
+ *            data of consecutive reads stays contiguous.
+ * @return The number of bytes read, ``0`` at end of file, ``-1`` on error.
+ */
+VIS_INTERNAL ssize_t text_span_read(Vis *vis, Text*, TextSpan **span, int fd, size_t len);
+/** Release a span, storage no longer used by any text is freed. */
+VIS_INTERNAL void text_span_free(TextSpan*);
 /**
  * @}
  * @defgroup iterator Text Iterators
@@ -363,11 +546,13 @@ VIS_INTERNAL void text_mark_current_revision(Text*);
  * Setup a sequence of write operations.
  *
  * The returned ``TextSave`` pointer can be used to write multiple, possibly
- * non-contiguous, file ranges.
+ * non-contiguous, file ranges. The text may be modified before the save is
+ * committed, the revision current at the time of this call is marked as saved.
  * @rst
  * .. warning:: For every call to ``text_save_begin`` there must be exactly
  *              one matching call to either ``text_save_commit`` or
  *              ``text_save_cancel`` to release the underlying resources.
+ *              Only one save operation per text may be in progress.
  * @endrst
  */
 VIS_INTERNAL bool text_save_begin(TextSave*);
@@ -399,6 +584,16 @@ VIS_INTERNAL void text_save_cancel(TextSave*);
  * @return The number of bytes written or ``-1`` in case of an error.
  */
 VIS_INTERNAL ssize_t text_write_range(const Text*, const Filerange*, int fd);
+/**
+ * Write as much of a file range as a non-blocking pipe accepts.
+ * @rst
+ * .. note:: Where supported, data of the original file is spliced into the
+ *           pipe from the page cache instead of being copied.
+ * @endrst
+ * @return The number of bytes written or ``-1`` in case nothing could be
+ *         written, ``errno`` is ``EAGAIN`` if the pipe is full.
+ */
+VIS_INTERNAL ssize_t text_pipe_range(const Text*, const Filerange*, int fd);
 /**
  * @}
  * @defgroup misc Miscellaneous
@@ -441,6 +636,14 @@ VIS_INTERNAL void text_regex_free(Regex*);
 VIS_INTERNAL int text_regex_match(Regex*, const char *data, int eflags);
 VIS_INTERNAL int text_search_range_forward(Text*, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags);
 VIS_INTERNAL int text_search_range_backward(Text*, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags);
+/**
+ * Find all non-overlapping matches within the range in a single pass.
+ * The search continues after the end of each match, respectively one
+ * byte beyond an empty match. Iteration stops once ``handle`` returns
+ * ``false``. Returns the number of matches passed to ``handle``.
+ */
+VIS_INTERNAL size_t text_search_all(Text*, Filerange*, Regex*, size_t nmatch, int eflags,
+                                    bool (*handle)(RegexMatch pmatch[], void *data), void *data);
 
 /** @} */
 
@@ -5,8 +5,10 @@
  * This is useful for debugging and fuzzing purposes as well as for environments
  * with no curses support.
  *
- * Currently no attempt is made to optimize terminal output. The amount of
- * flickering will depend on the smartness of your terminal emulator.
+ * A copy of the cells last sent to the terminal is kept, every frame only
+ * rewrites the runs of cells which changed since. Short unchanged gaps within
+ * a run are rewritten as well, as that is cheaper than repositioning the
+ * cursor, trailing blanks of a line are erased instead of being written.
  *
  * The following terminal escape sequences are used:
  *
@@ -14,7 +16,8 @@
  *  - CSI ? 1049 l             Use Normal Screen Buffer and restore cursor (DECRST)
  *  - CSI ? 25 l               Hide Cursor (DECTCEM)
  *  - CSI ? 25 h               Show Cursor (DECTCEM)
- *  - CSI 2 J                  Erase in Display (ED)
+ *  - CSI J                    Erase in Display (ED)
+ *  - CSI K                    Erase in Line (EL)
  *  - CSI row ; column H       Cursor Position (CUP)
  *  - CSI ... m                Character Attributes (SGR)
  *    - CSI 0 m                     Normal
@@ -89,77 +92,203 @@ static void cursor_visible(bool visible) {
 	output_literal(visible ? "\x1b[?25h" : "\x1b[?25l");
 }
 
+typedef struct {
+	Buffer buf;           /* escape sequences of the frame being drawn */
+	Cell *cells;          /* cells as displayed by the terminal */
+	size_t cells_size;    /* #bytes allocated for cells */
+	int width, height;    /* dimensions of cells */
+	int cur_row, cur_col; /* cursor position as last sent to the terminal */
+	bool redraw;          /* whether the terminal contents are unknown */
+} UiTermScreen;
+
+/* unchanged cells between two modified ones which are rewritten rather
+ * than moving the cursor past them */
+#define UI_TERM_GAP_MAX 4
+
+static const Cell cell_erased = {
+	.data = " ",
+	.style = {
+		.attr = CELL_ATTR_NORMAL,
+		.fg = CELL_COLOR_DEFAULT,
+		.bg = CELL_COLOR_DEFAULT,
+	},
+};
+
+static bool cell_style_equal(const CellStyle *s1, const CellStyle *s2) {
+	return s1->attr == s2->attr && cell_color_equal(s1->fg, s2->fg) &&
+	       cell_color_equal(s1->bg, s2->bg);
+}
+
+/* whether the cell looks like one of an erased line */
+static bool cell_erasable(const Cell *cell) {
+	return !strcmp(cell->data, " ") && cell->style.attr == CELL_ATTR_NORMAL &&
+	       cell_color_equal(cell->style.bg, cell_erased.style.bg);
+}
+
+static bool cell_equal(const Cell *c1, const Cell *c2) {
+	if (strcmp(c1->data, c2->data) || c1->style.attr != c2->style.attr ||
+	    !cell_color_equal(c1->style.bg, c2->style.bg))
+		return false;
+	/* the foreground color of a blank is invisible */
+	return cell_color_equal(c1->style.fg, c2->style.fg) || cell_erasable(c1);
+}
+
+static void cell_style_apply(Buffer *buf, CellStyle *cur, const CellStyle *style) {
+	if (style->attr != cur->attr) {
+
+		static const struct {
+			CellAttr attr;
+			char on[4], off[4];
+		} cell_attrs[] = {
+			{ CELL_ATTR_BOLD, "1", "22" },
+			{ CELL_ATTR_DIM, "2", "22" },
+			{ CELL_ATTR_ITALIC, "3", "23" },
+			{ CELL_ATTR_UNDERLINE, "4", "24" },
+			{ CELL_ATTR_BLINK, "5", "25" },
+			{ CELL_ATTR_REVERSE, "7", "27" },
+		};
+
+		for (size_t i = 0; i < LENGTH(cell_attrs); i++) {
+			CellAttr a = cell_attrs[i].attr;
+			if ((style->attr & a) == (cur->attr & a))
+				continue;
+			buffer_appendf(buf, "\x1b[%sm",
+			               style->attr & a ?
+			               cell_attrs[i].on :
+			               cell_attrs[i].off);
+		}
+
+		cur->attr = style->attr;
+	}
+
+	if (!cell_color_equal(cur->fg, style->fg)) {
+		cur->fg = style->fg;
+		if (cur->fg.index != (uint8_t)-1) {
+			buffer_appendf(buf, "\x1b[%dm", 30 + cur->fg.index);
+		} else {
+			buffer_appendf(buf, "\x1b[38;2;%d;%d;%dm",
+			               cur->fg.r, cur->fg.g, cur->fg.b);
+		}
+	}
+
+	if (!cell_color_equal(cur->bg, style->bg)) {
+		cur->bg = style->bg;
+		if (cur->bg.index != (uint8_t)-1) {
+			buffer_appendf(buf, "\x1b[%dm", 40 + cur->bg.index);
+		} else {
+			buffer_appendf(buf, "\x1b[48;2;%d;%d;%dm",
+			               cur->bg.r, cur->bg.g, cur->bg.b);
+		}
+	}
+}
+
 static void ui_term_backend_blit(Ui *tui) {
-	Buffer *buf = tui->ctx;
-	buf->len    = 0;
-	CellAttr attr = CELL_ATTR_NORMAL;
-	CellColor fg = CELL_COLOR_DEFAULT, bg = CELL_COLOR_DEFAULT;
+	UiTermScreen *screen = tui->ctx;
+	Buffer *buf = &screen->buf;
+	buf->len = 0;
 	int w = tui->width, h = tui->height;
-	Cell *cell = tui->cells;
-	/* reposition cursor, erase screen, reset attributes */
-	buffer_append0(buf, "\x1b[H" "\x1b[J" "\x1b[0m");
+	if (screen->width != w || screen->height != h)
+		screen->redraw = true;
+	CellStyle style = cell_erased.style;
+	if (screen->redraw) {
+		/* reset attributes, erase screen and compare against its blanks */
+		buffer_append0(buf, "\x1b[0m" "\x1b[H" "\x1b[J");
+		for (int i = 0; i < w*h; i++)
+			screen->cells[i] = cell_erased;
+		screen->cur_row = screen->cur_col = 0;
+	}
+	/* terminal cursor position, -1 if unknown */
+	int row = screen->cur_row, col = screen->cur_col;
+	bool reset = !screen->redraw;
 	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			CellStyle *style = &cell->style;
-			if (style->attr != attr) {
-
-				static const struct {
-					CellAttr attr;
-					char on[4], off[4];
-				} cell_attrs[] = {
-					{ CELL_ATTR_BOLD, "1", "22" },
-					{ CELL_ATTR_DIM, "2", "22" },
-					{ CELL_ATTR_ITALIC, "3", "23" },
-					{ CELL_ATTR_UNDERLINE, "4", "24" },
-					{ CELL_ATTR_BLINK, "5", "25" },
-					{ CELL_ATTR_REVERSE, "7", "27" },
-				};
-
-				for (size_t i = 0; i < LENGTH(cell_attrs); i++) {
-					CellAttr a = cell_attrs[i].attr;
-					if ((style->attr & a) == (attr & a))
-						continue;
-					buffer_appendf(buf, "\x1b[%sm",
-					               style->attr & a ?
-					               cell_attrs[i].on :
-					               cell_attrs[i].off);
-				}
-
-				attr = style->attr;
+		const Cell *cells = tui->cells + y * w;
+		Cell *shown = screen->cells + y * w;
+		/* trailing blanks are erased instead of written */
+		int blank = w;
+		while (blank > 0 && cell_erasable(&cells[blank-1]))
+			blank--;
+		if (w - blank <= UI_TERM_GAP_MAX)
+			blank = w;
+		for (int x = 0; x < w; ) {
+			if (cell_equal(&shown[x], &cells[x])) {
+				x++;
+				continue;
 			}
-
-			if (!cell_color_equal(fg, style->fg)) {
-				fg = style->fg;
-				if (fg.index != (uint8_t)-1) {
-					buffer_appendf(buf, "\x1b[%dm", 30 + fg.index);
-				} else {
-					buffer_appendf(buf, "\x1b[38;2;%d;%d;%dm",
-					               fg.r, fg.g, fg.b);
+			if (reset) {
+				/* attributes in effect are unknown */
+				buffer_append0(buf, "\x1b[0m");
+				reset = false;
+			}
+			if (x >= blank) {
+				if (row != y || col != x)
+					buffer_appendf(buf, "\x1b[%d;%dH", y + 1, x + 1);
+				if (!cell_style_equal(&style, &cell_erased.style)) {
+					buffer_append0(buf, "\x1b[0m");
+					style = cell_erased.style;
 				}
+				buffer_append0(buf, "\x1b[K");
+				for (; x < w; x++)
+					shown[x] = cell_erased;
+				row = y;
+				col = x;
+				break;
 			}
-
-			if (!cell_color_equal(bg, style->bg)) {
-				bg = style->bg;
-				if (bg.index != (uint8_t)-1) {
-					buffer_appendf(buf, "\x1b[%dm", 40 + bg.index);
+			/* start with the leading cell of a wide character */
+			int start = x;
+			while (start > 0 && !cells[start].data[0])
+				start--;
+			/* extend the run over short unchanged gaps */
+			int end = x + 1;
+			for (int gap = 0; end + gap < blank && gap <= UI_TERM_GAP_MAX; ) {
+				if (cell_equal(&shown[end+gap], &cells[end+gap])) {
+					gap++;
 				} else {
-					buffer_appendf(buf, "\x1b[48;2;%d;%d;%dm",
-					               bg.r, bg.g, bg.b);
+					end += gap + 1;
+					gap = 0;
 				}
 			}
-
-			buffer_append0(buf, cell->data);
-			cell++;
+			while (end < w && !cells[end].data[0])
+				end++;
+			if (row != y || col != start)
+				buffer_appendf(buf, "\x1b[%d;%dH", y + 1, start + 1);
+			for (x = start; x < end; x++) {
+				cell_style_apply(buf, &style, &cells[x].style);
+				buffer_append0(buf, cells[x].data);
+				shown[x] = cells[x];
+			}
+			row = y;
+			/* the position after the last column depends on the terminal */
+			col = end < w ? end : -1;
 		}
 	}
+	screen->width = w;
+	screen->height = h;
+	screen->redraw = false;
 	/* move cursor */
-	buffer_appendf(buf, "\x1b[%d;%dH", tui->cur_row + 1, tui->cur_col + 1);
-	output(buf->data, buffer_length0(buf));
+	if (row != tui->cur_row || col != tui->cur_col)
+		buffer_appendf(buf, "\x1b[%d;%dH", tui->cur_row + 1, tui->cur_col + 1);
+	screen->cur_row = tui->cur_row;
+	screen->cur_col = tui->cur_col;
+	if (buf->len)
+		output(buf->data, buffer_length0(buf));
 }
 
-static void ui_term_backend_clear(Ui *tui) { }
+static void ui_term_backend_clear(Ui *tui) {
+	UiTermScreen *screen = tui->ctx;
+	screen->redraw = true;
+}
 
 static bool ui_term_backend_resize(Ui *tui, int width, int height) {
+	UiTermScreen *screen = tui->ctx;
+	size_t size = width*height*sizeof(Cell);
+	if (size > screen->cells_size) {
+		Cell *cells = realloc(screen->cells, size);
+		if (!cells)
+			return false;
+		screen->cells_size = size;
+		screen->cells = cells;
+	}
+	screen->redraw = true;
 	return true;
 }
 
@@ -167,6 +296,8 @@ static void ui_term_backend_save(Ui *tui, bool fscr) {
 }
 
 static void ui_term_backend_restore(Ui *tui) {
+	/* the screen might have been used by another program */
+	ui_term_backend_clear(tui);
 }
 
 int ui_terminal_colors(void) {
@@ -185,6 +316,7 @@ void ui_terminal_resume(Ui *tui) {
 	screen_alternate(true);
 	cursor_visible(false);
 	termkey_start(tui->termkey);
+	ui_term_backend_clear(tui);
 }
 
 static bool ui_term_backend_init(Ui *tui, char *term) {
@@ -193,18 +325,20 @@ static bool ui_term_backend_init(Ui *tui, char *term) {
 }
 
 static bool ui_backend_init(Ui *ui) {
-	Buffer *buf = calloc(1, sizeof(Buffer));
-	if (!buf)
+	UiTermScreen *screen = calloc(1, sizeof(UiTermScreen));
+	if (!screen)
 		return false;
-	ui->ctx = buf;
+	screen->redraw = true;
+	ui->ctx = screen;
 	return true;
 }
 
 static void ui_term_backend_free(Ui *tui) {
-	Buffer *buf = tui->ctx;
+	UiTermScreen *screen = tui->ctx;
 	ui_term_backend_suspend(tui);
-	buffer_release(buf);
-	free(buf);
+	buffer_release(&screen->buf);
+	free(screen->cells);
+	free(screen);
 }
 
 static bool is_default_color(CellColor c) {
@@ -159,6 +159,7 @@ bool ui_style_define(Win *win, int id, const char *style) {
 	}
 	tui->styles[win->id * UI_STYLE_MAX + id] = cell_style;
 	free(style_copy);
+	view_invalidate(&win->view);
 	return true;
 }
 
@@ -25,9 +25,18 @@
 #ifndef CONFIG_ACL
   #define CONFIG_ACL 0
 #endif
+#ifndef CONFIG_COPY_FILE_RANGE
+  #define CONFIG_COPY_FILE_RANGE 0
+#endif
+#ifndef CONFIG_SPLICE
+  #define CONFIG_SPLICE 0
+#endif
 
 #undef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 700
+#if (CONFIG_COPY_FILE_RANGE || CONFIG_SPLICE) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE /* copy_file_range(2) and splice(2) with glibc */
+#endif
 
 #include <ctype.h>
 #include <errno.h>
@@ -47,6 +56,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/select.h>
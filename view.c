@@ -80,6 +80,14 @@ void window_status_update(Vis *vis, Win *win) {
 	         text_modified(txt) ? " [+]" : "",
 	         vis_macro_recording(vis) ? " @": "");
 
+	if (text_loading(txt))
+		snprintf(left_parts[left_count++], sizeof(left_parts[0]), "loading %.1f MiB",
+		         text_size(txt) / 1048576.0);
+
+	int saving = file_save_progress(file);
+	if (saving != -1)
+		snprintf(left_parts[left_count++], sizeof(left_parts[0]), "saving %d%%", saving);
+
 	int count = vis->action.count;
 	const char *keys = buffer_content0(&vis->input_queue);
 	if (keys && keys[0])
@@ -264,18 +272,19 @@ static bool view_expand_tab(View *view, Cell *cell) {
 
 	cell->width = 1;
 
+	size_t len = cell->len;
 	int displayed_width = view->tabwidth - (view->col % view->tabwidth);
 	for (int w = 0; w < displayed_width; ++w) {
 		int t = (w == 0) ? SYNTAX_SYMBOL_TAB : SYNTAX_SYMBOL_TAB_FILL;
 		const char *symbol = view->symbols[t];
 		strncpy(cell->data, symbol, sizeof(cell->data) - 1);
-		cell->len = (w == 0) ? 1 : 0;
+		cell->len = (w == 0) ? len : 0;
 
 		if (!view_add_cell(view, cell))
 			return false;
 	}
 
-	cell->len = 1;
+	cell->len = len;
 	return true;
 }
 
@@ -334,7 +343,7 @@ static bool view_addch(View *view, Cell *cell) {
 		/* non-printable ascii char, represent it as ^(char + 64) */
 		*cell = (Cell) {
 			.data = { '^', ch == 127 ? '?' : ch + 64, '\0' },
-			.len = 1,
+			.len = cell->len,
 			.width = 2,
 			.style = cell->style,
 		};
@@ -400,10 +409,133 @@ bool view_coord_get(View *view, size_t pos, Line **retline, int *retrow, int *re
 	return true;
 }
 
+static int view_row(View *view, Line *line) {
+	if (!line)
+		return view->height;
+	size_t line_size = sizeof(Line) + view->width*sizeof(Cell);
+	return ((char*)line - (char*)view->lines) / line_size;
+}
+
+/* whether the previous frame was drawn with the current layout settings */
+static bool view_frame_valid(View *view) {
+	ViewFrame *frame = &view->frame;
+	return frame->count > 0 && frame->width == view->width &&
+	       frame->text_width == view_max_text_width(view) &&
+	       frame->tabwidth == view->tabwidth &&
+	       !memcmp(frame->symbols, view->symbols, sizeof(frame->symbols));
+}
+
+/* record a file line which was completely drawn */
+static void view_line_drawn(View *view, size_t pos, size_t len, int row, bool breakat) {
+	view->drawn[view->drawn_count++] = (DrawnLine){
+		.pos = pos,
+		.len = len,
+		.row = row,
+		.rows = view_row(view, view->line) - row,
+		.breakat = breakat,
+		.breakat_end = view->prevch_breakat,
+	};
+}
+
+/* whether text starts with a zero width character, which would be combined
+ * with the new line preceding it */
+static bool view_combining(const char *text, size_t len) {
+	wchar_t wchar;
+	mbstate_t mbstate = { 0 };
+	size_t n = mbrtowc(&wchar, text, len, &mbstate);
+	return n != 0 && n < (size_t)-2 && wcwidth(wchar) == 0;
+}
+
+static int drawn_line_cmp(const void *key, const void *elem) {
+	size_t pos = *(const size_t*)key;
+	const DrawnLine *line = elem;
+	return pos < line->pos ? -1 : pos > line->pos;
+}
+
+/* Draw the file line starting at pos by copying the cells of an identical
+ * one from the previous frame. It is looked up at the same position and at
+ * the same distance from the end of the file, which covers lines before and
+ * after a modified region. Returns the number of bytes drawn. */
+static size_t view_line_reuse(View *view, size_t pos, const char *text, size_t len) {
+	ViewFrame *frame = &view->frame;
+	size_t size = text_size(view->text);
+	size_t candidates[] = { pos, pos + frame->size - size };
+	int row = view_row(view, view->line);
+	for (size_t i = 0; i < LENGTH(candidates); i++) {
+		if (i > 0 && candidates[i] == pos)
+			break;
+		DrawnLine *old = bsearch(&candidates[i], frame->lines, frame->count, sizeof *old, drawn_line_cmp);
+		if (!old || old->len > len || old->rows > view->height - row ||
+		    old->breakat != view->prevch_breakat ||
+		    memcmp(frame->text + (old->pos - frame->start), text, old->len) ||
+		    view_combining(text + old->len, len - old->len))
+			continue;
+		size_t line_size = sizeof(Line) + view->width*sizeof(Cell);
+		const Line *src = (Line*)((char*)frame->screen + old->row * line_size);
+		size_t lineno = view->line->lineno;
+		for (int r = 0; r < old->rows; r++) {
+			Line *dst = view->line;
+			dst->len = src->len;
+			dst->width = src->width;
+			dst->lineno = lineno;
+			memcpy(dst->cells, src->cells, view->width*sizeof(Cell));
+			src = (const Line*)((const char*)src + line_size);
+			view->line = dst->next;
+		}
+		if (view->line)
+			view->line->lineno = lineno + 1;
+		view->col = 0;
+		view->wrapcol = 0;
+		view->prevch_breakat = old->breakat_end;
+		view->drawn[view->drawn_count++] = (DrawnLine){
+			.pos = pos,
+			.len = old->len,
+			.row = row,
+			.rows = old->rows,
+			.breakat = old->breakat,
+			.breakat_end = old->breakat_end,
+		};
+		return old->len;
+	}
+	return 0;
+}
+
+/* keep the frame just drawn, as long as it is not yet styled */
+static void view_frame_save(View *view, bool valid) {
+	ViewFrame *frame = &view->frame;
+	char *text = frame->text;
+	frame->text = view->textbuf;
+	view->textbuf = text;
+	DrawnLine *lines = frame->lines;
+	frame->lines = view->drawn;
+	view->drawn = lines;
+	frame->count = valid ? view->drawn_count : 0;
+	frame->start = view->start;
+	frame->size = text_size(view->text);
+	frame->width = view->width;
+	frame->text_width = view_max_text_width(view);
+	frame->tabwidth = view->tabwidth;
+	memcpy(frame->symbols, view->symbols, sizeof(frame->symbols));
+	size_t line_size = sizeof(Line) + view->width*sizeof(Cell);
+	if (frame->count > 0) {
+		const DrawnLine *last = &frame->lines[frame->count-1];
+		memcpy(frame->screen, view->lines, (last->row + last->rows) * line_size);
+	}
+}
+
+void view_invalidate(View *view) {
+	view->frame.count = 0;
+}
+
 /* redraw the complete with data starting from view->start bytes into the file.
- * stop once the screen is full, update view->end, view->lastline */
+ * stop once the screen is full, update view->end, view->lastline.
+ * File lines which did not change since the previous frame are copied over
+ * instead of decoding them again. */
 void view_draw(View *view) {
 	view_clear(view);
+	if (!view_frame_valid(view))
+		view->frame.count = 0;
+	view->drawn_count = 0;
 	/* read a screenful of text considering each character as 4-byte UTF character*/
 	const size_t size = view->width * view->height * 4;
 	/* current buffer to work with */
@@ -418,10 +550,30 @@ void view_draw(View *view) {
 	char *cur = text;
 	/* start from known multibyte state */
 	mbstate_t mbstate = { 0 };
+	/* start, screen line and word wrap state of the file line being drawn */
+	size_t line_pos = pos;
+	int line_row = 0;
+	bool line_breakat = view->prevch_breakat;
+	/* whether the buffer still holds the text starting from view->start */
+	bool contiguous = true;
 
 	Cell cell = { .data = "", .len = 0, .width = 0, }, prev_cell = cell;
 
-	while (rem > 0) {
+	for (bool line_start = true; rem > 0; ) {
+
+		if (line_start) {
+			line_start = false;
+			size_t len;
+			while (view->line && (len = view_line_reuse(view, pos, cur, rem)) > 0) {
+				pos += len;
+				cur += len;
+				rem -= len;
+			}
+			line_pos = pos;
+			line_row = view_row(view, view->line);
+			line_breakat = view->prevch_breakat;
+			continue;
+		}
 
 		/* current 'parsed' character' */
 		wchar_t wchar;
@@ -442,6 +594,7 @@ void view_draw(View *view) {
 			rem = text_bytes_get(view->text, pos+prev_cell.len, size, text);
 			text[rem] = '\0';
 			cur = text;
+			contiguous = false;
 			continue;
 		} else if (len == 0) {
 			/* NUL byte encountered, store it and continue */
@@ -462,9 +615,19 @@ void view_draw(View *view) {
 			strncat(prev_cell.data, cell.data, sizeof(prev_cell.data)-strlen(prev_cell.data)-1);
 			prev_cell.len += cell.len;
 		} else {
+			bool newline = prev_cell.data[0] == '\n';
 			if (prev_cell.len && !view_addch(view, &prev_cell))
 				break;
 			pos += prev_cell.len;
+			if (newline && contiguous) {
+				/* the current character is looked at again, unless the
+				 * following file lines can be reused */
+				view_line_drawn(view, line_pos, pos - line_pos, line_row, line_breakat);
+				prev_cell = (Cell){ .data = "" };
+				memset(&cell, 0, sizeof cell);
+				line_start = true;
+				continue;
+			}
 			prev_cell = cell;
 		}
 
@@ -506,6 +669,7 @@ void view_draw(View *view) {
 		}
 	}
 
+	view_frame_save(view, contiguous);
 	view->need_update = true;
 }
 
@@ -530,24 +694,42 @@ bool view_resize(View *view, int width, int height) {
 		return true;
 	}
 	char *textbuf = malloc(width * height * 4 + 1);
-	if (!textbuf)
-		return false;
+	char *frame_text = malloc(width * height * 4 + 1);
+	DrawnLine *drawn = calloc(height, sizeof *drawn);
+	DrawnLine *frame_lines = calloc(height, sizeof *frame_lines);
+	if (!textbuf || !frame_text || !drawn || !frame_lines)
+		goto err;
 	size_t lines_size = height*(sizeof(Line) + width*sizeof(Cell));
 	if (lines_size > view->lines_size) {
 		Line *lines = realloc(view->lines, lines_size);
-		if (!lines) {
-			free(textbuf);
-			return false;
-		}
+		if (!lines)
+			goto err;
 		view->lines = lines;
+		Line *screen = realloc(view->frame.screen, lines_size);
+		if (!screen)
+			goto err;
+		view->frame.screen = screen;
 		view->lines_size = lines_size;
 	}
 	free(view->textbuf);
+	free(view->frame.text);
+	free(view->drawn);
+	free(view->frame.lines);
 	view->textbuf = textbuf;
+	view->frame.text = frame_text;
+	view->drawn = drawn;
+	view->frame.lines = frame_lines;
+	view->frame.count = 0;
 	view->width = width;
 	view->height = height;
 	view_draw(view);
 	return true;
+err:
+	free(textbuf);
+	free(frame_text);
+	free(drawn);
+	free(frame_lines);
+	return false;
 }
 
 void view_free(View *view) {
@@ -557,6 +739,10 @@ void view_free(View *view) {
 		selection_free(view->selections);
 	free(view->textbuf);
 	free(view->lines);
+	free(view->frame.text);
+	free(view->frame.screen);
+	free(view->frame.lines);
+	free(view->drawn);
 	free(view->breakat);
 }
 
@@ -899,6 +1085,7 @@ bool view_breakat_set(View *view, const char *breakat) {
 		return false;
 	free(view->breakat);
 	view->breakat = copy;
+	view_invalidate(view);
 	return true;
 }
 
@@ -1323,37 +1510,74 @@ void view_selections_normalize(View *view) {
 }
 
 void win_style(Win *win, enum UiStyle style, size_t start, size_t end, bool keep_non_default) {
-	View *view = &win->view;
-	if (end < view->start || start > view->end)
-		return;
+	WinStyleCursor cursor;
+	win_style_begin(win, &cursor);
+	win_style_next(win, &cursor, style, start, end, keep_non_default);
+}
 
-	size_t pos = view->start;
-	Line *line = view->topline;
+void win_style_begin(Win *win, WinStyleCursor *cursor) {
+	cursor->line = win->view.topline;
+	cursor->col = 0;
+	cursor->pos = win->view.start;
+}
 
-	/* skip lines before range to be styled */
-	while (line && pos + line->len <= start) {
-		pos += line->len;
-		line = line->next;
+bool win_style_next(Win *win, WinStyleCursor *cursor, enum UiStyle style, size_t start, size_t end, bool keep_non_default) {
+	View *view = &win->view;
+	if (start > view->end)
+		cursor->line = NULL;
+	Line *line = cursor->line;
+	if (!line || end < cursor->pos)
+		return line != NULL;
+
+	int col = cursor->col, width = view->width;
+	size_t pos = cursor->pos;
+
+	/* skip lines and columns before range to be styled */
+	while (line && pos < start) {
+		if (col == 0 && pos + line->len <= start) {
+			pos += line->len;
+			line = line->next;
+		} else if (col < width) {
+			pos += line->cells[col++].len;
+		} else {
+			line = line->next;
+			col = 0;
+		}
 	}
 
-	if (!line)
-		return;
-
-	int col = 0, width = view->width;
+	/* continue on the next line once all cells of the current one are consumed */
+	while (line && pos == start) {
+		int next = col;
+		while (next < width && !line->cells[next].len)
+			next++;
+		if (next < width)
+			break;
+		line = line->next;
+		col = 0;
+	}
 
-	/* skip columns before range to be styled */
-	while (pos < start && col < width)
-		pos += line->cells[col++].len;
+	if (!line) {
+		cursor->line = NULL;
+		return false;
+	}
 
 	/* skip empty columns */
-	while (!line->cells[col].len && col < width)
+	while (col < width && !line->cells[col].len)
 		col++;
 
-	do {
+	for (;;) {
 		while (pos <= end && col < width) {
 			pos += line->cells[col].len;
 			ui_window_style_set(&win->vis->ui, win->id, &line->cells[col++], style, keep_non_default);
 		}
+		if (pos > end || !line->next)
+			break;
+		line = line->next;
 		col = 0;
-	} while (pos <= end && (line = line->next));
+	}
+
+	cursor->line = line;
+	cursor->col = col;
+	cursor->pos = pos;
+	return col < width || line->next;
 }
@@ -33,6 +33,33 @@ struct Line {               /* a line on the screen, *not* in the file */
 	Cell cells[];       /* win->width cells storing information about the displayed characters */
 };
 
+typedef struct {            /* a file line which was completely drawn */
+	size_t pos;         /* position of its first byte */
+	size_t len;         /* length in bytes, including the terminating new line */
+	int row, rows;      /* first screen line and number of screen lines occupied */
+	bool breakat;       /* whether the preceding character is part of breakat */
+	bool breakat_end;   /* whether the terminating new line is part of breakat */
+} DrawnLine;
+
+typedef struct {            /* previously drawn frame, used to reuse the cells of unchanged file lines */
+	DrawnLine *lines;   /* completely drawn file lines ordered by position, at most one per screen line */
+	int count;          /* number of valid entries, zero if the frame can not be reused */
+	Line *screen;       /* screen lines as drawn, before any styling was applied */
+	char *text;         /* text displayed in the frame */
+	size_t start;       /* position of text[0] */
+	size_t size;        /* text size at the time the frame was drawn */
+	int width;          /* layout settings in effect */
+	int text_width;
+	int tabwidth;
+	const char *symbols[SYNTAX_SYMBOL_LAST];
+} ViewFrame;
+
+typedef struct {            /* position within the drawn cells while styling ranges in order */
+	Line *line;         /* screen line of the next cell, NULL past the end of the view */
+	int col;            /* column of the next cell, the width once the line is consumed */
+	size_t pos;         /* text position of the next cell */
+} WinStyleCursor;
+
 struct View;
 typedef struct Selection {
 	Mark cursor;            /* other selection endpoint where it changes */
@@ -77,6 +104,9 @@ typedef struct View {
 	int wrapcolumn; /* wrap lines at minimum of window width and wrapcolumn (if != 0) */
 	int wrapcol;    /* used while drawing view content, column where word wrap might happen */
 	bool prevch_breakat; /* used while drawing view content, previous char is part of breakat */
+	ViewFrame frame;     /* previously drawn frame */
+	DrawnLine *drawn;    /* used while drawing view content, file lines completely drawn so far */
+	int drawn_count;
 } View;
 
 /**
@@ -129,6 +159,8 @@ VIS_INTERNAL bool view_resize(View*, int width, int height);
  */
 VIS_INTERNAL void view_draw(View*);
 VIS_INTERNAL bool view_update(View*);
+/** Redraw all lines from scratch, e.g. after style definitions changed. */
+VIS_INTERNAL void view_invalidate(View*);
 
 /**
  * @}
@@ -351,6 +383,17 @@ VIS_INTERNAL bool view_breakat_set(View*, const char *breakat);
 VIS_INTERNAL void view_tabwidth_set(View*, int tabwidth);
 /** Apply a style to a text range. */
 VIS_INTERNAL void win_style(struct Win*, enum UiStyle, size_t start, size_t end, bool keep_non_default);
+/** Position the cursor at the start of the view. */
+VIS_INTERNAL void win_style_begin(struct Win*, WinStyleCursor*);
+/**
+ * Apply a style to the text range ``[start, end]`` and advance the cursor past
+ * it, such that many ranges are styled in one pass over the cells.
+ * @rst
+ * .. note:: The ranges have to be in ascending, non-overlapping order.
+ * @endrst
+ * @return Whether there are cells left to style.
+ */
+VIS_INTERNAL bool win_style_next(struct Win*, WinStyleCursor*, enum UiStyle, size_t start, size_t end, bool keep_non_default);
 
 /** @} */
 
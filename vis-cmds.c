@@ -368,6 +368,36 @@ static bool cmd_set(Vis *vis, Win *win, Command *cmd, const char *argv[], Select
 		if (arg.i >= 0)
 			win->view.wrapcolumn = arg.i;
 		break;
+	case OPTION_UNDO_LEVELS:
+	case OPTION_UNDO_AGE:
+	case OPTION_UNDO_SIZE:
+		if (arg.i < 0) {
+			vis_info_show(vis, "Invalid undo history limit");
+			return false;
+		}
+		if (opt_index == OPTION_UNDO_LEVELS)
+			vis->history_limit.revisions = arg.i;
+		else if (opt_index == OPTION_UNDO_AGE)
+			vis->history_limit.age = arg.i;
+		else
+			vis->history_limit.bytes = arg.i;
+		break;
+	case OPTION_SAVE_BACKGROUND:
+		vis->save_background = arg.i;
+		break;
+	case OPTION_UNDO_FILE:
+		vis->undofile = toggle ? !vis->undofile : arg.b;
+		break;
+	case OPTION_SWAP_FILE:
+		vis->swapfile = toggle ? !vis->swapfile : arg.b;
+		break;
+	case OPTION_FILTER_JOBS:
+		if (arg.i < 1) {
+			vis_info_show(vis, "Invalid number of filter jobs");
+			return false;
+		}
+		vis->filter_jobs = arg.i;
+		break;
 	default:
 		if (!opt->func)
 			return false;
@@ -521,7 +551,7 @@ static bool cmd_quit(Vis *vis, Win *win, Command *cmd, const char *argv[], Selec
 static bool cmd_qall(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
 	for (Win *next, *win = vis->windows; win; win = next) {
 		next = win->next;
-		if (!win->file->internal && (!text_modified(win->file->text) || cmd->flags == '!'))
+		if (!win->file->internal && ((!text_modified(win->file->text) && !win->file->save) || cmd->flags == '!'))
 			vis_window_close(win);
 	}
 	if (!has_windows(vis)) {
@@ -43,9 +43,14 @@ enum PromptState {
 };
 
 typedef struct {
-	Buffer     *data;
-	VisDACount  count;
-	VisDACount  capacity;
+	Buffer    buffer;  /* register content, unless it is shared with a text */
+	TextSpan *span;    /* content shared with a text, copied to buffer once it is read */
+} RegisterSlot;
+
+typedef struct {
+	RegisterSlot *data;
+	VisDACount    count;
+	VisDACount    capacity;
 	enum {
 		REGISTER_NORMAL,
 		REGISTER_NUMBER,
@@ -137,17 +142,58 @@ typedef struct {
 	enum SamError error;  /* non-zero in case something went wrong */
 } Transcript;
 
+typedef struct {             /* an external command reading a range of a file */
+	File *file;              /* file whose range is written to the standard input */
+	Filerange range;         /* part of the range which still needs to be written */
+	const char *buf;         /* NUL terminated data written instead of a range or NULL */
+	const char **argv;       /* command to run, passed to the shell if it has no arguments */
+	void *stdout_context;
+	ssize_t (*read_stdout)(void *stdout_context, char *data, size_t len);
+	void *stderr_context;
+	ssize_t (*read_stderr)(void *stderr_context, char *data, size_t len);
+	Buffer *stdout_buffer;   /* stdout is read straight into this buffer instead, if not NULL */
+	Buffer *stderr_buffer;   /* likewise for stderr */
+	TextSpan **stdout_span;  /* stdout is stored in the text of the file instead, if not NULL */
+	size_t stdout_size;      /* expected size of the stored output, that of the range */
+	pid_t pid;               /* the running command, -1 once it terminated */
+	int in, out, err;        /* our ends of the pipes to it, -1 once closed */
+	int status;              /* exit status once terminated, -1 if it failed */
+} Filter;
+
+typedef struct SamFilter SamFilter;
+typedef struct {             /* filters of a sam command whose output is applied once all of them ran */
+	SamFilter  *data;
+	VisDACount  count;
+	VisDACount  capacity;
+	size_t loop;             /* current invocation of the innermost selection loop */
+	size_t iteration;        /* current iteration of the innermost selection loop */
+	size_t iterations;       /* counter from which loop and iteration are drawn */
+} SamFilterList;
+
+typedef struct {             /* a save performed in the background by a child process */
+	TextSave ctx;            /* committed once the child wrote all data */
+	char *path;              /* absolute path of the destination */
+	bool existing;           /* whether the destination existed before */
+	bool same;               /* whether the destination is the loaded file */
+	size_t size;             /* number of bytes to write */
+	pid_t pid;               /* the child writing the data */
+	int fd;                  /* read end of a pipe on which the child reports failure */
+} FileSave;
+
 struct File { /* shared state among windows displaying the same file */
 	Text *text;                      /* data structure holding the file content */
 	const char *name;                /* file name used when loading/saving */
 	volatile sig_atomic_t truncated; /* whether the underlying memory mapped region became invalid (SIGBUS) */
 	int fd;                          /* output file descriptor associated with this file or -1 if loaded by file name */
+	int load_fd;                     /* input file descriptor whose content is still being appended or -1 */
 	bool internal;                   /* whether it is an internal file (e.g. used for the prompt) */
 	struct stat stat;                /* filesystem information when loaded/saved, used to detect changes outside the editor */
 	int refcount;                    /* how many windows are displaying this file? (always >= 1) */
 	SelectionRegionList marks[VIS_MARK_INVALID]; /* marks which are shared across windows */
 	enum TextSaveMethod save_method; /* whether the file is saved using rename(2) or overwritten */
 	Transcript transcript;           /* keeps track of changes performed by sam commands */
+	FileSave *save;                  /* save in progress or NULL */
+	char *swap;                      /* journal removed once the file is closed or NULL */
 	File *next, *prev;
 };
 
@@ -203,6 +249,14 @@ struct Vis {
 	bool autoindent;                     /* whether indentation should be copied from previous line on newline */
 	bool change_colors;                  /* whether to adjust 256 color palette for true colors */
 	bool ignorecase;                     /* whether to ignore case when searching */
+	TextHistoryLimit history_limit;      /* undo history retained upon snapshots, unlimited if zero */
+	size_t save_background;              /* minimal file size saved in the background, never if zero */
+	bool undofile;                       /* whether the undo history of opened files is journaled */
+	bool swapfile;                       /* whether changes of opened files are journaled until they are closed */
+	bool recover;                        /* whether opened files are restored to their most recently journaled state */
+	struct timespec journal_synced;      /* when the journals of all files were last synced */
+	size_t filter_jobs;                  /* maximal number of filters of a sam command run at the same time */
+	SamFilterList *filters;              /* filters of the sam command being executed, NULL if run right away */
 	bool keymap_disabled;                /* ignore key map for next key press, gets automatically re-enabled */
 	char *shell;                         /* shell used to launch external commands */
 	Map *cmds;                           /* ":"-commands, used for unique prefix queries */
@@ -274,6 +328,7 @@ enum VisEvents {
 	VIS_EVENT_FILE_SAVE_PRE,
 	VIS_EVENT_FILE_SAVE_POST,
 	VIS_EVENT_FILE_CLOSE,
+	VIS_EVENT_FILE_CHANGE,
 	VIS_EVENT_WIN_OPEN,
 	VIS_EVENT_WIN_CLOSE,
 	VIS_EVENT_WIN_HIGHLIGHT,
@@ -306,6 +361,8 @@ VIS_INTERNAL void macro_operator_record(Vis *vis);
 VIS_INTERNAL void vis_do(Vis *vis);
 VIS_INTERNAL void action_reset(Action*);
 VIS_INTERNAL size_t vis_text_insert_nl(Vis*, Text*, size_t pos);
+VIS_INTERNAL int vis_pipe_filter(Vis*, Filter*, bool fullscreen);
+VIS_INTERNAL bool vis_pipe_all(Vis*, Filter *filters[], size_t count, size_t jobs);
 
 VIS_INTERNAL Mode *mode_get(Vis*, enum VisMode);
 VIS_INTERNAL void mode_set(Vis *vis, Mode *new_mode);
@@ -328,7 +385,11 @@ VIS_INTERNAL bool register_slot_put(Vis*, Register*, size_t slot, const char *da
 VIS_INTERNAL bool register_put_range(Vis*, Register*, Text*, Filerange*);
 VIS_INTERNAL bool register_slot_put_range(Vis*, Register*, size_t slot, Text*, Filerange*);
 
+VIS_INTERNAL const TextSpan *register_slot_span(Register*, size_t slot);
+VIS_INTERNAL void register_slot_flatten(Vis*, Register*, size_t slot);
+
 VIS_INTERNAL size_t vis_register_count(Vis*, Register*);
 VIS_INTERNAL bool register_resize(Register*, size_t count);
+VIS_INTERNAL void register_release(Register*);
 
 #endif
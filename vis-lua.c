@@ -400,6 +400,13 @@ static size_t checkpos(lua_State *L, int narg) {
 	return luaL_argerror(L, narg, "expected position, got number");
 }
 
+static lua_Integer checklimit(lua_State *L, int narg) {
+	lua_Integer n = luaL_checkinteger(L, narg);
+	if (n >= 0)
+		return n;
+	return luaL_argerror(L, narg, "expected non-negative limit, got number");
+}
+
 static void pushpos(lua_State *L, size_t pos) {
 	if (pos == EPOS)
 		lua_pushnil(L);
@@ -1503,6 +1510,20 @@ static int vis_options_assign(Vis *vis, lua_State *L, const char *key, int next)
 		if (!lua_isstring(L, next))
 			return newindex_common(L);
 		vis_shell_set(vis, lua_tostring(L, next));
+	} else if (strcmp(key, "undolevels") == 0) {
+		vis->history_limit.revisions = checklimit(L, next);
+	} else if (strcmp(key, "undoage") == 0) {
+		vis->history_limit.age = checklimit(L, next);
+	} else if (strcmp(key, "undosize") == 0) {
+		vis->history_limit.bytes = checklimit(L, next);
+	} else if (strcmp(key, "savebackground") == 0) {
+		vis->save_background = luaL_checkinteger(L, next);
+	} else if (strcmp(key, "undofile") == 0) {
+		vis->undofile = lua_toboolean(L, next);
+	} else if (strcmp(key, "swapfile") == 0) {
+		vis->swapfile = lua_toboolean(L, next);
+	} else if (strcmp(key, "filterjobs") == 0) {
+		vis->filter_jobs = MAX(luaL_checkinteger(L, next), 1);
 	}
 	return 0;
 }
@@ -1611,6 +1632,13 @@ static const struct luaL_Reg vis_lua[] = {
  * @tfield[opt=false] boolean ignorecase {ic}
  * @tfield[opt="auto"] string loadmethod `"auto"`, `"read"`, or `"mmap"`.
  * @tfield[opt="/bin/sh"] string shell
+ * @tfield[opt=0] int undolevels
+ * @tfield[opt=0] int undoage
+ * @tfield[opt=0] int undosize
+ * @tfield[opt=16777216] int savebackground
+ * @tfield[opt=false] boolean undofile
+ * @tfield[opt=false] boolean swapfile
+ * @tfield[opt=1] int filterjobs
  * @see Window.options
  */
 
@@ -1648,6 +1676,27 @@ static int vis_options_index(lua_State *L) {
 		} else if (strcmp(key, "shell") == 0) {
 			lua_pushstring(L, vis->shell);
 			return 1;
+		} else if (strcmp(key, "undolevels") == 0) {
+			lua_pushinteger(L, vis->history_limit.revisions);
+			return 1;
+		} else if (strcmp(key, "undoage") == 0) {
+			lua_pushinteger(L, vis->history_limit.age);
+			return 1;
+		} else if (strcmp(key, "undosize") == 0) {
+			lua_pushinteger(L, vis->history_limit.bytes);
+			return 1;
+		} else if (strcmp(key, "savebackground") == 0) {
+			lua_pushinteger(L, vis->save_background);
+			return 1;
+		} else if (strcmp(key, "undofile") == 0) {
+			lua_pushboolean(L, vis->undofile);
+			return 1;
+		} else if (strcmp(key, "swapfile") == 0) {
+			lua_pushboolean(L, vis->swapfile);
+			return 1;
+		} else if (strcmp(key, "filterjobs") == 0) {
+			lua_pushinteger(L, vis->filter_jobs);
+			return 1;
 		}
 	}
 	return index_common(L);
@@ -2075,6 +2124,67 @@ static int window_style(lua_State *L) {
 	return 0;
 }
 
+/* absolute end position, exclusive, of the i-th token lexed from data starting at start */
+static size_t window_token_end(lua_State *L, size_t start, size_t i) {
+	lua_rawgeti(L, 2, 2*i + 2);
+	lua_Integer end = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	return end < 1 ? start : start + (size_t)end - 1;
+}
+
+/***
+ * Style the tokens produced by a lexer.
+ *
+ * Applies the styles of all tokens in a single pass over the window content,
+ * which is considerably cheaper than calling @{style} for every token.
+ * Tokens outside the viewport as well as tokens without a style are skipped.
+ * The style will be cleared after every window redraw.
+ * @function style_tokens
+ * @tparam table tokens the alternating token names and end positions as returned by `lexer:lex`
+ * @tparam int start the absolute file position in bytes of the lexed data
+ * @tparam table styles the mapping of token names to display styles
+ * @see style
+ * @usage
+ * local tokens = lexer:lex(data)
+ * win:style_tokens(tokens, viewport.start, lexer._TAGS)
+ */
+static int window_style_tokens(lua_State *L) {
+	Win *win = obj_ref_check(L, 1, VIS_LUA_TYPE_WINDOW);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	size_t start = checkpos(L, 3);
+	luaL_checktype(L, 4, LUA_TTABLE);
+	size_t count = lua_rawlen(L, 2) / 2;
+
+	/* find the first token ending within the view */
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (window_token_end(L, start, mid) <= win->view.start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	WinStyleCursor cursor;
+	win_style_begin(win, &cursor);
+	size_t token_start = lo > 0 ? window_token_end(L, start, lo - 1) : start;
+	for (size_t i = lo; i < count; i++) {
+		size_t token_end = window_token_end(L, start, i);
+		if (token_end <= token_start)
+			continue;
+		lua_rawgeti(L, 2, 2*i + 1);
+		lua_rawget(L, 4);
+		bool more = true;
+		if (lua_isnumber(L, -1))
+			more = win_style_next(win, &cursor, lua_tointeger(L, -1), token_start, token_end - 1, false);
+		lua_pop(L, 1);
+		if (!more)
+			break;
+		token_start = token_end;
+	}
+	return 0;
+}
+
 /***
  * Style the single terminal cell at the given coordinates, relative to this window.
  *
@@ -2172,6 +2282,7 @@ static const struct luaL_Reg window_funcs[] = {
 	{ "unmap", window_unmap },
 	{ "style_define", window_style_define },
 	{ "style", window_style },
+	{ "style_tokens", window_style_tokens },
 	{ "style_pos", window_style_pos },
 	{ "status", window_status },
 	{ "draw", window_draw },
@@ -2539,6 +2650,14 @@ static const struct luaL_Reg window_selection_funcs[] = {
  * File state.
  * @tfield bool modified whether the file contains unsaved changes
  */
+/***
+ * Background save state.
+ * @tfield int saving percentage of the background save already written or `nil` if there is none
+ */
+/***
+ * Loading state.
+ * @tfield bool loading whether the file content is still being read, it can not be modified meanwhile
+ */
 /***
  * File permission.
  * @tfield int permission the file permission bits as of the most recent load/save
@@ -2573,6 +2692,20 @@ static int file_index(lua_State *L) {
 			return 1;
 		}
 
+		if (strcmp(key, "loading") == 0) {
+			lua_pushboolean(L, text_loading(file->text));
+			return 1;
+		}
+
+		if (strcmp(key, "saving") == 0) {
+			int saving = file_save_progress(file);
+			if (saving == -1)
+				lua_pushnil(L);
+			else
+				lua_pushinteger(L, saving);
+			return 1;
+		}
+
 		if (strcmp(key, "permission") == 0) {
 			struct stat stat = text_stat(file->text);
 			lua_pushinteger(L, stat.st_mode & 0777);
@@ -3530,6 +3663,26 @@ static void vis_lua_file_close(Vis *vis, File *file) {
 	lua_pop(L, 1);
 }
 
+/***
+ * File change.
+ * The file content was modified, emitted before a window displaying it is
+ * redrawn. State derived from the content past the given position should
+ * be discarded.
+ * @function file_change
+ * @tparam File file the file which was modified
+ * @tparam int pos the lowest position modified since the event was last emitted
+ */
+static void vis_lua_file_change(Vis *vis, File *file, size_t pos) {
+	lua_State *L = vis->lua;
+	vis_lua_event_get(L, "file_change");
+	if (lua_isfunction(L, -1)) {
+		obj_ref_new(L, file, VIS_LUA_TYPE_FILE);
+		lua_pushinteger(L, pos);
+		pcall(vis, L, 2, 0);
+	}
+	lua_pop(L, 1);
+}
+
 /***
  * Window open.
  * A new window has been created.
@@ -3687,6 +3840,7 @@ bool vis_event_emit(Vis *vis, enum VisEvents id, ...) {
 	case VIS_EVENT_FILE_SAVE_PRE:
 	case VIS_EVENT_FILE_SAVE_POST:
 	case VIS_EVENT_FILE_CLOSE:
+	case VIS_EVENT_FILE_CHANGE:
 	{
 		File *file = va_arg(ap, File*);
 		if (file->internal)
@@ -3701,6 +3855,8 @@ bool vis_event_emit(Vis *vis, enum VisEvents id, ...) {
 			vis_lua_file_save_post(vis, file, path);
 		} else if (id == VIS_EVENT_FILE_CLOSE) {
 			vis_lua_file_close(vis, file);
+		} else if (id == VIS_EVENT_FILE_CHANGE) {
+			vis_lua_file_change(vis, file, va_arg(ap, size_t));
 		}
 		break;
 	}
@@ -57,13 +57,19 @@ static size_t op_put(Vis *vis, Text *txt, OperatorContext *c) {
 	}
 
 	size_t len;
-	const char *data = register_slot_get(vis, c->reg, c->reg_slot, &len);
+	const TextSpan *span = register_slot_span(c->reg, c->reg_slot);
+	const char *data = span ? NULL : register_slot_get(vis, c->reg, c->reg_slot, &len);
+	if (span)
+		len = text_span_size(span);
 
 	for (int i = 0; i < c->count; i++) {
 		char nl;
 		if (c->reg->linewise && pos > 0 && text_byte_get(txt, pos-1, &nl) && nl != '\n')
 			pos += text_insert(vis, txt, pos, "\n", 1);
-		text_insert(vis, txt, pos, data, len);
+		if (span)
+			text_span_insert(vis, txt, pos, span);
+		else
+			text_insert(vis, txt, pos, data, len);
 		pos += len;
 		if (c->reg->linewise && pos > 0 && text_byte_get(txt, pos-1, &nl) && nl != '\n')
 			pos += text_insert(vis, txt, pos, "\n", 1);
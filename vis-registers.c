@@ -1,6 +1,6 @@
 #include "vis-core.h"
 
-static Buffer *register_buffer(Vis *vis, Register *reg, VisDACount slot)
+static RegisterSlot *register_slot(Vis *vis, Register *reg, VisDACount slot)
 {
 	if (slot >= reg->capacity)
 		da_reserve(vis, reg, slot);
@@ -9,6 +9,37 @@ static Buffer *register_buffer(Vis *vis, Register *reg, VisDACount slot)
 	return reg->data + slot;
 }
 
+/* get the buffer of a slot whose content is about to be replaced */
+static Buffer *register_buffer(Vis *vis, Register *reg, VisDACount slot)
+{
+	RegisterSlot *s = register_slot(vis, reg, slot);
+	text_span_free(s->span);
+	s->span = NULL;
+	return &s->buffer;
+}
+
+void register_slot_flatten(Vis *vis, Register *reg, size_t slot)
+{
+	if ((VisDACount)slot >= reg->count || !reg->data[slot].span)
+		return;
+	RegisterSlot *s = reg->data + slot;
+	size_t len = text_span_size(s->span);
+	s->buffer.len = 0;
+	if (len == SIZE_MAX || !buffer_reserve(&s->buffer, len+1))
+		return;
+	s->buffer.len = text_span_bytes_get(s->span, 0, len, s->buffer.data);
+	buffer_append(&s->buffer, "\0", 1);
+	text_span_free(s->span);
+	s->span = NULL;
+}
+
+const TextSpan *register_slot_span(Register *reg, size_t slot)
+{
+	if (reg->type != REGISTER_NORMAL || (VisDACount)slot >= reg->count)
+		return NULL;
+	return reg->data[slot].span;
+}
+
 const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 {
 	if (len) *len = 0;
@@ -16,7 +47,8 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 	switch (reg->type) {
 	case REGISTER_NORMAL:{
 		if ((int)slot < reg->count) {
-			Buffer *b = reg->data + slot;
+			register_slot_flatten(vis, reg, slot);
+			Buffer *b = &reg->data[slot].buffer;
 			buffer_terminate(b);
 			if (len) *len = buffer_length0(b);
 			result = buffer_content0(b);
@@ -24,7 +56,7 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 	}break;
 	case REGISTER_NUMBER:{
 		if (reg->count > 0) {
-			Buffer *b = reg->data;
+			Buffer *b = &reg->data->buffer;
 			b->len = 0;
 			buffer_appendf(b, "%zu", slot + 1);
 			if (len) *len = buffer_length0(b);
@@ -33,7 +65,7 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 	}break;
 	case REGISTER_CLIPBOARD:{
 		if ((VisDACount)slot < reg->count) {
-			Buffer *b      = reg->data + slot;
+			Buffer *b      = &reg->data[slot].buffer;
 			Buffer  buferr = {0};
 			enum VisRegister id = reg - vis->registers;
 			const char *cmd[] = {VIS_CLIPBOARD, "--paste", "--selection", 0, 0};
@@ -86,6 +118,7 @@ static bool register_slot_append_range(Vis *vis, Register *reg, size_t slot, Tex
 	switch (reg->type) {
 	case REGISTER_NORMAL:
 	{
+		register_slot_flatten(vis, reg, slot);
 		Buffer *buf = register_buffer(vis, reg, slot);
 		size_t len = text_range_size(range);
 		if (len == SIZE_MAX || !buffer_grow(buf, len+1))
@@ -108,12 +141,15 @@ bool register_slot_put_range(Vis *vis, Register *reg, size_t slot, Text *txt, Fi
 	switch (reg->type) {
 	case REGISTER_NORMAL:
 	{
-		Buffer *buf = register_buffer(vis, reg, slot);
-		size_t len = text_range_size(range);
-		if (len == SIZE_MAX || !buffer_reserve(buf, len+1))
+		/* share the content with the text, it is only copied once read */
+		TextSpan *span = text_span_get(txt, range);
+		if (!span)
 			return false;
-		buf->len = text_bytes_get(txt, range->start, len, buf->data);
-		return buffer_append(buf, "\0", 1);
+		RegisterSlot *s = register_slot(vis, reg, slot);
+		text_span_free(s->span);
+		s->span = span;
+		s->buffer.len = 0;
+		return true;
 	}
 	case REGISTER_CLIPBOARD:
 	{
@@ -157,10 +193,25 @@ size_t vis_register_count(Vis *vis, Register *reg)
 bool register_resize(Register *reg, size_t count)
 {
 	bool result = (VisDACount)count < reg->count;
-	if (result) reg->count = count;
+	if (result) {
+		for (VisDACount i = count; i < reg->count; i++) {
+			text_span_free(reg->data[i].span);
+			reg->data[i].span = NULL;
+		}
+		reg->count = count;
+	}
 	return result;
 }
 
+void register_release(Register *reg)
+{
+	for (VisDACount i = 0; i < reg->capacity; i++) {
+		buffer_release(&reg->data[i].buffer);
+		text_span_free(reg->data[i].span);
+	}
+	da_release(reg);
+}
+
 enum VisRegister vis_register_from(Vis *vis, char reg) {
 
 	if (reg == '@')
@@ -239,9 +290,10 @@ str8_list vis_register_get(Vis *vis, enum VisRegister id)
 	if (reg) {
 		da_reserve(vis, &result, reg->count);
 		for (VisDACount i = 0; i < reg->count; i++) {
+			register_slot_flatten(vis, reg, i);
 			*da_push(vis, &result) = (str8){
-				.length = reg->data[i].len,
-				.data   = (uint8_t *)reg->data[i].data,
+				.length = reg->data[i].buffer.len,
+				.data   = (uint8_t *)reg->data[i].buffer.data,
 			};
 		}
 	}
@@ -24,6 +24,22 @@
 #include "vis-subprocess.c"
 #include "vis-text-objects.c"
 
+/* files of at least this size are saved in the background by default */
+#ifndef VIS_SAVE_BACKGROUND
+#define VIS_SAVE_BACKGROUND (16 << 20)
+#endif
+
+/* capacity of the pipes to filters of ranges exceeding the default one */
+#ifndef VIS_PIPE_SIZE
+#define VIS_PIPE_SIZE (1 << 20)
+#endif
+#define VIS_PIPE_SIZE_DEFAULT (1 << 16)
+
+/* filters of sam commands are run one after another by default */
+#ifndef VIS_FILTER_JOBS
+#define VIS_FILTER_JOBS 1
+#endif
+
 /** window / file handling */
 
 static void file_free(Vis *vis, File *file) {
@@ -37,6 +53,12 @@ static void file_free(Vis *vis, File *file) {
 		vis_event_emit(vis, VIS_EVENT_FILE_CLOSE, file);
 	for (size_t i = 0; i < LENGTH(file->marks); i++)
 		da_release(file->marks + i);
+	if (file->load_fd != -1)
+		close(file->load_fd);
+	file_save_cancel(file);
+	if (file->swap)
+		unlink(file->swap);
+	free(file->swap);
 	text_free(file->text);
 	free((char*)file->name);
 
@@ -54,6 +76,7 @@ static File *file_new_text(Vis *vis, Text *text) {
 	if (!file)
 		return NULL;
 	file->fd = -1;
+	file->load_fd = -1;
 	file->text = text;
 	file->stat = text_stat(text);
 	if (vis->files)
@@ -63,6 +86,59 @@ static File *file_new_text(Vis *vis, Text *text) {
 	return file;
 }
 
+/* The undo history of a file is journaled in $XDG_STATE_HOME/vis/undo, which
+ * defaults to $HOME/.local/state/vis/undo, named after its absolute path with
+ * every '/' replaced by '%'. Journals only kept for crash recovery are stored
+ * in the swap directory next to it instead and removed once the file is closed. */
+static bool file_journal_open(File *file, bool swap) {
+	char path[PATH_MAX];
+	const char *state = getenv("XDG_STATE_HOME"), *home = getenv("HOME");
+	const char *dir = swap ? "swap" : "undo";
+	int len = -1;
+	if (state && *state)
+		len = snprintf(path, sizeof path, "%s/vis/%s/", state, dir);
+	else if (home && *home)
+		len = snprintf(path, sizeof path, "%s/.local/state/vis/%s/", home, dir);
+	if (len < 0 || len + strlen(file->name) >= sizeof path) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	for (char *slash = path + 1; (slash = strchr(slash, '/')); slash++) {
+		*slash = '\0';
+		int ret = mkdir(path, 0700);
+		*slash = '/';
+		if (ret == -1 && errno != EEXIST)
+			return false;
+	}
+	char *cur = path + len;
+	for (const char *name = file->name; *name; name++)
+		*cur++ = *name == '/' ? '%' : *name;
+	*cur = '\0';
+	if (!text_journal_open(file->text, AT_FDCWD, path))
+		return false;
+	if (swap)
+		file->swap = strdup(path);
+	return true;
+}
+
+static void file_journal_setup(Vis *vis, File *file) {
+	if (!vis->undofile && !vis->swapfile && !vis->recover)
+		return;
+	Text *text = file->text;
+	const char *name = file->name;
+	if (!file_journal_open(file, !vis->undofile)) {
+		if (errno == EAGAIN || errno == EACCES)
+			vis_info_show(vis, "Can't open journal: `%s' is edited in another session", name);
+		else
+			vis_info_show(vis, "Can't open journal: %s", strerror(errno));
+	} else if (vis->recover) {
+		if (text_journal_recover(text) == EPOS)
+			vis_info_show(vis, "No changes of `%s' to recover", name);
+	} else if (file->swap && text_journal_recoverable(text)) {
+		vis_info_show(vis, "Unsaved changes of `%s' found, recover them with `vis -r'", name);
+	}
+}
+
 static File *file_new(Vis *vis, const char *name, bool internal) {
 	char *name_absolute = NULL;
 	bool cmp_names = 0;
@@ -107,6 +183,8 @@ static File *file_new(Vis *vis, const char *name, bool internal) {
 		goto err;
 	file->name = name_absolute;
 	file->internal = internal;
+	if (!internal && name)
+		file_journal_setup(vis, file);
 	if (!internal)
 		vis_event_emit(vis, VIS_EVENT_FILE_OPEN, file);
 	return file;
@@ -312,6 +390,9 @@ void vis_window_draw(Win *win) {
 	if (!view_update(&win->view))
 		return;
 	Vis *vis = win->vis;
+	size_t changed = text_changed(win->file->text);
+	if (changed != EPOS)
+		vis_event_emit(vis, VIS_EVENT_FILE_CHANGE, win->file, changed);
 	vis_event_emit(vis, VIS_EVENT_WIN_HIGHLIGHT, win);
 
 	window_draw_colorcolumn(win);
@@ -367,12 +448,30 @@ bool vis_window_reload(Win *win) {
 	const char *name = win->file->name;
 	if (!name)
 		return false; /* can't reload unsaved file */
+	/* The new text opens the journal once the current one completed it and
+	 * stopped recording, otherwise their records would interleave. It is kept
+	 * by the current text if that remains in use by other windows. */
+	Vis *vis = win->vis;
+	bool undofile = vis->undofile, swapfile = vis->swapfile, recover = vis->recover;
+	vis->undofile = vis->swapfile = vis->recover = false;
 	/* temporarily unset file name, otherwise file_new returns the same File */
 	win->file->name = NULL;
-	File *file = file_new(win->vis, name, false);
+	File *file = file_new(vis, name, false);
 	win->file->name = name;
+	vis->undofile = undofile;
+	vis->swapfile = swapfile;
+	vis->recover = recover;
 	if (!file)
 		return false;
+	if (win->file->refcount == 1) {
+		if (!text_journal_close(win->file->text))
+			vis_info_show(vis, "Can't write journal of `%s': %s", name, strerror(errno));
+		file_journal_setup(vis, file);
+	}
+	if (win->file->swap && file->swap && strcmp(win->file->swap, file->swap) == 0) {
+		free(win->file->swap);
+		win->file->swap = NULL;
+	}
 	file_free(win->vis, win->file);
 	file->refcount = 1;
 	win->file = file;
@@ -469,8 +568,19 @@ bool vis_window_new_fd(Vis *vis, int fd) {
 	return true;
 }
 
+bool vis_window_load_fd(Vis *vis, int fd) {
+	if (fd == -1 || !vis->win || vis->win->file->load_fd != -1)
+		return false;
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags|O_NONBLOCK) == -1 ||
+	    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+		return false;
+	vis->win->file->load_fd = fd;
+	return true;
+}
+
 bool vis_window_closable(Win *win) {
-	if (!win || !text_modified(win->file->text))
+	if (!win || (!text_modified(win->file->text) && !win->file->save))
 		return true;
 	return win->file->refcount > 1;
 }
@@ -542,6 +652,8 @@ bool vis_init(Vis *vis)
 		return false;
 	ui_init(&vis->ui, vis);
 	vis->change_colors = true;
+	vis->save_background = VIS_SAVE_BACKGROUND;
+	vis->filter_jobs = VIS_FILTER_JOBS;
 	for (size_t i = 0; i < LENGTH(vis->registers); i++)
 		da_push(vis, vis->registers + i);
 	vis->registers[VIS_REG_BLACKHOLE].type = REGISTER_BLACKHOLE;
@@ -597,11 +709,8 @@ void vis_cleanup(Vis *vis)
 	file_free(vis, vis->search_file);
 	file_free(vis, vis->error_file);
 
-	for (int i = 0; i < LENGTH(vis->registers); i++) {
-		for (VisDACount j = 0; j < vis->registers[i].count; j++)
-			buffer_release(vis->registers[i].data + j);
-		da_release(vis->registers + i);
-	}
+	for (int i = 0; i < LENGTH(vis->registers); i++)
+		register_release(vis->registers + i);
 	ui_terminal_free(&vis->ui);
 	if (vis->usercmds) {
 		const char *name = 0;
@@ -643,13 +752,31 @@ void vis_insert_key(Vis *vis, const char *data, size_t len) {
 	Win *win = vis->win;
 	if (!win)
 		return;
+	/* selections are sorted, insert at all of them at once */
+	struct { size_t *data; VisDACount count, capacity; } positions = {0};
+	bool sorted = true;
 	for (Selection *s = view_selections(&win->view); s; s = view_selections_next(s)) {
 		size_t pos = view_cursors_pos(s);
-		if (pos != EPOS) {
-			vis_insert(vis, pos, data, len);
-			view_cursors_scroll_to(s, pos + len);
+		if (pos == EPOS || (positions.count > 0 && pos < positions.data[positions.count-1]))
+			sorted = false;
+		*da_push(vis, &positions) = pos;
+	}
+	if (sorted) {
+		text_insert_multi(vis, win->file->text, positions.data, positions.count, data, len);
+		vis_window_invalidate(win);
+		VisDACount i = 0;
+		for (Selection *s = view_selections(&win->view); s; s = view_selections_next(s), i++)
+			view_cursors_scroll_to(s, positions.data[i] + (i+1) * len);
+	} else {
+		for (Selection *s = view_selections(&win->view); s; s = view_selections_next(s)) {
+			size_t pos = view_cursors_pos(s);
+			if (pos != EPOS) {
+				vis_insert(vis, pos, data, len);
+				view_cursors_scroll_to(s, pos + len);
+			}
 		}
 	}
+	da_release(&positions);
 }
 
 void vis_replace(Vis *vis, size_t pos, const char *data, size_t len) {
@@ -1235,6 +1362,126 @@ bool vis_signal_handler(Vis *vis, int signum, const siginfo_t *siginfo, const vo
 	return false;
 }
 
+/* maximal number of bytes read per loading file before input is handled again */
+#ifndef VIS_LOAD_TICK
+#define VIS_LOAD_TICK (1 << 24)
+#endif
+
+/* add the descriptors of files which are still being loaded to fds */
+static int vis_load_before_tick(Vis *vis, fd_set *fds) {
+	int maxfd = 0;
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->load_fd != -1) {
+			FD_SET(file->load_fd, fds);
+			maxfd = MAX(maxfd, file->load_fd);
+		}
+	}
+	return maxfd;
+}
+
+/* append the available data of the loading files, at most VIS_LOAD_TICK
+ * bytes per file and tick such that key presses are still handled */
+static void vis_load_tick(Vis *vis, fd_set *fds) {
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->load_fd == -1 || !FD_ISSET(file->load_fd, fds))
+			continue;
+		ssize_t len = 0;
+		for (size_t loaded = 0; loaded < VIS_LOAD_TICK; loaded += len) {
+			len = text_load_fd(vis, file->text, file->load_fd, VIS_LOAD_TICK - loaded);
+			if (len <= 0)
+				break;
+		}
+		if (!text_loading(file->text)) {
+			if (len == -1)
+				vis_info_show(vis, "Can not read `%s': %s", file->name ? file->name : "-", strerror(errno));
+			close(file->load_fd);
+			file->load_fd = -1;
+		}
+		for (Win *win = vis->windows; win; win = win->next) {
+			if (win->file == file)
+				view_draw(&win->view);
+		}
+	}
+}
+
+/* add the pipes of the background saves, they become readable once done */
+static int vis_save_before_tick(Vis *vis, fd_set *fds) {
+	int maxfd = 0;
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->save) {
+			FD_SET(file->save->fd, fds);
+			maxfd = MAX(maxfd, file->save->fd);
+		}
+	}
+	return maxfd;
+}
+
+static void vis_save_tick(Vis *vis, fd_set *fds) {
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->save && FD_ISSET(file->save->fd, fds))
+			file_save_finish(vis, file);
+	}
+}
+
+/* minimal interval in seconds between syncs of the file journals */
+#ifndef VIS_JOURNAL_SYNC
+#define VIS_JOURNAL_SYNC 1
+#endif
+
+static bool timespec_less(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void vis_journal_sync(Vis *vis) {
+	for (File *file = vis->files; file; file = file->next) {
+		if (text_journal_pending(file->text) && !text_journal_sync(file->text))
+			vis_info_show(vis, "Can't write journal of `%s': %s", file->name, strerror(errno));
+	}
+}
+
+/* The journals collect the changes of every snapshot, they are written and
+ * synced at most every VIS_JOURNAL_SYNC seconds after the keys read so far
+ * were handled and the screen redrawn. Returns the time until the pending
+ * records are due or NULL if there are none. */
+static struct timespec *vis_journal_tick(Vis *vis, struct timespec *remaining) {
+	bool pending = false;
+	for (File *file = vis->files; file && !pending; file = file->next)
+		pending = text_journal_pending(file->text);
+	if (!pending)
+		return NULL;
+	struct timespec now, due = vis->journal_synced;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		return NULL;
+	due.tv_sec += VIS_JOURNAL_SYNC;
+	if (timespec_less(&now, &due)) {
+		remaining->tv_sec = due.tv_sec - now.tv_sec;
+		remaining->tv_nsec = due.tv_nsec - now.tv_nsec;
+		if (remaining->tv_nsec < 0) {
+			remaining->tv_sec--;
+			remaining->tv_nsec += 1000000000;
+		}
+		return remaining;
+	}
+	vis_journal_sync(vis);
+	vis->journal_synced = now;
+	return NULL;
+}
+
+/* Complete the journals with the changes since the last snapshot, before
+ * the editor terminates abnormally. They are kept for later recovery. */
+static void vis_journal_preserve(Vis *vis) {
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->internal)
+			continue;
+		/* records written so far are not affected if the snapshot fails */
+		text_journal_sync(file->text);
+		text_snapshot(file->text);
+		text_journal_sync(file->text);
+		free(file->swap);
+		file->swap = NULL;
+	}
+}
+
 int vis_run(Vis *vis) {
 	if (!vis->windows)
 		return EXIT_SUCCESS;
@@ -1243,8 +1490,8 @@ int vis_run(Vis *vis) {
 	vis->running = true;
 
 	if (setjmp(vis->oom_jmp_buf)) {
-		/* TODO: if we run out of memory here we may have files with unsaved changes.
-		 * ideally we need to try and save temporary versions somewhere for later recovery */
+		/* files with unsaved changes can be recovered from their journals */
+		vis_journal_preserve(vis);
 		vis_cleanup(vis);
 		vis_die(vis, "vis: out of memory\n");
 	}
@@ -1252,6 +1499,10 @@ int vis_run(Vis *vis) {
 	vis_event_emit(vis, VIS_EVENT_START);
 
 	struct timespec idle = { .tv_nsec = 0 }, *timeout = NULL;
+	/* refresh interval of the status bar while files are saved in the background */
+	struct timespec progress = { .tv_nsec = 250000000 };
+	/* time until the journals are synced */
+	struct timespec journal_due;
 
 	sigset_t emptyset;
 	sigemptyset(&emptyset);
@@ -1283,8 +1534,10 @@ int vis_run(Vis *vis) {
 			free(name);
 		}
 
-		if (vis->terminate)
+		if (vis->terminate) {
+			vis_journal_preserve(vis);
 			vis_die(vis, "Killed by SIGTERM\n");
+		}
 		if (vis->interrupted) {
 			vis->interrupted = false;
 			vis_keys_push(vis, "<C-c>", 0, true);
@@ -1302,22 +1555,35 @@ int vis_run(Vis *vis) {
 		}
 
 		ui_draw(&vis->ui);
+		struct timespec *journal = vis_journal_tick(vis, &journal_due);
 		idle.tv_sec = vis->mode->idle_timeout;
-		int r = pselect(vis_process_before_tick(&fds) + 1, &fds, NULL, NULL,
-		                timeout, &emptyset);
+		int maxfd = MAX(vis_process_before_tick(&fds), vis_load_before_tick(vis, &fds));
+		int savefd = vis_save_before_tick(vis, &fds);
+		maxfd = MAX(maxfd, savefd);
+		struct timespec *wait = timeout || !savefd ? timeout : &progress;
+		if (journal && (!wait || timespec_less(journal, wait)))
+			wait = journal;
+		int r = pselect(maxfd + 1, &fds, NULL, NULL, wait, &emptyset);
 		if (r == -1 && errno == EINTR)
 			continue;
 
 		if (r < 0) {
-			/* TODO save all pending changes to a ~suffixed file */
+			vis_journal_preserve(vis);
 			vis_die(vis, "Error in mainloop: %s\n", strerror(errno));
 		}
 		vis_process_tick(vis, &fds);
+		vis_load_tick(vis, &fds);
+		vis_save_tick(vis, &fds);
 
 		if (!FD_ISSET(STDIN_FILENO, &fds)) {
-			if (vis->mode->idle)
-				vis->mode->idle(vis);
-			timeout = NULL;
+			/* data of a load, save or process arrived, the save progress
+			 * needs to be redrawn or the journals synced, none of which
+			 * ends the idle period */
+			if (r == 0 && wait == timeout) {
+				if (vis->mode->idle)
+					vis->mode->idle(vis);
+				timeout = NULL;
+			}
 			continue;
 		}
 
@@ -1339,8 +1605,10 @@ Macro *macro_get(Vis *vis, enum VisRegister id)
 		return vis->last_recording;
 	if (VIS_REG_A <= id && id <= VIS_REG_Z)
 		id -= VIS_REG_A;
-	if (id < LENGTH(vis->registers))
-		return vis->registers[id].data;
+	if (id < LENGTH(vis->registers)) {
+		register_slot_flatten(vis, &vis->registers[id], 0);
+		return &vis->registers[id].data->buffer;
+	}
 	return NULL;
 }
 
@@ -1562,24 +1830,20 @@ Regex *vis_regex(Vis *vis, const char *pattern) {
 	return regex;
 }
 
-static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, const char *argv[],
-	void *stdout_context, ssize_t (*read_stdout)(void *stdout_context, char *data, size_t len),
-	void *stderr_context, ssize_t (*read_stderr)(void *stderr_context, char *data, size_t len),
-	bool fullscreen) {
+/* fork and execute the filter, its input is the keyboard if interactive */
+static bool filter_start(Vis *vis, Filter *f, bool interactive) {
+	int pin[2], pout[2], perr[2];
 
-	/* if an invalid range was given, stdin (i.e. key board input) is passed
-	 * through the external command. */
-	Text *text = file != NULL ? file->text : NULL;
-	int pin[2], pout[2], perr[2], status = -1;
-	bool interactive = buf == NULL && (range == NULL || !text_range_valid(range));
-	Filerange rout = (interactive  || buf != NULL) ? text_range_new(0, 0) : *range;
+	f->pid = -1;
+	f->in = f->out = f->err = -1;
+	f->status = -1;
 
 	if (pipe(pin) == -1)
-		return -1;
+		return false;
 	if (pipe(pout) == -1) {
 		close(pin[0]);
 		close(pin[1]);
-		return -1;
+		return false;
 	}
 
 	if (pipe(perr) == -1) {
@@ -1587,10 +1851,9 @@ static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, co
 		close(pin[1]);
 		close(pout[0]);
 		close(pout[1]);
-		return -1;
+		return false;
 	}
 
-	ui_terminal_save(&vis->ui, fullscreen);
 	pid_t pid = fork();
 
 	if (pid == -1) {
@@ -1601,7 +1864,7 @@ static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, co
 		close(perr[0]);
 		close(perr[1]);
 		vis_info_show(vis, "fork failure: %s", strerror(errno));
-		return -1;
+		return false;
 	} else if (pid == 0) { /* child i.e filter */
 		sigset_t sigterm_mask;
 		sigemptyset(&sigterm_mask);
@@ -1623,7 +1886,7 @@ static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, co
 			 * closed. Some programs behave differently when used
 			 * in a pipeline.
 			 */
-			if (range && text_range_size(range) == 0)
+			if (!f->buf && text_range_size(&f->range) == 0)
 				dup2(null, STDIN_FILENO);
 			else
 				dup2(pin[0], STDIN_FILENO);
@@ -1640,7 +1903,7 @@ static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, co
 			 * ensure that the complete output is visible.
 			 */
 			while(write(STDOUT_FILENO, " ", 1) == -1 && errno == EINTR);
-		} else if (read_stdout) {
+		} else if (f->read_stdout || f->stdout_buffer || f->stdout_span) {
 			dup2(pout[1], STDOUT_FILENO);
 		} else {
 			dup2(null, STDOUT_FILENO);
@@ -1648,7 +1911,7 @@ static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, co
 		close(pout[1]);
 		close(pout[0]);
 		if (!interactive) {
-			if (read_stderr)
+			if (f->read_stderr || f->stderr_buffer)
 				dup2(perr[1], STDERR_FILENO);
 			else
 				dup2(null, STDERR_FILENO);
@@ -1657,12 +1920,14 @@ static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, co
 		close(perr[1]);
 		close(null);
 
+		File *file = f->file;
 		if (file != NULL && file->name) {
 			char *name = strrchr(file->name, '/');
 			setenv("vis_filepath", file->name, 1);
 			setenv("vis_filename", name ? name+1 : file->name, 1);
 		}
 
+		const char **argv = f->argv;
 		if (!argv[1])
 			execlp(vis->shell, vis->shell, "-c", argv[0], (char*)NULL);
 		else
@@ -1671,125 +1936,140 @@ static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, co
 		exit(EXIT_FAILURE);
 	}
 
-	vis->interrupted = false;
-
 	close(pin[0]);
 	close(pout[1]);
 	close(perr[1]);
 
-	if (fcntl(pout[0], F_SETFL, O_NONBLOCK) == -1 ||
-	    fcntl(perr[0], F_SETFL, O_NONBLOCK) == -1)
-		goto err;
-
-	fd_set rfds, wfds;
+	f->pid = pid;
+	f->in = pin[1];
+	f->out = pout[0];
+	f->err = perr[0];
+	f->stdout_size = text_range_size(&f->range);
+
+#if CONFIG_SPLICE
+	/* move large ranges in fewer chunks than the default capacity allows,
+	 * failure is harmless since the size is limited for unprivileged users */
+	if (text_range_size(&f->range) > VIS_PIPE_SIZE_DEFAULT) {
+		fcntl(f->in, F_SETPIPE_SZ, VIS_PIPE_SIZE);
+		fcntl(f->out, F_SETPIPE_SZ, VIS_PIPE_SIZE);
+	}
+#endif
+
+	/* data is transferred without blocking, filters started later must not
+	 * inherit our ends of the pipes, otherwise the input of this one
+	 * would never be closed */
+	if (fcntl(f->in, F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(f->out, F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(f->err, F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(f->in, F_SETFD, FD_CLOEXEC) == -1 ||
+	    fcntl(f->out, F_SETFD, FD_CLOEXEC) == -1 ||
+	    fcntl(f->err, F_SETFD, FD_CLOEXEC) == -1) {
+		close(f->in);
+		close(f->out);
+		close(f->err);
+		f->in = f->out = f->err = -1;
+	}
 
-	do {
-		if (vis->interrupted) {
-			kill(0, SIGTERM);
-			break;
-		}
+	return true;
+}
 
-		FD_ZERO(&rfds);
-		FD_ZERO(&wfds);
-		if (pin[1] != -1)
-			FD_SET(pin[1], &wfds);
-		if (pout[0] != -1)
-			FD_SET(pout[0], &rfds);
-		if (perr[0] != -1)
-			FD_SET(perr[0], &rfds);
-
-		if (select(FD_SETSIZE, &rfds, &wfds, NULL, NULL) == -1) {
-			if (errno == EINTR)
-				continue;
-			vis_info_show(vis, "Select failure");
-			break;
-		}
+static bool filter_running(Filter *f) {
+	return f->in != -1 || f->out != -1 || f->err != -1;
+}
+
+static int filter_fds(Filter *f, fd_set *rfds, fd_set *wfds) {
+	if (f->in != -1)
+		FD_SET(f->in, wfds);
+	if (f->out != -1)
+		FD_SET(f->out, rfds);
+	if (f->err != -1)
+		FD_SET(f->err, rfds);
+	return MAX(f->in, MAX(f->out, f->err));
+}
+
+/* read the available output of a filter, collected output is read in place */
+static void filter_read(Vis *vis, Filter *f, int *fd, TextSpan **span, Buffer *buffer, void *context,
+	ssize_t (*read_data)(void *context, char *data, size_t len), const char *name) {
+	char buf[BUFSIZ];
+	ssize_t len;
+	if (span) {
+		/* once output arrives, make room for the rest of the expected size */
+		size_t stored = *span ? text_span_size(*span) : 0;
+		size_t size = stored > 0 && stored < f->stdout_size ? f->stdout_size - stored : 0;
+		len = text_span_read(vis, f->file->text, span, *fd, MAX(size, sizeof buf));
+	} else if (buffer) {
+		len = buffer_read(buffer, *fd, sizeof buf);
+	} else if ((len = read(*fd, buf, sizeof buf)) > 0 && read_data) {
+		(*read_data)(context, buf, len);
+	}
 
-		if (pin[1] != -1 && FD_ISSET(pin[1], &wfds)) {
-			ssize_t written = 0;
-			Filerange junk = rout;
-			if (text_range_size(&rout)) {
-				if (junk.end > junk.start + PIPE_BUF)
-					junk.end = junk.start + PIPE_BUF;
-				written = text_write_range(text, &junk, pin[1]);
-				if (written > 0) {
-					rout.start += written;
-					if (text_range_size(&rout) == 0) {
-						close(pin[1]);
-						pin[1] = -1;
-					}
-				}
-			} else if (buf != NULL) {
-				size_t len = strlen(buf);
-				if (len > 0) {
-					if (len > PIPE_BUF)
-						len = PIPE_BUF;
-
-					written = write_all(pin[1], buf, len);
-					if (written > 0) {
-						buf += written;
-					}
-				}
-			}
+	if (len == 0) {
+		close(*fd);
+		*fd = -1;
+	} else if (len == -1 && errno != EINTR && errno != EWOULDBLOCK) {
+		vis_info_show(vis, "Error reading from filter %s", name);
+		close(*fd);
+		*fd = -1;
+	}
+}
 
-			if (written <= 0) {
-				close(pin[1]);
-				pin[1] = -1;
-				if (written == -1)
-					vis_info_show(vis, "Error writing to external command");
-			}
+/* write as much input as the pipe accepts and read the available output */
+static void filter_io(Vis *vis, Filter *f, fd_set *rfds, fd_set *wfds) {
+	if (f->in != -1 && FD_ISSET(f->in, wfds)) {
+		ssize_t written = 0;
+		if (text_range_size(&f->range)) {
+			written = text_pipe_range(f->file->text, &f->range, f->in);
+			if (written > 0)
+				f->range.start += written;
+		} else if (f->buf != NULL) {
+			size_t len = strlen(f->buf);
+			if (len > 0)
+				written = write(f->in, f->buf, len);
+			if (written > 0)
+				f->buf += written;
 		}
 
-		if (pout[0] != -1 && FD_ISSET(pout[0], &rfds)) {
-			char buf[BUFSIZ];
-			ssize_t len = read(pout[0], buf, sizeof buf);
-			if (len > 0) {
-				if (read_stdout)
-					(*read_stdout)(stdout_context, buf, len);
-			} else if (len == 0) {
-				close(pout[0]);
-				pout[0] = -1;
-			} else if (errno != EINTR && errno != EWOULDBLOCK) {
-				vis_info_show(vis, "Error reading from filter stdout");
-				close(pout[0]);
-				pout[0] = -1;
-			}
+		bool done = text_range_size(&f->range) == 0 && (!f->buf || !*f->buf);
+		bool full = written == -1 && (errno == EAGAIN || errno == EINTR);
+		if (done || (written <= 0 && !full)) {
+			close(f->in);
+			f->in = -1;
+			if (written == -1 && !full)
+				vis_info_show(vis, "Error writing to external command");
 		}
+	}
 
-		if (perr[0] != -1 && FD_ISSET(perr[0], &rfds)) {
-			char buf[BUFSIZ];
-			ssize_t len = read(perr[0], buf, sizeof buf);
-			if (len > 0) {
-				if (read_stderr)
-					(*read_stderr)(stderr_context, buf, len);
-			} else if (len == 0) {
-				close(perr[0]);
-				perr[0] = -1;
-			} else if (errno != EINTR && errno != EWOULDBLOCK) {
-				vis_info_show(vis, "Error reading from filter stderr");
-				close(perr[0]);
-				perr[0] = -1;
-			}
-		}
+	if (f->out != -1 && FD_ISSET(f->out, rfds))
+		filter_read(vis, f, &f->out, f->stdout_span, f->stdout_buffer, f->stdout_context, f->read_stdout, "stdout");
 
-	} while (pin[1] != -1 || pout[0] != -1 || perr[0] != -1);
+	if (f->err != -1 && FD_ISSET(f->err, rfds))
+		filter_read(vis, f, &f->err, NULL, f->stderr_buffer, f->stderr_context, f->read_stderr, "stderr");
+}
 
-err:
-	if (pin[1] != -1)
-		close(pin[1]);
-	if (pout[0] != -1)
-		close(pout[0]);
-	if (perr[0] != -1)
-		close(perr[0]);
+/* close the remaining pipes and collect the exit status */
+static void filter_wait(Vis *vis, Filter *f) {
+	if (f->in != -1)
+		close(f->in);
+	if (f->out != -1)
+		close(f->out);
+	if (f->err != -1)
+		close(f->err);
+	f->in = f->out = f->err = -1;
 
+	int status = -1;
 	for (;;) {
 		if (vis->interrupted)
 			kill(0, SIGTERM);
-		pid_t died = waitpid(pid, &status, 0);
-		if ((died == -1 && errno == ECHILD) || pid == died)
+		pid_t died = waitpid(f->pid, &status, 0);
+		if ((died == -1 && errno == ECHILD) || f->pid == died)
 			break;
 	}
 
+	f->pid = -1;
+	f->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void filter_finish(Vis *vis) {
 	/* clear any pending SIGTERM */
 	struct sigaction sigterm_ignore, sigterm_old;
 	sigterm_ignore.sa_handler = SIG_IGN;
@@ -1801,11 +2081,141 @@ err:
 
 	vis->interrupted = false;
 	ui_terminal_restore(&vis->ui);
+}
 
-	if (WIFEXITED(status))
-		return WEXITSTATUS(status);
+/* run a single filter, if neither data nor a valid range is given, stdin
+ * (i.e. key board input) is passed through the external command. */
+int vis_pipe_filter(Vis *vis, Filter *f, bool fullscreen) {
+	bool interactive = f->buf == NULL && !text_range_valid(&f->range);
+	if (interactive)
+		f->range = text_range_new(0, 0);
 
-	return -1;
+	ui_terminal_save(&vis->ui, fullscreen);
+	if (!filter_start(vis, f, interactive)) {
+		ui_terminal_restore(&vis->ui);
+		return -1;
+	}
+
+	vis->interrupted = false;
+
+	fd_set rfds, wfds;
+
+	while (filter_running(f)) {
+		if (vis->interrupted) {
+			kill(0, SIGTERM);
+			break;
+		}
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		int maxfd = filter_fds(f, &rfds, &wfds);
+
+		if (select(maxfd + 1, &rfds, &wfds, NULL, NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			vis_info_show(vis, "Select failure");
+			break;
+		}
+
+		filter_io(vis, f, &rfds, &wfds);
+	}
+
+	filter_wait(vis, f);
+	filter_finish(vis);
+	return f->status;
+}
+
+static int _vis_pipe(Vis *vis, File *file, Filerange *range, const char* buf, const char *argv[],
+	void *stdout_context, ssize_t (*read_stdout)(void *stdout_context, char *data, size_t len),
+	void *stderr_context, ssize_t (*read_stderr)(void *stderr_context, char *data, size_t len),
+	bool fullscreen) {
+	Filter f = {
+		.file = file,
+		.range = buf != NULL ? text_range_new(0, 0) : range ? *range : text_range_empty(),
+		.buf = buf,
+		.argv = argv,
+		.stdout_context = stdout_context,
+		.read_stdout = read_stdout,
+		.stderr_context = stderr_context,
+		.read_stderr = read_stderr,
+	};
+	return vis_pipe_filter(vis, &f, fullscreen);
+}
+
+/* run all filters with at most jobs of them at the same time, false if
+ * interrupted in which case the status of the remaining ones is -1 */
+bool vis_pipe_all(Vis *vis, Filter *filters[], size_t count, size_t jobs) {
+	/* every running filter occupies three descriptors, which select(2) can only watch up to FD_SETSIZE */
+	jobs = MIN(MAX(jobs, 1), FD_SETSIZE / 4);
+	size_t first = 0, next = 0, running = 0;
+	bool failure = false;
+
+	for (size_t i = 0; i < count; i++) {
+		filters[i]->pid = -1;
+		filters[i]->status = -1;
+	}
+
+	ui_terminal_save(&vis->ui, false);
+	vis->interrupted = false;
+
+	fd_set rfds, wfds;
+
+	while (!vis->interrupted && !failure) {
+		for (; next < count && running < jobs; next++) {
+			Filter *f = filters[next];
+			if (!filter_start(vis, f, false))
+				continue;
+			if (filter_running(f))
+				running++;
+			else
+				filter_wait(vis, f);
+		}
+		if (!running)
+			break;
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		int maxfd = -1;
+		while (filters[first]->pid == -1)
+			first++;
+		for (size_t i = first; i < next; i++) {
+			if (filters[i]->pid != -1)
+				maxfd = MAX(maxfd, filter_fds(filters[i], &rfds, &wfds));
+		}
+
+		if (select(maxfd + 1, &rfds, &wfds, NULL, NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			vis_info_show(vis, "Select failure");
+			failure = true;
+			break;
+		}
+
+		for (size_t i = first; i < next; i++) {
+			Filter *f = filters[i];
+			if (f->pid == -1)
+				continue;
+			filter_io(vis, f, &rfds, &wfds);
+			if (!filter_running(f)) {
+				filter_wait(vis, f);
+				running--;
+			}
+		}
+	}
+
+	/* terminate the filters which were aborted */
+	bool interrupted = vis->interrupted;
+	for (size_t i = first; i < next; i++) {
+		Filter *f = filters[i];
+		if (f->pid == -1)
+			continue;
+		if (!interrupted)
+			kill(f->pid, SIGTERM);
+		filter_wait(vis, f);
+	}
+
+	filter_finish(vis);
+	return !interrupted && !failure;
 }
 
 int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
@@ -1824,10 +2234,15 @@ int vis_pipe_buf(Vis *vis, const char* buf, const char *argv[],
 
 static int _vis_pipe_collect(Vis *vis, File *file, Filerange *range, const char* buf, const char *argv[], char **out, char **err, bool fullscreen) {
 	Buffer bufout = {0}, buferr = {0};
-	int status = _vis_pipe(vis, file, range, buf, argv,
-	                      &bufout, out ? read_into_buffer : NULL,
-	                      &buferr, err ? read_into_buffer : NULL,
-	                      fullscreen);
+	Filter f = {
+		.file = file,
+		.range = buf != NULL ? text_range_new(0, 0) : range ? *range : text_range_empty(),
+		.buf = buf,
+		.argv = argv,
+		.stdout_buffer = out ? &bufout : NULL,
+		.stderr_buffer = err ? &buferr : NULL,
+	};
+	int status = vis_pipe_filter(vis, &f, fullscreen);
 	buffer_terminate(&bufout);
 	buffer_terminate(&buferr);
 	if (out) *out = bufout.data;
@@ -1865,7 +2280,12 @@ bool vis_cmd(Vis *vis, const char *cmdline) {
 }
 
 void vis_file_snapshot(Vis *vis, File *file) {
-	if (!vis->replaying)
+	const TextHistoryLimit *limit = &vis->history_limit;
+	if (vis->replaying)
+		return;
+	if (limit->revisions || limit->age || limit->bytes)
+		text_history_compact(file->text, limit);
+	else
 		text_snapshot(file->text);
 }
 
@@ -195,6 +195,16 @@ VIS_EXPORT bool vis_window_new(Vis *vis, const char *filename);
  * @endrst
  */
 VIS_EXPORT bool vis_window_new_fd(Vis *vis, int fd);
+/**
+ * Read the content of the current window's file from a file descriptor.
+ * @param vis The editor instance.
+ * @param fd The file descriptor to read from, it is closed at end of file.
+ * @rst
+ * .. note:: The data is appended in the background while the editor keeps
+ * handling input. Until end of file is reached the file can not be modified.
+ * @endrst
+ */
+VIS_EXPORT bool vis_window_load_fd(Vis *vis, int fd);
 /**
  * Reload the file currently displayed in the window from disk.
  * @param win The window to reload.